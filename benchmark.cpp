@@ -0,0 +1,431 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  Benchmark Suite
+ *  Runs a fixed corpus of equation shapes through compilation, single row evaluation, batch evaluation and parallel batch
+ *  evaluation, and writes the results as JSON so that runs of different releases can be compared.
+ *
+ *  Every measurement repeats until it has run for a minimum time, so short operations are timed over many calls. Latencies
+ *  are reported as percentiles over samples, throughputs as rows per second over all repetitions.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+
+#include "source/libSimpleMath.hpp"
+
+using namespace std;
+using namespace smath;
+
+// Rows of generated input, which is also the largest batch and the size of the parallel runs
+#define BENCH_ROWS   1048576
+
+// Single row evaluations per latency sample, so that the clock is read far less often than the equation is evaluated
+#define BENCH_INNER  32
+
+typedef chrono::steady_clock bclock_t;
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Corpus
+ * ========
+ *  Each case stresses a different part of the library: instruction dispatch, stack depth, the vector math functions,
+ *  column handling, and conditionals.
+ */
+
+struct benchCase {
+    const char* name;
+    const char* equation;
+    const char* variables;
+};
+
+static const benchCase s_Corpus[] = {
+    {"arithmetic",
+     "a + x*y - z/2",
+     "a,x,y,z"},
+    {"nested",
+     "((((((((x+1)*y-2)/(1+z*z)+3)*x-4)*y+5)/(1+z*z)-6)*x+7)*y-8)/(1+x*x)",
+     "x,y,z"},
+    {"transcendental",
+     "sin(x)*cos(y) + exp(-z*z)*log(1+x*x) + atan2(y,x) + tan(z/4)",
+     "x,y,z"},
+    {"many_variables",
+     "v0*v1 + v2*v3 - v4*v5 + v6/(1+v7*v7) + v8*v9 - v10*v11 + v12*v13 - v14/(1+v15*v15)",
+     "v0,v1,v2,v3,v4,v5,v6,v7,v8,v9,v10,v11,v12,v13,v14,v15"},
+    {"branchy",
+     "if(x > 0, if(y > 0, x*y, x-y), if(z > 0.5, sin(x), cos(y))) + if(x < y && y < z, x, z)",
+     "x,y,z"},
+};
+
+struct benchStats {
+    double_t p50;
+    double_t p99;
+    double_t mean;
+    size_t   samples;
+};
+
+struct benchOptions {
+    double_t  minTime    = 0.25;
+    size_t    maxThreads = max(1u, thread::hardware_concurrency());
+    vstring_t cases;
+};
+
+// Results are summed into this, so the compiler can not drop the evaluations
+static volatile double_t s_Sink = 0.0;
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: secondsSince
+ * ==========================
+ */
+
+static double_t secondsSince(bclock_t::time_point tStart) {
+    return chrono::duration<double_t>(bclock_t::now() - tStart).count();
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: makeStats
+ * =======================
+ *  Sorts the samples and picks the percentiles by rank
+ */
+
+static benchStats makeStats(vdouble_t& vdSamples) {
+
+    benchStats bsOut = {0.0, 0.0, 0.0, vdSamples.size()};
+    if(vdSamples.empty()) return bsOut;
+
+    sort(vdSamples.begin(), vdSamples.end());
+    for(double_t dVal : vdSamples) bsOut.mean += dVal;
+
+    size_t nLast = vdSamples.size() - 1;
+    bsOut.mean  /= vdSamples.size();
+    bsOut.p50    = vdSamples[nLast*50/100];
+    bsOut.p99    = vdSamples[nLast*99/100];
+
+    return bsOut;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: splitNames
+ * ========================
+ */
+
+static vstring_t splitNames(const char* pNames) {
+
+    vstring_t vsOut;
+    string    sName;
+
+    for(const char* pChar=pNames; ; pChar++) {
+        if(*pChar == ',' || *pChar == '\0') {
+            vsOut.push_back(sName);
+            sName.clear();
+            if(*pChar == '\0') break;
+        } else {
+            sName += *pChar;
+        }
+    }
+
+    return vsOut;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: benchCompile
+ * ==========================
+ *  Time to parse and compile the equation into a program for the given backend, one fresh Math object per sample so that
+ *  nothing is reused between samples
+ */
+
+static benchStats benchCompile(const benchCase& bcCase, value_t idBackend, const benchOptions& boOpts) {
+
+    vstring_t vsVars = splitNames(bcCase.variables);
+    vdouble_t vdSamples;
+
+    auto tStart = bclock_t::now();
+    while(vdSamples.size() < 10 || secondsSince(tStart) < boOpts.minTime) {
+        auto tSample = bclock_t::now();
+        Math mEq;
+        mEq.setBackend(idBackend);
+        mEq.setVariables(vsVars);
+        mEq.setEquation(bcCase.equation);
+        vdSamples.push_back(1e6*secondsSince(tSample));
+    }
+
+    return makeStats(vdSamples);
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: benchEval
+ * =======================
+ *  Latency of evalEquation on one row of values, cycling through the rows of the input
+ */
+
+static benchStats benchEval(SimpleMath& smLib, size_t idEQ, const vdouble_t& vdRows, size_t nVars,
+                            const benchOptions& boOpts) {
+
+    vdouble_t vdSamples;
+    size_t    nRows  = vdRows.size()/nVars;
+    size_t    iRow   = 0;
+    double_t  dSum   = 0.0;
+
+    auto tStart = bclock_t::now();
+    while(vdSamples.size() < 100 || secondsSince(tStart) < boOpts.minTime) {
+        auto tSample = bclock_t::now();
+        for(size_t i=0; i<BENCH_INNER; i++) {
+            dSum += smLib.evalEquation(idEQ, &vdRows[iRow*nVars], nVars);
+            iRow  = iRow+1 < nRows ? iRow+1 : 0;
+        }
+        vdSamples.push_back(1e9*secondsSince(tSample)/BENCH_INNER);
+    }
+    s_Sink = s_Sink + dSum;
+
+    return makeStats(vdSamples);
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: benchBatch
+ * ========================
+ *  Rows per second of evalEquationBatch, or of evalEquationParallel when nThreads is not 0, on batches of nRows rows
+ */
+
+static double_t benchBatch(SimpleMath& smLib, size_t idEQ, const vector<const double_t*>& vpCols, size_t nRows,
+                           size_t nThreads, vdouble_t& vdOut, const benchOptions& boOpts) {
+
+    vector<const double_t*> vpBatch(vpCols.size());
+    size_t nTotal = 0;
+    size_t nCalls = 0;
+    size_t nInner = max((size_t)1, (size_t)4096/nRows);
+
+    // Small batches are run several to a clock reading, and walk through the input so that they are not all served from the
+    // same cache lines
+    auto tStart = bclock_t::now();
+    while(nCalls < 3 || secondsSince(tStart) < boOpts.minTime) {
+        for(size_t k=0; k<nInner; k++) {
+            size_t iRow = (nCalls*nRows) % (BENCH_ROWS - nRows + 1);
+            for(size_t v=0; v<vpCols.size(); v++) vpBatch[v] = vpCols[v] + iRow;
+            if(nThreads == 0) {
+                smLib.evalEquationBatch(idEQ, vpBatch.data(), nRows, vdOut.data());
+            } else {
+                smLib.evalEquationParallel(idEQ, vpBatch.data(), nRows, vdOut.data(), nThreads);
+            }
+            nTotal += nRows;
+            nCalls++;
+        }
+    }
+    s_Sink = s_Sink + vdOut[0];
+
+    return nTotal/secondsSince(tStart);
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  JSON Output
+ * =============
+ */
+
+static string jsonString(const char* pText) {
+
+    string sOut = "\"";
+    for(const char* pChar=pText; *pChar; pChar++) {
+        if(*pChar == '"' || *pChar == '\\') sOut += '\\';
+        sOut += *pChar;
+    }
+    sOut += '"';
+
+    return sOut;
+}
+
+static void jsonStats(FILE* pOut, const benchStats& bsStats) {
+    fprintf(pOut, "{\"p50\": %.4g, \"p99\": %.4g, \"mean\": %.4g, \"samples\": %zu}",
+        bsStats.p50, bsStats.p99, bsStats.mean, bsStats.samples);
+}
+
+// ****************************************************************************************************************************** //
+
+static void printUsage() {
+    printf("Usage: benchmark.e [options]\n");
+    printf("Benchmarks compilation and evaluation on a fixed set of equations, and writes the results as JSON.\n\n");
+    printf("  -o file       Write the results to file instead of stdout\n");
+    printf("  -c case       Run only the named case, can be repeated:");
+    for(const auto& bcCase : s_Corpus) printf(" %s", bcCase.name);
+    printf("\n");
+    printf("  -t threads    Largest thread count of the scaling runs, default one per hardware thread\n");
+    printf("  -m seconds    Minimum time of each measurement, default 0.25\n");
+    printf("  -q            Quick run with a minimum time of 0.02 s\n");
+}
+
+int main(int argc, char const *argv[]) {
+
+    benchOptions boOpts;
+    string       sOutput;
+
+    for(int i=1; i<argc; i++) {
+        string sArg = argv[i];
+        bool   hasValue = i+1 < argc;
+        if(sArg == "-o" && hasValue) {
+            sOutput = argv[++i];
+        } else
+        if(sArg == "-c" && hasValue) {
+            boOpts.cases.push_back(argv[++i]);
+        } else
+        if(sArg == "-t" && hasValue) {
+            boOpts.maxThreads = max(1, atoi(argv[++i]));
+        } else
+        if(sArg == "-m" && hasValue) {
+            boOpts.minTime = max(0.0, atof(argv[++i]));
+        } else
+        if(sArg == "-q") {
+            boOpts.minTime = 0.02;
+        } else
+        if(sArg == "-h" || sArg == "--help") {
+            printUsage();
+            return 0;
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    for(const auto& sCase : boOpts.cases) {
+        bool isKnown = false;
+        for(const auto& bcCase : s_Corpus) isKnown = isKnown || sCase == bcCase.name;
+        if(!isKnown) {
+            fprintf(stderr, "Error: Unknown case '%s'\n", sCase.c_str());
+            return 1;
+        }
+    }
+
+    FILE* pOut = sOutput.empty() ? stdout : fopen(sOutput.c_str(), "w");
+    if(pOut == nullptr) {
+        fprintf(stderr, "Error: Cannot open %s\n", sOutput.c_str());
+        return 1;
+    }
+
+    // The same generated columns are used for every case, with as many columns as the widest case needs
+    size_t nMaxVars = 0;
+    for(const auto& bcCase : s_Corpus) nMaxVars = max(nMaxVars, splitNames(bcCase.variables).size());
+
+    mt19937_64                          rGen(1);
+    uniform_real_distribution<double_t> rDist(-2.0, 2.0);
+    vector<vdouble_t>                   vdCols(nMaxVars, vdouble_t(BENCH_ROWS));
+    for(auto& vdCol : vdCols) {
+        for(auto& dVal : vdCol) dVal = rDist(rGen);
+    }
+    vdouble_t vdOut(BENCH_ROWS);
+
+    const size_t  aSizes[]    = {1, 16, 256, 4096, 65536, BENCH_ROWS};
+    const char*   aBackends[] = {"stack", "register", "jit"};
+    const value_t aIds[]      = {MB_STACK, MB_REGISTER, MB_JIT};
+
+    char   aTime[32];
+    time_t tNow = time(nullptr);
+    strftime(aTime, sizeof(aTime), "%Y-%m-%dT%H:%M:%SZ", gmtime(&tNow));
+    const char* pSimd = getenv("SMATH_SIMD");
+
+    fprintf(pOut, "{\n");
+    fprintf(pOut, "  \"benchmark\": \"libEqNibbler\",\n");
+    fprintf(pOut, "  \"format\": 1,\n");
+    fprintf(pOut, "  \"timestamp\": \"%s\",\n", aTime);
+#ifdef __VERSION__
+    fprintf(pOut, "  \"compiler\": %s,\n", jsonString(__VERSION__).c_str());
+#endif
+    fprintf(pOut, "  \"hardware_threads\": %u,\n", thread::hardware_concurrency());
+    fprintf(pOut, "  \"simd\": %s,\n", jsonString(pSimd ? pSimd : "auto").c_str());
+    fprintf(pOut, "  \"min_time_s\": %g,\n", boOpts.minTime);
+    fprintf(pOut, "  \"cases\": [");
+
+    bool isFirst = true;
+    for(const auto& bcCase : s_Corpus) {
+
+        if(!boOpts.cases.empty() && find(boOpts.cases.begin(), boOpts.cases.end(), bcCase.name) == boOpts.cases.end()) {
+            continue;
+        }
+        fprintf(stderr, "Running %s\n", bcCase.name);
+
+        vstring_t vsVars = splitNames(bcCase.variables);
+        size_t    nVars  = vsVars.size();
+
+        SimpleMath smLib;
+        size_t     idEQ = smLib.addEquation(bcCase.equation, vsVars);
+        if(!smLib.getProgram(idEQ)) {
+            fprintf(stderr, "Error: Case %s does not compile\n", bcCase.name);
+            return 1;
+        }
+
+        // Row-major copy of the input for single row evaluation
+        vdouble_t vdRows(BENCH_ROWS*nVars);
+        vector<const double_t*> vpCols;
+        for(size_t v=0; v<nVars; v++) {
+            for(size_t i=0; i<BENCH_ROWS; i++) vdRows[i*nVars+v] = vdCols[v][i];
+            vpCols.push_back(vdCols[v].data());
+        }
+
+        fprintf(pOut, "%s\n    {\n", isFirst ? "" : ",");
+        fprintf(pOut, "      \"name\": %s,\n", jsonString(bcCase.name).c_str());
+        fprintf(pOut, "      \"equation\": %s,\n", jsonString(bcCase.equation).c_str());
+        fprintf(pOut, "      \"variables\": %zu,\n", nVars);
+        isFirst = false;
+
+        // Backends that are not available, like the JIT on other platforms, are left out
+        fprintf(pOut, "      \"compile_us\": {");
+        for(int b=0; b<3; b++) {
+            if(!smLib.setBackend(idEQ, aIds[b]) || smLib.getBackend(idEQ) != aIds[b]) continue;
+            fprintf(pOut, "%s\n        \"%s\": ", b > 0 ? "," : "", aBackends[b]);
+            jsonStats(pOut, benchCompile(bcCase, aIds[b], boOpts));
+        }
+        fprintf(pOut, "\n      },\n");
+
+        fprintf(pOut, "      \"eval_ns\": {");
+        for(int b=0; b<3; b++) {
+            if(!smLib.setBackend(idEQ, aIds[b]) || smLib.getBackend(idEQ) != aIds[b]) continue;
+            fprintf(pOut, "%s\n        \"%s\": ", b > 0 ? "," : "", aBackends[b]);
+            jsonStats(pOut, benchEval(smLib, idEQ, vdRows, nVars, boOpts));
+        }
+        fprintf(pOut, "\n      },\n");
+        smLib.setBackend(idEQ, MB_STACK);
+
+        fprintf(pOut, "      \"batch\": [");
+        for(size_t s=0; s<sizeof(aSizes)/sizeof(*aSizes); s++) {
+            double_t dRate = benchBatch(smLib, idEQ, vpCols, aSizes[s], 0, vdOut, boOpts);
+            fprintf(pOut, "%s\n        {\"rows\": %zu, \"rows_per_s\": %.4g, \"ns_per_row\": %.4g}",
+                s > 0 ? "," : "", aSizes[s], dRate, 1e9/dRate);
+        }
+        fprintf(pOut, "\n      ],\n");
+
+        // Thread counts double up to the largest, which is always included
+        fprintf(pOut, "      \"threads\": [");
+        double_t dBase = 0.0;
+        for(size_t nThreads=1; ; nThreads=min(2*nThreads, boOpts.maxThreads)) {
+            double_t dRate = benchBatch(smLib, idEQ, vpCols, BENCH_ROWS, nThreads, vdOut, boOpts);
+            if(nThreads == 1) dBase = dRate;
+            fprintf(pOut, "%s\n        {\"threads\": %zu, \"rows_per_s\": %.4g, \"speedup\": %.3f}",
+                nThreads > 1 ? "," : "", nThreads, dRate, dRate/dBase);
+            if(nThreads == boOpts.maxThreads) break;
+        }
+        fprintf(pOut, "\n      ]\n");
+        fprintf(pOut, "    }");
+    }
+
+    fprintf(pOut, "\n  ]\n}\n");
+    if(pOut != stdout) fclose(pOut);
+
+    return 0;
+}
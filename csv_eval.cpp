@@ -0,0 +1,606 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  CSV/TSV Evaluation Tool
+ *  Evaluates equations on the columns of a CSV or TSV file and writes one result column per equation. Variables are the
+ *  column names from the header line, or other names mapped to a column with -m.
+ *
+ *  The file is streamed through three stages that run at the same time: a reader thread that cuts the input into batches
+ *  at line ends, the calling thread that parses, evaluates and formats each batch on a thread pool, and a writer thread.
+ *  Batches are recycled through a fixed set of buffers, so memory stays bounded whatever the size of the input.
+ *
+ *  Quoted fields are unquoted, but a quoted field can not contain a line break.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <condition_variable>
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+#include "source/libSimpleMath.hpp"
+#include "source/threadPool.hpp"
+
+using namespace std;
+using namespace smath;
+
+// Bytes of input per batch, and the number of batches in flight between the stages
+#define CSV_BATCH_BYTES 8388608
+#define CSV_BATCHES     4
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Pipeline Buffers
+ * ==================
+ *  A batch is split at line ends into pieces, one task each. A piece keeps its parsed columns, results and formatted output
+ *  between batches, so the buffers only grow until they fit the largest piece seen.
+ */
+
+struct csvPiece {
+    const char*            begin;
+    const char*            end;
+    size_t                 rows;
+    vector<vdouble_t>      cols;
+    vector<vdouble_t>      outs;
+    string                 text;
+};
+
+struct csvBatch {
+    string                 input;
+    vector<csvPiece>       pieces;
+};
+
+template<class T> class BlockingQueue {
+
+public:
+
+    void Push(T tItem) {
+        {
+            lock_guard<mutex> lGuard(m_Mutex);
+            m_Items.push_back(tItem);
+        }
+        m_Ready.notify_one();
+    }
+
+    // Returns false once the queue is closed and empty
+    bool Pop(T* pItem) {
+        unique_lock<mutex> lLock(m_Mutex);
+        m_Ready.wait(lLock, [this]{ return !m_Items.empty() || m_Closed; });
+        if(m_Items.empty()) return false;
+        *pItem = m_Items.front();
+        m_Items.pop_front();
+        return true;
+    }
+
+    void Close() {
+        {
+            lock_guard<mutex> lGuard(m_Mutex);
+            m_Closed = true;
+        }
+        m_Ready.notify_all();
+    }
+
+private:
+
+    mutex              m_Mutex;
+    condition_variable m_Ready;
+    deque<T>           m_Items;
+    bool               m_Closed = false;
+
+};
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: parseNumber
+ * =========================
+ *  Parses a decimal number in [pBeg, pEnd). Numbers with at most 15 significant digits and a decimal exponent within 22 are
+ *  converted exactly with one multiplication or division, everything else goes through strtod. Empty fields and anything
+ *  that is not a number give NaN.
+ */
+
+static double_t parseNumber(const char* pBeg, const char* pEnd) {
+
+    while(pBeg < pEnd && (*pBeg == ' ' || *pBeg == '"')) pBeg++;
+    while(pEnd > pBeg && (pEnd[-1] == ' ' || pEnd[-1] == '"' || pEnd[-1] == '\r')) pEnd--;
+    if(pBeg == pEnd) return NAN;
+
+    static const double_t aPow10[23] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+
+    const char* pPos     = pBeg;
+    bool        isNeg    = false;
+    uint64_t    iMant    = 0;
+    int         nDigits  = 0;
+    int         iExp10   = 0;
+    bool        hasDigit = false;
+
+    if(*pPos == '-' || *pPos == '+') isNeg = *pPos++ == '-';
+    while(pPos < pEnd && *pPos == '0') {
+        pPos++;
+        hasDigit = true;
+    }
+    for(; pPos < pEnd && isdigit((unsigned char)*pPos); pPos++, nDigits++) {
+        if(nDigits < 19) {
+            iMant = 10*iMant + (*pPos - '0');
+        } else {
+            iExp10++;
+        }
+        hasDigit = true;
+    }
+    if(pPos < pEnd && *pPos == '.') {
+        for(pPos++; pPos < pEnd && isdigit((unsigned char)*pPos); pPos++) {
+            hasDigit = true;
+            if(iMant == 0 && *pPos == '0') {
+                iExp10--;
+                continue;
+            }
+            if(nDigits < 19) {
+                iMant = 10*iMant + (*pPos - '0');
+                iExp10--;
+            }
+            nDigits++;
+        }
+    }
+    if(hasDigit && pPos < pEnd && (*pPos == 'e' || *pPos == 'E' || *pPos == 'd' || *pPos == 'D')) {
+        const char* pExp  = pPos + 1;
+        bool        isNeg = false;
+        int         iExp  = 0;
+        if(pExp < pEnd && (*pExp == '-' || *pExp == '+')) isNeg = *pExp++ == '-';
+        if(pExp < pEnd && isdigit((unsigned char)*pExp)) {
+            for(; pExp < pEnd && isdigit((unsigned char)*pExp); pExp++) {
+                if(iExp < 100000) iExp = 10*iExp + (*pExp - '0');
+            }
+            iExp10 += isNeg ? -iExp : iExp;
+            pPos    = pExp;
+        }
+    }
+
+    if(hasDigit && pPos == pEnd && nDigits <= 15 && iExp10 >= -22 && iExp10 <= 22) {
+        double_t dVal = (double_t)iMant;
+        dVal = iExp10 < 0 ? dVal/aPow10[-iExp10] : dVal*aPow10[iExp10];
+        return isNeg ? -dVal : dVal;
+    }
+
+    // Slow path, also handles nan and inf
+    char aBuffer[64];
+    size_t nLen = min((size_t)(pEnd - pBeg), sizeof(aBuffer)-1);
+    for(size_t i=0; i<nLen; i++) {
+        aBuffer[i] = (pBeg[i] == 'd' || pBeg[i] == 'D') ? 'e' : pBeg[i];
+    }
+    aBuffer[nLen] = '\0';
+    char*    pStop;
+    double_t dVal = strtod(aBuffer, &pStop);
+
+    return (pStop == aBuffer + nLen && nLen > 0) ? dVal : NAN;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: formatNumber
+ * ==========================
+ *  Writes dVal to pBuf, which must hold 32 characters, and returns the length. With nPrecision 0 this is the shortest text
+ *  that reads back as the same value, otherwise nPrecision significant digits as for printf's %g. std::to_chars is several
+ *  times faster than snprintf and is used where the standard library has it.
+ */
+
+static int formatNumber(char* pBuf, double_t dVal, int nPrecision) {
+
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    to_chars_result tRes = nPrecision > 0 ? to_chars(pBuf, pBuf+32, dVal, chars_format::general, nPrecision)
+                                          : to_chars(pBuf, pBuf+32, dVal);
+    return (int)(tRes.ptr - pBuf);
+#else
+    return snprintf(pBuf, 32, "%.*g", nPrecision > 0 ? nPrecision : 17, dVal);
+#endif
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: splitFields
+ * =========================
+ *  Calls fField(iField, pBeg, pEnd) for every field of the line [pBeg, pEnd), skipping delimiters inside double quotes
+ */
+
+template<class F> static void splitFields(const char* pBeg, const char* pEnd, char cDelim, const F& fField) {
+
+    size_t iField = 0;
+    bool   inQuote = false;
+    const char* pField = pBeg;
+
+    for(const char* pPos=pBeg; pPos<pEnd; pPos++) {
+        if(*pPos == '"') {
+            inQuote = !inQuote;
+        } else
+        if(*pPos == cDelim && !inQuote) {
+            fField(iField++, pField, pPos);
+            pField = pPos + 1;
+        }
+    }
+    fField(iField, pField, pEnd);
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: unquote
+ * =====================
+ */
+
+static string unquote(const char* pBeg, const char* pEnd) {
+
+    while(pBeg < pEnd && *pBeg == ' ') pBeg++;
+    while(pEnd > pBeg && (pEnd[-1] == ' ' || pEnd[-1] == '\r')) pEnd--;
+    if(pEnd - pBeg >= 2 && *pBeg == '"' && pEnd[-1] == '"') {
+        pBeg++;
+        pEnd--;
+    }
+
+    string sField;
+    for(const char* pPos=pBeg; pPos<pEnd; pPos++) {
+        if(*pPos == '"' && pPos+1 < pEnd && pPos[1] == '"') pPos++;
+        sField += *pPos;
+    }
+
+    return sField;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: usesWord
+ * ======================
+ *  Checks whether sWord appears as a whole word in sEquation. Used to only parse the columns an equation can refer to.
+ */
+
+static bool usesWord(const string& sEquation, const string& sWord) {
+
+    auto isWordChar = [](char cChar) { return isalnum((unsigned char)cChar) || cChar == '_'; };
+
+    for(size_t iPos=sEquation.find(sWord); iPos!=string::npos; iPos=sEquation.find(sWord, iPos+1)) {
+        bool isStart = iPos == 0 || !isWordChar(sEquation[iPos-1]);
+        bool isEnd   = iPos + sWord.size() == sEquation.size() || !isWordChar(sEquation[iPos+sWord.size()]);
+        if(isStart && isEnd) return true;
+    }
+
+    return false;
+}
+
+// ****************************************************************************************************************************** //
+
+static void printUsage() {
+    printf("Usage: csv_eval.e [options] -e [name=]equation [-e ...] [file]\n");
+    printf("Evaluates equations on the columns of a CSV or TSV file read from file or stdin.\n\n");
+    printf("  -e [name=]eq  Equation to evaluate, with the column names of the header as variables\n");
+    printf("  -m var=column Make the named column available as variable var\n");
+    printf("  -d char       Field delimiter, 'tab' for tab, detected from the header by default\n");
+    printf("  -o file       Write the results to file instead of stdout\n");
+    printf("  -t threads    Threads for parsing and evaluation, default one per hardware thread\n");
+    printf("  -p digits     Significant digits of the results, default as many as needed to read back exactly\n");
+    printf("  -k            Keep the input columns in front of the results\n");
+    printf("  -q            Do not report throughput on stderr\n");
+}
+
+int main(int argc, char const *argv[]) {
+
+    vstring_t vsNames;
+    vstring_t vsEquations;
+    vstring_t vsMapVars;
+    vstring_t vsMapCols;
+    string    sInput;
+    string    sOutput;
+    char      cDelim     = '\0';
+    size_t    nThreads   = max(1u, thread::hardware_concurrency());
+    int       nPrecision = 0;
+    bool      keepInput  = false;
+    bool      isQuiet    = false;
+
+    for(int i=1; i<argc; i++) {
+        string sArg = argv[i];
+        bool   hasValue = i+1 < argc;
+        if(sArg == "-e" && hasValue) {
+            string sEq  = argv[++i];
+            size_t iSep = sEq.find('=');
+            bool   isNamed = iSep != string::npos && iSep > 0 && sEq[iSep-1] != '!' && sEq[iSep-1] != '<' &&
+                             sEq[iSep-1] != '>' && sEq[iSep-1] != '=' && (iSep+1 == sEq.size() || sEq[iSep+1] != '=');
+            vsNames.push_back(isNamed ? sEq.substr(0, iSep) : "eq" + to_string(vsEquations.size()+1));
+            vsEquations.push_back(isNamed ? sEq.substr(iSep+1) : sEq);
+        } else
+        if(sArg == "-m" && hasValue) {
+            string sMap = argv[++i];
+            size_t iSep = sMap.find('=');
+            if(iSep == string::npos) {
+                printf("Error: Expected var=column, got '%s'\n", sMap.c_str());
+                return 1;
+            }
+            vsMapVars.push_back(sMap.substr(0, iSep));
+            vsMapCols.push_back(sMap.substr(iSep+1));
+        } else
+        if(sArg == "-d" && hasValue) {
+            string sDelim = argv[++i];
+            cDelim = (sDelim == "tab" || sDelim == "\\t") ? '\t' : sDelim[0];
+        } else
+        if(sArg == "-o" && hasValue) {
+            sOutput = argv[++i];
+        } else
+        if(sArg == "-t" && hasValue) {
+            nThreads = max(1, atoi(argv[++i]));
+        } else
+        if(sArg == "-p" && hasValue) {
+            nPrecision = min(17, max(1, atoi(argv[++i])));
+        } else
+        if(sArg == "-k") {
+            keepInput = true;
+        } else
+        if(sArg == "-q") {
+            isQuiet = true;
+        } else
+        if(sArg == "-h" || sArg == "--help") {
+            printUsage();
+            return 0;
+        } else
+        if(sArg[0] != '-' && sInput.empty()) {
+            sInput = sArg;
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+    if(vsEquations.empty()) {
+        printUsage();
+        return 1;
+    }
+
+    FILE* pIn  = sInput.empty()  ? stdin  : fopen(sInput.c_str(), "rb");
+    FILE* pOut = sOutput.empty() ? stdout : fopen(sOutput.c_str(), "wb");
+    if(pIn == nullptr || pOut == nullptr) {
+        fprintf(stderr, "Error: Cannot open %s\n", pIn == nullptr ? sInput.c_str() : sOutput.c_str());
+        return 1;
+    }
+
+    // Header
+    string sHeader;
+    for(int cChar=fgetc(pIn); cChar!=EOF && cChar!='\n'; cChar=fgetc(pIn)) sHeader += (char)cChar;
+    if(!sHeader.empty() && sHeader.back() == '\r') sHeader.pop_back();
+    if(cDelim == '\0') {
+        cDelim = sHeader.find('\t') != string::npos ? '\t' :
+                 (sHeader.find(';') != string::npos && sHeader.find(',') == string::npos) ? ';' : ',';
+    }
+
+    vstring_t vsColumns;
+    splitFields(sHeader.data(), sHeader.data()+sHeader.size(), cDelim, [&](size_t, const char* pBeg, const char* pEnd) {
+        vsColumns.push_back(unquote(pBeg, pEnd));
+    });
+
+    // Variables are the columns, and the mapped names, that appear in any of the equations
+    vstring_t      vsVars;
+    vector<size_t> viVarCol;
+    auto addVariable = [&](const string& sVar, const string& sCol) {
+        for(size_t i=0; i<vsColumns.size(); i++) {
+            if(vsColumns[i] != sCol) continue;
+            for(const auto& sEq : vsEquations) {
+                if(!usesWord(sEq, sVar)) continue;
+                vsVars.push_back(sVar);
+                viVarCol.push_back(i);
+                break;
+            }
+            return true;
+        }
+        return false;
+    };
+    for(size_t i=0; i<vsMapVars.size(); i++) {
+        if(!addVariable(vsMapVars[i], vsMapCols[i])) {
+            fprintf(stderr, "Error: No column named '%s'\n", vsMapCols[i].c_str());
+            return 1;
+        }
+    }
+    for(const auto& sCol : vsColumns) {
+        if(find(vsVars.begin(), vsVars.end(), sCol) == vsVars.end()) addVariable(sCol, sCol);
+    }
+
+    SimpleMath     smEqs;
+    vector<size_t> viEqs;
+    for(size_t k=0; k<vsEquations.size(); k++) {
+        viEqs.push_back(smEqs.addEquation(vsEquations[k], vsVars));
+        if(!smEqs.getProgram(viEqs.back())) {
+            fprintf(stderr, "Error: Invalid equation '%s'\n", vsEquations[k].c_str());
+            return 1;
+        }
+    }
+    size_t idSet = smEqs.addEquationSet(viEqs);
+    size_t nVars = vsVars.size();
+    size_t nEqs  = viEqs.size();
+
+    // Column index to variable slot, for a single pass over the fields of a line
+    vector<int> viColVar(vsColumns.size(), -1);
+    for(size_t v=0; v<nVars; v++) viColVar[viVarCol[v]] = (int)v;
+
+    string sOutHeader = keepInput ? sHeader : "";
+    for(size_t k=0; k<nEqs; k++) {
+        if(!sOutHeader.empty() || k > 0) sOutHeader += cDelim;
+        sOutHeader += vsNames[k];
+    }
+    sOutHeader += '\n';
+    fwrite(sOutHeader.data(), 1, sOutHeader.size(), pOut);
+
+    // Pipeline
+    BlockingQueue<csvBatch*> qFree, qParse, qWrite;
+    vector<csvBatch>         vBatches(CSV_BATCHES);
+    for(auto& bBatch : vBatches) {
+        bBatch.pieces.resize(4*nThreads);
+        qFree.Push(&bBatch);
+    }
+
+    atomic<bool> isValid(true);
+    size_t       nBytes = sHeader.size() + 1;
+    size_t       nRows  = 0;
+    auto         tStart = chrono::steady_clock::now();
+
+    thread tReader([&]() {
+        string    sCarry;
+        csvBatch* pBatch;
+        while(isValid && qFree.Pop(&pBatch)) {
+            string& sBuf = pBatch->input;
+            sBuf.swap(sCarry);
+            size_t nHave = sBuf.size();
+            sBuf.resize(nHave + CSV_BATCH_BYTES);
+            size_t nRead = fread(&sBuf[nHave], 1, CSV_BATCH_BYTES, pIn);
+            sBuf.resize(nHave + nRead);
+            nBytes += nRead;
+
+            bool   isLast = nRead == 0;
+            size_t iCut   = sBuf.rfind('\n');
+            if(isLast) {
+                sCarry.clear();
+                if(!sBuf.empty() && sBuf.back() != '\n') sBuf += '\n';
+            } else {
+                iCut = iCut == string::npos ? 0 : iCut+1;
+                sCarry.assign(sBuf, iCut, string::npos);
+                sBuf.resize(iCut);
+            }
+            if(!sBuf.empty()) qParse.Push(pBatch);
+            if(isLast) break;
+        }
+        qParse.Close();
+    });
+
+    thread tWriter([&]() {
+        csvBatch* pBatch;
+        while(qWrite.Pop(&pBatch)) {
+            for(const auto& pPiece : pBatch->pieces) fwrite(pPiece.text.data(), 1, pPiece.text.size(), pOut);
+            qFree.Push(pBatch);
+        }
+    });
+
+    ThreadPool tpWork(nThreads);
+    csvBatch*  pBatch;
+
+    while(qParse.Pop(&pBatch)) {
+
+        // Cut the batch into pieces at line ends
+        const char* pData = pBatch->input.data();
+        size_t      nData = pBatch->input.size();
+        size_t      nPieces = pBatch->pieces.size();
+        const char* pPrev = pData;
+        for(size_t p=0; p<nPieces; p++) {
+            const char* pCut = pData + nData*(p+1)/nPieces;
+            if(pCut < pPrev) pCut = pPrev;
+            if(p+1 < nPieces) {
+                const char* pNL = (const char*)memchr(pCut, '\n', pData+nData-pCut);
+                pCut = pNL == nullptr ? pData+nData : pNL+1;
+            }
+            pBatch->pieces[p].begin = pPrev;
+            pBatch->pieces[p].end   = pCut;
+            pPrev = pCut;
+        }
+
+        atomic<bool> okBatch(true);
+        tpWork.Run(nPieces, [&](size_t iTask, size_t) {
+
+            csvPiece& pcWork = pBatch->pieces[iTask];
+            pcWork.cols.resize(nVars);
+            pcWork.outs.resize(nEqs);
+            pcWork.text.clear();
+
+            // Parse
+            size_t nLines = 0;
+            size_t nCap   = pcWork.cols.empty() ? 0 : pcWork.cols[0].size();
+            for(const char* pLine=pcWork.begin; pLine<pcWork.end; ) {
+                const char* pEOL = (const char*)memchr(pLine, '\n', pcWork.end-pLine);
+                if(pEOL == pLine || (pEOL == pLine+1 && *pLine == '\r')) {
+                    pLine = pEOL + 1;
+                    continue;
+                }
+                if(nLines == nCap) {
+                    nCap = max((size_t)1024, 2*nCap);
+                    for(auto& vdCol : pcWork.cols) vdCol.resize(nCap);
+                }
+                for(auto& vdCol : pcWork.cols) vdCol[nLines] = NAN;
+                splitFields(pLine, pEOL, cDelim, [&](size_t iField, const char* pBeg, const char* pEnd) {
+                    if(iField < viColVar.size() && viColVar[iField] >= 0) {
+                        pcWork.cols[viColVar[iField]][nLines] = parseNumber(pBeg, pEnd);
+                    }
+                });
+                nLines++;
+                pLine = pEOL + 1;
+            }
+            pcWork.rows = nLines;
+            if(nLines == 0) return;
+
+            // Evaluate
+            vector<const double_t*> vpCols(nVars);
+            vector<double_t*>       vpOuts(nEqs);
+            for(size_t v=0; v<nVars; v++) vpCols[v] = pcWork.cols[v].data();
+            for(size_t k=0; k<nEqs; k++) {
+                if(pcWork.outs[k].size() < nLines) pcWork.outs[k].resize(nLines);
+                vpOuts[k] = pcWork.outs[k].data();
+            }
+            if(!smEqs.evalEquationSet(idSet, vpCols.data(), nLines, vpOuts.data())) {
+                okBatch = false;
+                return;
+            }
+
+            // Format
+            char   aNum[32];
+            size_t iRow = 0;
+            for(const char* pLine=pcWork.begin; pLine<pcWork.end; ) {
+                const char* pEOL = (const char*)memchr(pLine, '\n', pcWork.end-pLine);
+                const char* pTxt = (pEOL > pLine && pEOL[-1] == '\r') ? pEOL-1 : pEOL;
+                if(pTxt == pLine) {
+                    pLine = pEOL + 1;
+                    continue;
+                }
+                if(keepInput) {
+                    pcWork.text.append(pLine, pTxt);
+                    pcWork.text += cDelim;
+                }
+                for(size_t k=0; k<nEqs; k++) {
+                    int nLen = formatNumber(aNum, pcWork.outs[k][iRow], nPrecision);
+                    pcWork.text.append(aNum, nLen);
+                    pcWork.text += k+1 < nEqs ? cDelim : '\n';
+                }
+                iRow++;
+                pLine = pEOL + 1;
+            }
+        });
+
+        if(!okBatch) {
+            isValid = false;
+            break;
+        }
+
+        for(const auto& pcWork : pBatch->pieces) nRows += pcWork.rows;
+        qWrite.Push(pBatch);
+    }
+
+    // On an error the reader may be waiting for a free batch, so wake it and drain what it still sends
+    if(!isValid) {
+        qFree.Close();
+        while(qParse.Pop(&pBatch)) {}
+    }
+    qWrite.Close();
+    tReader.join();
+    tWriter.join();
+
+    if(pIn  != stdin)  fclose(pIn);
+    if(pOut != stdout) fclose(pOut);
+    else fflush(pOut);
+
+    if(!isQuiet) {
+        double_t dTime = chrono::duration<double_t>(chrono::steady_clock::now() - tStart).count();
+        fprintf(stderr, "Rows: %zu, Input: %.1f MB, Time: %.3f s, Throughput: %.1f MB/s, %.3e rows/s\n",
+            nRows, nBytes/1e6, dTime, nBytes/1e6/dTime, nRows/dTime);
+    }
+
+    return isValid ? 0 : 1;
+}
@@ -2,36 +2,152 @@
  *  Equation Nibbler Library
  * ==========================
  *  C++ Example Code
+ *  Shows the evaluation interfaces of SimpleMath. Timings are measured by the benchmark suite in benchmark.cpp.
  */
 
-#include <time.h>
+#include <cstdio>
 #include <cstdlib>
+#include <new>
 
 #include "source/libSimpleMath.hpp"
 
 using namespace std;
 using namespace smath;
 
+// Count heap allocations to check that evaluation does not allocate
+static size_t nAllocs = 0;
+
+void* operator new(size_t nSize) {
+    nAllocs++;
+    void* pMem = malloc(nSize);
+    if(!pMem) throw bad_alloc();
+    return pMem;
+}
+
+void operator delete(void* pMem) noexcept {
+    free(pMem);
+}
+
 int main(int argc, char const *argv[]) {
 
     double_t theResult;
     SimpleMath* theEQ = new SimpleMath();
-    clock_t tStart = clock();
     vector<string>   theVars{"a","x","y","z"};
-    // size_t idEQ = theEQ->addEquation("-(1 + (2 + x)) + (3 + (4 + y)) + (5 + (6 + (7 + z)))",theVars);
     size_t idEQ = theEQ->addEquation("-3.2^3 + sin(pi/2) * cos(a) * exp(pi/2) - if(pi > 3, pi, 0) -(1 + (2 + x)) + (3 + (4 + y)) + (5 + (6 + (7 + z)))",theVars);
-    // size_t idEQ = theEQ->addEquation("-a + x * y / z",theVars);
     vector<double_t> theVals{0.0,1.0,2.0,3.0};
 
-    int maxItt = 20000000;
-    // int maxItt = 1;
+    size_t nStart = nAllocs;
+    theResult = theEQ->evalEquation(idEQ, theVals);
+    printf("Result:         %23.16e\n", theResult);
+    printf("Allocations:    %d\n", (int)(nAllocs - nStart));
+
+    // The stack and register interpreters, the JIT compiler and the incremental evaluator give the same result
+    const char* theNames[4] = {"Stack", "Register", "JIT", "Incremental"};
+    value_t     theBacks[4] = {MB_STACK, MB_REGISTER, MB_JIT, MB_INCREMENTAL};
+    for(int b=0; b<4; b++) {
+        theEQ->setBackend(idEQ, theBacks[b]);
+        if(theEQ->getBackend(idEQ) != theBacks[b]) {
+            printf("%-11s not available\n", theNames[b]);
+            continue;
+        }
+        printf("%-11s result: %23.16e\n", theNames[b], theEQ->evalEquation(idEQ, theVals));
+    }
+    theEQ->setBackend(idEQ, MB_STACK);
+
+    // Batch evaluation on columns of values
+    size_t nRows = 100000;
+    vector<vector<double_t>> theCols(theVars.size());
+    vector<const double_t*>  theColPtr;
+    vector<double_t>         theOut(nRows);
+    for(size_t i=0; i<theVars.size(); i++) {
+        theCols[i].assign(nRows, theVals[i]);
+        theColPtr.push_back(theCols[i].data());
+    }
 
-    for(int s=0; s<maxItt; s++) {
-        theResult = theEQ->evalEquation(idEQ, theVals);
+    nStart = nAllocs;
+    theEQ->evalEquationBatch(idEQ, theColPtr.data(), nRows, theOut.data());
+    printf("Batch result:   %23.16e\n", theOut[nRows-1]);
+    printf("Allocations:    %d\n", (int)(nAllocs - nStart));
+
+    // Single precision columns
+    vector<vector<float>> theColsF(theVars.size());
+    vector<const float*>  theColPtrF;
+    vector<float>         theOutF(nRows);
+    for(size_t i=0; i<theVars.size(); i++) {
+        theColsF[i].assign(nRows, (float)theVals[i]);
+        theColPtrF.push_back(theColsF[i].data());
     }
-    printf("Result: %23.16e\n", theResult);
-    printf("Total time:     %.6f s\n",      (double)(clock() - tStart)/CLOCKS_PER_SEC);
-    printf("Per operatrion: %.6f us\n", 1e6*(double)(clock() - tStart)/CLOCKS_PER_SEC/maxItt);
+    theEQ->evalEquationBatch(idEQ, theColPtrF.data(), nRows, theOutF.data());
+    printf("Float batch:    %23.16e\n", theOutF[nRows-1]);
+
+    // Batch evaluation with the packed JIT code, and split over a thread pool
+    theEQ->setBackend(idEQ, MB_JIT);
+    theEQ->evalEquationBatch(idEQ, theColPtr.data(), nRows, theOut.data());
+    printf("JIT batch:      %23.16e\n", theOut[nRows-1]);
+    theEQ->setBackend(idEQ, MB_STACK);
+
+    theEQ->evalEquationParallel(idEQ, theColPtr.data(), nRows, theOut.data());
+    printf("Parallel batch: %23.16e\n", theOut[nRows-1]);
+
+    // Sum and maximum of the batch results, without an output column
+    printf("Batch sum:      %23.16e\n", theEQ->reduceEquation(idEQ, theColPtr.data(), nRows, RD_SUM));
+    printf("Batch maximum:  %23.16e\n", theEQ->reduceEquation(idEQ, theColPtr.data(), nRows, RD_MAX, 0));
+
+    // Rows where a condition holds, as a bitmap and as a list of indices
+    size_t           idCond = theEQ->addEquation("x >= 1 && y < 3 || z < 0", theVars);
+    vector<uint64_t> theBits((nRows+63)/64);
+    vector<size_t>   theRows(nRows);
+    size_t           nSelected;
+    theEQ->filterEquation(idCond, theColPtr.data(), nRows, theBits.data(), &nSelected);
+    printf("Filter:         %d rows\n", (int)nSelected);
+    theEQ->selectEquation(idCond, theColPtr.data(), nRows, theRows.data(), &nSelected);
+    printf("Select:         %d rows, last %d\n", (int)nSelected, nSelected > 0 ? (int)theRows[nSelected-1] : -1);
+
+    // Several equations sharing subexpressions, evaluated as a set in one pass
+    vector<size_t> theIds;
+    theIds.push_back(theEQ->addEquation("sin(a)*exp(x) + y*z", theVars));
+    theIds.push_back(theEQ->addEquation("sin(a)*exp(x) - y*z", theVars));
+    theIds.push_back(theEQ->addEquation("(sin(a)*exp(x))^2 + z", theVars));
+    size_t idSet = theEQ->addEquationSet(theIds);
+
+    vector<vector<double_t>> theOuts(theIds.size(), vector<double_t>(nRows));
+    vector<double_t*>        theOutPtr;
+    for(auto& vdOut : theOuts) theOutPtr.push_back(vdOut.data());
+
+    theEQ->evalEquationSet(idSet, theColPtr.data(), nRows, theOutPtr.data());
+    printf("Equation set:   %.6e %.6e %.6e\n", theOuts[0][nRows-1], theOuts[1][nRows-1], theOuts[2][nRows-1]);
+
+    // Value and derivative by every variable in one call, and on columns with one output per derivative
+    size_t   idGrad = theEQ->addGradient(theIds[0]);
+    double_t theGrad[4];
+    theResult = theEQ->evalGradient(idGrad, theVals.data(), theVals.size(), theGrad);
+    printf("Gradient:       %.6e [%.6e %.6e %.6e %.6e]\n", theResult, theGrad[0], theGrad[1], theGrad[2], theGrad[3]);
+
+    vector<vector<double_t>> theGrads(theVars.size()+1, vector<double_t>(nRows));
+    vector<double_t*>        theGradPtr;
+    for(auto& vdOut : theGrads) theGradPtr.push_back(vdOut.data());
+
+    theEQ->evalGradientBatch(idGrad, theColPtr.data(), nRows, theGradPtr.data());
+    printf("Gradient batch: %.6e [%.6e %.6e %.6e %.6e]\n", theGrads[0][nRows-1], theGrads[1][nRows-1], theGrads[2][nRows-1],
+        theGrads[3][nRows-1], theGrads[4][nRows-1]);
+
+    // Calls, rows and instructions of each equation while profiling is on
+    SimpleMath::setProfiling(PM_OPS);
+    theEQ->evalEquationBatch(idEQ, theColPtr.data(), nRows, theOut.data());
+    SimpleMath::setProfiling(PM_OFF);
+    evalprofile theProfile = theEQ->getProfile(idEQ);
+    printf("Profile:        %llu rows, %llu cycles\n", (unsigned long long)theProfile.rows, (unsigned long long)theProfile.cycles);
+    printf("Profile JSON:   %.60s...\n", theEQ->getProfileJSON().c_str());
+
+    // Compiled programs saved to a file, and loaded into a new object without parsing, keeping their ids
+    theEQ->saveFile("example_programs.eqn");
+    SimpleMath* theCopy = new SimpleMath();
+    theCopy->loadFile("example_programs.eqn");
+    printf("Loaded result:  %23.16e\n", theCopy->evalEquation(idEQ, theVals));
+    remove("example_programs.eqn");
+    delete theCopy;
+
+    delete theEQ;
 
     return 0;
 }
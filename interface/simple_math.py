@@ -1,9 +1,302 @@
-from ctypes import cdll
-smath = cdll.LoadLibrary("./libSimpleMath.so")
+"""
+Equation Nibbler Library
+========================
+Python interface to libSimpleMath through its C interface.
+
+NumPy arrays are handed to the library as pointers with a stride, so float64 arrays are evaluated in place without copying,
+including views such as slices or broadcast scalars. The library is loaded with ctypes.CDLL, which releases the GIL for the
+duration of every call, so other Python threads keep running during a batch evaluation.
+"""
+
+import ctypes
+import json
+import os
+
+import numpy as np
+
+MB_STACK       = 0
+MB_REGISTER    = 1
+MB_JIT         = 2
+MB_INCREMENTAL = 3
+
+AD_AUTO        = 0
+AD_FORWARD     = 1
+AD_REVERSE     = 2
+
+RD_SUM         = 0
+RD_MIN         = 1
+RD_MAX         = 2
+RD_MEAN        = 3
+RD_COUNT       = 4
+
+PM_OFF         = 0
+PM_CALLS       = 1
+PM_OPS         = 2
+
+_c_double_p  = ctypes.POINTER(ctypes.c_double)
+_c_int64_p   = ctypes.POINTER(ctypes.c_int64)
+
+
+def _load_library(path):
+    lib = ctypes.CDLL(path)
+
+    lib.py_smath_new.restype          = ctypes.c_void_p
+    lib.py_smath_new.argtypes         = []
+    lib.py_smath_free.restype         = None
+    lib.py_smath_free.argtypes        = [ctypes.c_void_p]
+    lib.py_smath_add_eq.restype       = ctypes.c_int64
+    lib.py_smath_add_eq.argtypes      = [ctypes.c_void_p, ctypes.c_char_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_size_t]
+    lib.py_smath_set_backend.restype  = ctypes.c_int
+    lib.py_smath_set_backend.argtypes = [ctypes.c_void_p, ctypes.c_int64, ctypes.c_int]
+    lib.py_smath_get_backend.restype  = ctypes.c_int
+    lib.py_smath_get_backend.argtypes = [ctypes.c_void_p, ctypes.c_int64]
+    lib.py_smath_eval_eq.restype      = ctypes.c_double
+    lib.py_smath_eval_eq.argtypes     = [ctypes.c_void_p, ctypes.c_int64, _c_double_p, ctypes.c_size_t]
+    lib.py_smath_eval_batch.restype   = ctypes.c_int
+    lib.py_smath_eval_batch.argtypes  = [ctypes.c_void_p, ctypes.c_int64, ctypes.POINTER(_c_double_p), _c_int64_p,
+                                         ctypes.c_size_t, _c_double_p, ctypes.c_int64, ctypes.c_size_t]
+    lib.py_smath_reduce.restype       = ctypes.c_double
+    lib.py_smath_reduce.argtypes      = [ctypes.c_void_p, ctypes.c_int64, ctypes.POINTER(_c_double_p), _c_int64_p,
+                                         ctypes.c_size_t, ctypes.c_int, ctypes.c_size_t]
+    lib.py_smath_filter.restype       = ctypes.c_int
+    lib.py_smath_filter.argtypes      = [ctypes.c_void_p, ctypes.c_int64, ctypes.POINTER(_c_double_p), _c_int64_p,
+                                         ctypes.c_size_t, ctypes.POINTER(ctypes.c_uint64), ctypes.POINTER(ctypes.c_size_t),
+                                         ctypes.POINTER(ctypes.c_size_t)]
+    lib.py_smath_add_set.restype      = ctypes.c_int64
+    lib.py_smath_add_set.argtypes     = [ctypes.c_void_p, _c_int64_p, ctypes.c_size_t]
+    lib.py_smath_eval_set.restype     = ctypes.c_int
+    lib.py_smath_eval_set.argtypes    = [ctypes.c_void_p, ctypes.c_int64, ctypes.POINTER(_c_double_p), _c_int64_p,
+                                         ctypes.c_size_t, ctypes.POINTER(_c_double_p), _c_int64_p]
+    lib.py_smath_add_grad.restype         = ctypes.c_int64
+    lib.py_smath_add_grad.argtypes        = [ctypes.c_void_p, ctypes.c_int64, ctypes.c_int]
+    lib.py_smath_eval_grad.restype        = ctypes.c_double
+    lib.py_smath_eval_grad.argtypes       = [ctypes.c_void_p, ctypes.c_int64, _c_double_p, ctypes.c_size_t, _c_double_p]
+    lib.py_smath_eval_grad_batch.restype  = ctypes.c_int
+    lib.py_smath_eval_grad_batch.argtypes = [ctypes.c_void_p, ctypes.c_int64, ctypes.POINTER(_c_double_p), _c_int64_p,
+                                             ctypes.c_size_t, ctypes.POINTER(_c_double_p), _c_int64_p]
+    lib.py_smath_set_profiling.restype    = None
+    lib.py_smath_set_profiling.argtypes   = [ctypes.c_int]
+    lib.py_smath_reset_profiles.restype   = None
+    lib.py_smath_reset_profiles.argtypes  = [ctypes.c_void_p]
+    lib.py_smath_profile_json.restype     = ctypes.c_size_t
+    lib.py_smath_profile_json.argtypes    = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t]
+
+    return lib
+
+
+def _strided(array):
+    """Returns a float64 view of array whose stride is a whole number of values, copying only if there is none."""
+    array = np.asarray(array, dtype=np.float64)
+    if array.ndim != 1 or array.strides[0] % array.itemsize != 0:
+        array = np.ascontiguousarray(array).reshape(-1)
+    return array
+
+
+def _pointer(array):
+    return array.ctypes.data_as(_c_double_p)
+
 
 class SimpleMath:
 
-    def __init__(self):
-        self.cObj = smath.py_smath_new()
+    def __init__(self, library=None):
+        if library is None:
+            library = os.path.join(os.path.dirname(os.path.abspath(__file__)), "libSimpleMath.so")
+        self._lib   = _load_library(library)
+        self._cObj  = self._lib.py_smath_new()
+        self._vars  = {}
+        self._sets  = {}
+        self._grads = {}
+
+    def __del__(self):
+        if getattr(self, "_cObj", None):
+            self._lib.py_smath_free(self._cObj)
+            self._cObj = None
+
+    def add_equation(self, equation, variables):
+        """Compiles an equation of the named variables and returns its id."""
+        variables = list(variables)
+        names     = (ctypes.c_char_p*len(variables))(*[v.encode() for v in variables])
+        eq_id     = self._lib.py_smath_add_eq(self._cObj, equation.encode(), names, len(variables))
+        if eq_id < 0:
+            raise ValueError("Invalid equation '%s'" % equation)
+        self._vars[eq_id] = variables
+        return eq_id
+
+    def set_backend(self, eq_id, backend):
+        if not self._lib.py_smath_set_backend(self._cObj, eq_id, backend):
+            raise ValueError("Cannot set backend %d for equation %d" % (backend, eq_id))
+
+    def get_backend(self, eq_id):
+        return self._lib.py_smath_get_backend(self._cObj, eq_id)
+
+    def evaluate(self, eq_id, values):
+        """Evaluates an equation for one set of values, in the order of its variables."""
+        values = np.ascontiguousarray(values, dtype=np.float64)
+        return self._lib.py_smath_eval_eq(self._cObj, eq_id, _pointer(values), values.size)
+
+    def evaluate_batch(self, eq_id, columns, out=None, threads=1):
+        """
+        Evaluates an equation on columns of values, given as a sequence in the order of its variables or as a dict by
+        variable name. Scalars are broadcast to the length of the other columns. The result is written to out if given,
+        which must be a float64 array of the right length, and returned. threads other than 1 splits the work over a
+        thread pool, with 0 for one thread per hardware thread.
+        """
+        cols, n_rows = self._columns(self._vars[eq_id], columns)
+        out = self._output(out, n_rows)
+
+        col_ptrs, strides = self._pointers(cols)
+        ok = self._lib.py_smath_eval_batch(self._cObj, eq_id, col_ptrs, strides, n_rows, _pointer(out),
+                                           out.strides[0]//out.itemsize if n_rows > 0 else 1, threads)
+        if not ok:
+            raise RuntimeError("Evaluation of equation %d failed" % eq_id)
+        return out
+
+    def reduce(self, eq_id, columns, reduction=RD_SUM, threads=1):
+        """
+        Evaluates an equation on columns like evaluate_batch, and returns the sum, minimum, maximum or mean of the results,
+        or the number of rows where it is not zero, as selected by reduction. The results are not stored, and the sums are
+        compensated and the same for any number of threads.
+        """
+        if reduction not in (RD_SUM, RD_MIN, RD_MAX, RD_MEAN, RD_COUNT):
+            raise ValueError("Unknown reduction %d" % reduction)
+        cols, n_rows = self._columns(self._vars[eq_id], columns)
+        col_ptrs, strides = self._pointers(cols)
+        return self._lib.py_smath_reduce(self._cObj, eq_id, col_ptrs, strides, n_rows, reduction, threads)
+
+    def select(self, eq_id, columns):
+        """
+        Evaluates an equation as a condition on columns like evaluate_batch, and returns the indices of the rows where it is
+        not zero, like np.flatnonzero of its results. Comparisons combined with && and || are evaluated as bit masks.
+        """
+        cols, n_rows = self._columns(self._vars[eq_id], columns)
+        col_ptrs, strides = self._pointers(cols)
+        selection = np.empty(n_rows, dtype=np.uintp)
+        count     = ctypes.c_size_t(0)
+        ok = self._lib.py_smath_filter(self._cObj, eq_id, col_ptrs, strides, n_rows, None,
+                                       selection.ctypes.data_as(ctypes.POINTER(ctypes.c_size_t)), ctypes.byref(count))
+        if not ok:
+            raise RuntimeError("Evaluation of equation %d failed" % eq_id)
+        return selection[:count.value].astype(np.intp)
+
+    def bitmap(self, eq_id, columns):
+        """
+        Like select, but returns the rows as a uint64 array with bit i % 64 of word i // 64 set for each row i, and the
+        number of rows selected.
+        """
+        cols, n_rows = self._columns(self._vars[eq_id], columns)
+        col_ptrs, strides = self._pointers(cols)
+        words = np.zeros((n_rows + 63)//64, dtype=np.uint64)
+        count = ctypes.c_size_t(0)
+        ok = self._lib.py_smath_filter(self._cObj, eq_id, col_ptrs, strides, n_rows,
+                                       words.ctypes.data_as(ctypes.POINTER(ctypes.c_uint64)), None, ctypes.byref(count))
+        if not ok:
+            raise RuntimeError("Evaluation of equation %d failed" % eq_id)
+        return words, count.value
+
+    def add_equation_set(self, eq_ids):
+        """Combines equations of the same variables into a set that evaluate_set computes in a single pass."""
+        eq_ids = list(eq_ids)
+        ids    = (ctypes.c_int64*len(eq_ids))(*eq_ids)
+        set_id = self._lib.py_smath_add_set(self._cObj, ids, len(eq_ids))
+        if set_id < 0:
+            raise ValueError("Equations %s cannot be combined into a set" % eq_ids)
+        self._sets[set_id] = (self._vars[eq_ids[0]], len(eq_ids))
+        return set_id
+
+    def evaluate_set(self, set_id, columns, out=None):
+        """Evaluates a set on columns of values like evaluate_batch, and returns a list with one array per equation."""
+        variables, n_outs = self._sets[set_id]
+        cols, n_rows = self._columns(variables, columns)
+        if out is None:
+            out = [None]*n_outs
+        out = [self._output(o, n_rows) for o in out]
+        if len(out) != n_outs:
+            raise ValueError("Expected %d output arrays, got %d" % (n_outs, len(out)))
+
+        col_ptrs, strides = self._pointers(cols)
+        out_ptrs    = (_c_double_p*n_outs)(*[_pointer(o) for o in out])
+        out_strides = (ctypes.c_int64*n_outs)(*[o.strides[0]//o.itemsize if n_rows > 0 else 1 for o in out])
+        ok = self._lib.py_smath_eval_set(self._cObj, set_id, col_ptrs, strides, n_rows, out_ptrs, out_strides)
+        if not ok:
+            raise RuntimeError("Evaluation of equation set %d failed" % set_id)
+        return out
+
+    def add_gradient(self, eq_id, mode=AD_AUTO):
+        """Compiles the derivatives of an equation by each of its variables, and returns the id of the gradient."""
+        grad_id = self._lib.py_smath_add_grad(self._cObj, eq_id, mode)
+        if grad_id < 0:
+            raise ValueError("Cannot differentiate equation %d" % eq_id)
+        self._grads[grad_id] = self._vars[eq_id]
+        return grad_id
+
+    def evaluate_gradient(self, grad_id, values):
+        """Evaluates a gradient for one set of values, and returns the value of the equation and an array of derivatives."""
+        values   = np.ascontiguousarray(values, dtype=np.float64)
+        gradient = np.empty(len(self._grads[grad_id]), dtype=np.float64)
+        value    = self._lib.py_smath_eval_grad(self._cObj, grad_id, _pointer(values), values.size, _pointer(gradient))
+        return value, gradient
+
+    def evaluate_gradient_batch(self, grad_id, columns):
+        """
+        Evaluates a gradient on columns of values like evaluate_batch. Returns an array of values and a two dimensional array
+        with the derivative by the i-th variable in row i.
+        """
+        variables = self._grads[grad_id]
+        cols, n_rows = self._columns(variables, columns)
+        value    = np.empty(n_rows, dtype=np.float64)
+        gradient = np.empty((len(variables), n_rows), dtype=np.float64)
+        out      = [value] + list(gradient)
+
+        col_ptrs, strides = self._pointers(cols)
+        out_ptrs    = (_c_double_p*len(out))(*[_pointer(o) for o in out])
+        out_strides = (ctypes.c_int64*len(out))(*[1]*len(out))
+        ok = self._lib.py_smath_eval_grad_batch(self._cObj, grad_id, col_ptrs, strides, n_rows, out_ptrs, out_strides)
+        if not ok:
+            raise RuntimeError("Evaluation of gradient %d failed" % grad_id)
+        return value, gradient
+
+    def set_profiling(self, mode):
+        """
+        Turns profiling on with PM_CALLS or PM_OPS, or off with PM_OFF. PM_OPS also counts every instruction, and makes all
+        equations run on the interpreters while it is on. The mode applies to every SimpleMath object in the process.
+        """
+        if mode not in (PM_OFF, PM_CALLS, PM_OPS):
+            raise ValueError("Unknown profiling mode %d" % mode)
+        self._lib.py_smath_set_profiling(mode)
+
+    def reset_profiles(self):
+        self._lib.py_smath_reset_profiles(self._cObj)
+
+    def profile(self):
+        """Returns the profile of the equations, sets and gradients called since the last reset, as a dict."""
+        size = self._lib.py_smath_profile_json(self._cObj, None, 0)
+        text = ctypes.create_string_buffer(size + 1)
+        self._lib.py_smath_profile_json(self._cObj, text, size + 1)
+        return json.loads(text.value.decode())
+
+    def _columns(self, variables, columns):
+        if isinstance(columns, dict):
+            columns = [columns[v] for v in variables]
+        if len(columns) != len(variables):
+            raise ValueError("Expected %d columns, got %d" % (len(variables), len(columns)))
+        if len(columns) == 0:
+            raise ValueError("An equation without variables has no batch length")
+        cols = np.broadcast_arrays(*[np.asarray(c, dtype=np.float64) for c in columns])
+        cols = [_strided(c) for c in cols]
+        return cols, cols[0].size
+
+    def _output(self, out, n_rows):
+        if out is None:
+            return np.empty(n_rows, dtype=np.float64)
+        if not isinstance(out, np.ndarray) or out.dtype != np.float64 or out.shape != (n_rows,):
+            raise ValueError("Output must be a float64 array of length %d" % n_rows)
+        if out.strides[0] % out.itemsize != 0:
+            raise ValueError("Output stride must be a whole number of values")
+        return out
+
+    def _pointers(self, cols):
+        col_ptrs = (_c_double_p*len(cols))(*[_pointer(c) for c in cols])
+        strides  = (ctypes.c_int64*len(cols))(*[c.strides[0]//c.itemsize if c.size > 0 else 1 for c in cols])
+        return col_ptrs, strides
 
 # END Class SimpleMath
@@ -1,6 +1,94 @@
+import time
 
-from simple_math import SimpleMath
+import numpy as np
+
+from simple_math import SimpleMath, MB_JIT, PM_OFF, PM_OPS, RD_SUM, RD_MAX, AD_FORWARD, AD_REVERSE
 
-print("Hello World!")
 sMath = SimpleMath()
 
+theVars = ["x", "y", "z"]
+idEQ    = sMath.add_equation("sin(x)*y + exp(z/10)", theVars)
+print("Scalar:   %.16e" % sMath.evaluate(idEQ, [1.0, 2.0, 3.0]))
+
+nRows = 1000000
+x = np.linspace(-5.0, 5.0, nRows)
+y = np.random.default_rng(1).uniform(0.0, 3.0, nRows)
+z = 3.0
+
+ref = np.sin(x)*y + np.exp(z/10)
+
+tStart = time.perf_counter()
+res = sMath.evaluate_batch(idEQ, [x, y, z])
+print("Batch:    %.6f s, max error %.3e" % (time.perf_counter() - tStart, np.max(np.abs(res - ref))))
+
+tStart = time.perf_counter()
+res = sMath.evaluate_batch(idEQ, {"x": x, "y": y, "z": z}, threads=0)
+print("Parallel: %.6f s, max error %.3e" % (time.perf_counter() - tStart, np.max(np.abs(res - ref))))
+
+# Strided views and outputs
+out = np.zeros(nRows)
+sMath.evaluate_batch(idEQ, [x[::2], y[::2], z], out=out[::2])
+print("Strided:  max error %.3e" % np.max(np.abs(out[::2] - ref[::2])))
+
+sMath.set_backend(idEQ, MB_JIT)
+res = sMath.evaluate_batch(idEQ, [x, y, z])
+print("JIT:      backend %d, max error %.3e" % (sMath.get_backend(idEQ), np.max(np.abs(res - ref))))
+
+# Reductions without an output array
+print("Sum:      relative error %.3e" % abs(sMath.reduce(idEQ, [x, y, z], RD_SUM, threads=0)/np.sum(ref) - 1))
+print("Max:      error %.3e" % abs(sMath.reduce(idEQ, [x, y, z], RD_MAX) - np.max(ref)))
+
+# Rows selected by a condition, as indices and as a bitmap
+idCond = sMath.add_equation("x > 0.5 && y <= 2 || z < 0", theVars)
+rows   = sMath.select(idCond, [x, y, z])
+words, count = sMath.bitmap(idCond, [x, y, z])
+bits   = np.unpackbits(words.view(np.uint8), bitorder="little")[:nRows]
+print("Select:   %d rows, %s" % (count, np.array_equal(rows, np.flatnonzero(sMath.evaluate_batch(idCond, [x, y, z]))) and
+                                   np.array_equal(np.flatnonzero(bits), rows)))
+
+# mod() of values that are not integers is an error for evaluate and evaluate_batch alike, also in a branch not taken
+idMod = sMath.add_equation("if(x > 2, mod(x, 2), 0)", theVars)
+for a in ([3.0, 4.0, 1.0], [3.0, 0.5]):
+    scalar = [sMath.evaluate(idMod, [v, 0.0, 0.0]) for v in a]
+    try:
+        batch = list(sMath.evaluate_batch(idMod, [np.array(a), 0.0, 0.0]))
+    except RuntimeError:
+        batch = None
+    print("Mod:      %s" % (batch == scalar if batch is not None else any(np.isnan(scalar))))
+
+# Constants of -0 keep their sign in the vector kernels of evaluate_batch
+for eq in ("x/(-0)", "atan2(-0,-1)", "-0"):
+    idZero = sMath.add_equation(eq, theVars)
+    batch  = sMath.evaluate_batch(idZero, [x[:16], y[:16], z])
+    scalar = np.array([sMath.evaluate(idZero, [a, b, z]) for a, b in zip(x[:16], y[:16])])
+    print("Zero:     %-14s %s" % (eq, np.array_equal(batch, scalar) and np.array_equal(np.signbit(batch), np.signbit(scalar))))
+
+# Several equations in one pass
+idSet = sMath.add_equation_set([
+    sMath.add_equation("sin(x)*y + z", theVars),
+    sMath.add_equation("sin(x)*y - z", theVars),
+])
+a, b = sMath.evaluate_set(idSet, [x, y, z])
+print("Set:      max error %.3e" % max(np.max(np.abs(a - (np.sin(x)*y + z))), np.max(np.abs(b - (np.sin(x)*y - z)))))
+
+# Value and derivatives in one pass
+idGrad = sMath.add_gradient(idEQ)
+value, grad = sMath.evaluate_gradient(idGrad, [1.0, 2.0, 3.0])
+print("Gradient: %.16e [%.6f %.6f %.6f]" % (value, grad[0], grad[1], grad[2]))
+
+value, grad = sMath.evaluate_gradient_batch(idGrad, [x, y, z])
+gref = [np.cos(x)*y, np.sin(x), np.full(nRows, np.exp(z/10)/10)]
+print("Gradient: max error %.3e" % max(np.max(np.abs(g - r)) for g, r in zip(grad, gref)))
+
+# The derivative of x^y by y is 0 where x is 0 and y is positive
+idPow = sMath.add_equation("x^y", ["x", "y"])
+for mode in (AD_FORWARD, AD_REVERSE):
+    value, grad = sMath.evaluate_gradient(sMath.add_gradient(idPow, mode), [0.0, 2.0])
+    print("Gradient: x^y at (0,2) mode %d [%.6f %.6f]" % (mode, grad[0], grad[1]))
+
+# Instruction counts of the calls made while profiling is on
+sMath.set_profiling(PM_OPS)
+sMath.evaluate_batch(idEQ, [x, y, z])
+sMath.set_profiling(PM_OFF)
+theProfile = sMath.profile()
+print("Profile:  %d rows, %d instructions" % (theProfile["equations"][0]["rows"], sum(o["count"] for o in theProfile["ops"])))
@@ -9,6 +9,19 @@
  */
 
 #include "clsMath.hpp"
+#include "programFile.hpp"
+#ifdef JIT_BACKEND
+#include "jitCompiler.hpp"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
 
 using namespace std;
 using namespace smath;
@@ -47,6 +60,10 @@ bool Math::setVariables(vstring_t vsVariable) {
 
 bool Math::setEquation(string_t sEquation) {
 
+    m_Parsed  = false;
+    m_Outputs = 0;
+    m_Program.reset();
+
     // Append a space to make sure last character is evaluated
     m_Equation = sEquation + " ";
 
@@ -56,6 +73,30 @@ bool Math::setEquation(string_t sEquation) {
     bool okParser = eqParser();
     if(!okParser) return false;
 
+    bool okOptimiser = eqOptimiser();
+    if(!okOptimiser) return false;
+
+    // Kept for equation sets, which look for common subexpressions across several equations
+    m_Folded = m_ParseTree;
+
+    bool okBranches = eqBranches();
+    if(!okBranches) return false;
+
+    bool okSubexpr = eqSubexpressions();
+    if(!okSubexpr) return false;
+
+    bool okCompiler = eqCompiler();
+    if(!okCompiler) return false;
+
+    // Only the folded tree is needed once the bytecode exists
+    vector<token>().swap(m_ParseTree);
+
+    bool okRegister = eqRegisterCompiler();
+    if(!okRegister) return false;
+
+    bool okProgram = eqBuildProgram();
+    if(!okProgram) return false;
+
     m_Parsed = true;
     return true;
 }
@@ -63,225 +104,142 @@ bool Math::setEquation(string_t sEquation) {
 // ****************************************************************************************************************************** //
 
 /**
- *  Method :: Eval
- * ================
- *  Evaluate the Parsed Function
- *  Takes vector of variables and vector of values as input
- *  Using Reverse Polish notation
- *  https://en.wikipedia.org/wiki/Reverse_Polish_notation
+ *  Method :: setEquationSet
+ * ==========================
+ *  Combines several parsed equations into one program with an output per equation, in the order given. The equations must
+ *  all use the same variables. Subexpressions shared between the equations are computed once per row, and EvalBatch with one
+ *  output column per equation evaluates the whole set in a single pass over the input columns.
  */
 
-bool Math::Eval(vdouble_t vdValues, double_t* pReturn) {
+bool Math::setEquationSet(const vector<const Math*>& vpEqs) {
 
-    vdouble_t vdStack;
-    size_t    iPos;
-    bool      valFound;
+    m_Parsed = false;
+    m_Program.reset();
 
-    double_t  dVal;
-    double_t  dValL;
-    double_t  dValR;
+    if(vpEqs.empty()) {
+        printf("Math Error: Equation set is empty\n");
+        return false;
+    }
 
-#ifdef DEBUG
-    printf("DEBUG> Evaluating Equation\n");
-    for(size_t i=0; i<m_WVariable.size(); i++) {
-        printf("DEBUG>  * %-5s = %10.3e\n", m_WVariable[i].c_str(), vdValues[i]);
+    m_WVariable = vpEqs[0]->m_WVariable;
+    m_Equation.clear();
+    m_ParseTree.clear();
+
+    for(size_t k=0; k<vpEqs.size(); k++) {
+        const Math* pEq = vpEqs[k];
+        if(pEq == nullptr || !pEq->m_Parsed || pEq->m_Outputs > 0) {
+            printf("Math Error: Equation %d of the set is not a valid equation\n", (int)k);
+            return false;
+        }
+        if(pEq->m_WVariable != m_WVariable) {
+            printf("Math Error: Equations in a set must have the same variables\n");
+            return false;
+        }
+        for(const auto& tItem : pEq->m_Folded) {
+            if(tItem.eval == EVAL_END) break;
+            m_ParseTree.push_back(tItem);
+        }
+        m_ParseTree.push_back(token({MP_NONE, 0.0, EVAL_OUTPUT, 1, (value_t)k}));
+        m_Equation += pEq->m_Equation + ";";
     }
-    printf("DEBUG> Computing\n");
-#endif
+    m_ParseTree.push_back(token({MP_END, 0.0, EVAL_END, 0, -1}));
+    m_Folded  = m_ParseTree;
+    m_Outputs = vpEqs.size();
 
-    if(!m_Parsed) {
-        printf("Math Eval Error: No valid equation to evaluate\n");
+    bool okBranches = eqBranches();
+    if(!okBranches) return false;
+
+    bool okSubexpr = eqSubexpressions();
+    if(!okSubexpr) return false;
+
+    bool okCompiler = eqCompiler();
+    if(!okCompiler) return false;
+    vector<token>().swap(m_ParseTree);
+
+    // Sets are only evaluated in batches, so there is no register code
+    m_RegCode.clear();
+    m_FrameSize = m_WVariable.size() + m_Consts.size();
+    m_RegResult = 0;
+
+    bool okProgram = eqBuildProgram();
+    if(!okProgram) return false;
+
+    m_Parsed = true;
+    return true;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: setGradient
+ * =======================
+ *  Builds a program that computes a parsed equation together with its derivative by each of its variables, see eqGradient.
+ *  The program has an output for the value followed by one per variable, in the order of the variables. Eval writes all of
+ *  them, and EvalBatch takes one output column each, as for an equation set. idMode is AD_FORWARD, AD_REVERSE or AD_AUTO.
+ */
+
+bool Math::setGradient(const Math* pEq, value_t idMode) {
+
+    m_Parsed = false;
+    m_Program.reset();
+
+    if(idMode != AD_AUTO && idMode != AD_FORWARD && idMode != AD_REVERSE) {
+        printf("Math Error: Unknown differentiation mode %d\n", idMode);
         return false;
     }
-
-    if(m_WVariable.size() != vdValues.size()) {
-        printf("Math Eval Error: Values vector must be the same length as variables vector\n");
+    if(pEq == nullptr || !pEq->m_Parsed || pEq->m_Outputs > 0) {
+        printf("Math Error: Only a valid single equation can be differentiated\n");
         return false;
     }
 
-    for(auto tItem : m_ParseTree) {
+    m_WVariable = pEq->m_WVariable;
+    m_Equation  = pEq->m_Equation;
+    m_ParseTree = pEq->m_Folded;
+    m_Outputs   = m_WVariable.size() + 1;
+    m_Folded.clear();
 
-        if(tItem.size == 0) {
-            if(tItem.eval == EVAL_NUMBER) {
-                vdStack.push_back(tItem.value);
-            } else
-            if(tItem.eval == EVAL_VARIABLE) {
-                iPos     = 0;
-                valFound = false;
-                for(auto sItem : m_WVariable) {
-                    if(sItem == tItem.content) {
-                        vdStack.push_back(vdValues.at(iPos));
-                        valFound = true;
-                        break;
-                    }
-                    iPos++;
-                }
-                if(!valFound) {
-                    printf("Math Eval Error: Unknown variable %s\n",tItem.content.c_str());
-                    return false;
-                }
-            } else
-            if(tItem.eval == EVAL_END) {
-                break;
-            } else {
-                printf("Math Eval Error: Unknown error in size = 0, content = '%s'\n", tItem.content.c_str());
-                return false;
-            }
-        } else
-        if(tItem.size == 1) {
-            dVal = vdStack.back(); vdStack.pop_back();
-            if(tItem.eval == EVAL_UNARY_PLUS) {
-                vdStack.push_back(dVal);
-            } else
-            if(tItem.eval == EVAL_UNARY_MINUS) {
-                vdStack.push_back(-dVal);
-            } else
-            if(tItem.eval == EVAL_FUNC_SIN) {
-                vdStack.push_back(sin(dVal));
-            } else
-            if(tItem.eval == EVAL_FUNC_COS) {
-                vdStack.push_back(cos(dVal));
-            } else
-            if(tItem.eval == EVAL_FUNC_TAN) {
-                vdStack.push_back(tan(dVal));
-            } else
-            if(tItem.eval == EVAL_FUNC_ASIN) {
-                vdStack.push_back(asin(dVal));
-            } else
-            if(tItem.eval == EVAL_FUNC_ACOS) {
-                vdStack.push_back(acos(dVal));
-            } else
-            if(tItem.eval == EVAL_FUNC_ATAN) {
-                vdStack.push_back(atan(dVal));
-            } else
-            if(tItem.eval == EVAL_FUNC_EXP) {
-                vdStack.push_back(exp(dVal));
-            } else
-            if(tItem.eval == EVAL_FUNC_LOG) {
-                vdStack.push_back(log(dVal));
-            } else
-            if(tItem.eval == EVAL_FUNC_ABS) {
-                vdStack.push_back(abs(dVal));
-            } else {
-                printf("Math Eval Error: Unknown error in size = 1, content = '%s'\n", tItem.content.c_str());
-                return false;
-            }
-        }
-        if(tItem.size == 2) {
-            dValR = vdStack.back(); vdStack.pop_back();
-            dValL = vdStack.back(); vdStack.pop_back();
-            if(tItem.eval == EVAL_MATH_PLUS) {
-                vdStack.push_back(dValL + dValR);
-            } else
-            if(tItem.eval == EVAL_MATH_MINUS) {
-                vdStack.push_back(dValL - dValR);
-            } else
-            if(tItem.eval == EVAL_MATH_MULT) {
-                vdStack.push_back(dValL * dValR);
-            } else
-            if(tItem.eval == EVAL_MATH_DIV) {
-                vdStack.push_back(dValL / dValR);
-            } else
-            if(tItem.eval == EVAL_MATH_POW) {
-                vdStack.push_back(pow(dValL,dValR));
-            } else
-            if(tItem.eval == EVAL_FUNC_ATAN2) {
-                vdStack.push_back(atan2(dValL,dValR));
-            } else
-            if(tItem.eval == EVAL_FUNC_MOD) {
-                if(dValL == floor(dValL) && dValR == floor(dValR)) {
-                    vdStack.push_back((int)floor(dValL)%(int)floor(dValR));
-                } else {
-                    printf("Math Eval Error: Function mod() requires integer values\n");
-                    return false;
-                }
-            } else
-            if(tItem.eval == EVAL_LOGICAL_AND) {
-                if(dValL && dValR) {
-                    vdStack.push_back(EVAL_TRUE);
-                } else {
-                    vdStack.push_back(EVAL_FALSE);
-                }
-            } else
-            if(tItem.eval == EVAL_LOGICAL_OR) {
-                if(dValL || dValR) {
-                    vdStack.push_back(EVAL_TRUE);
-                } else {
-                    vdStack.push_back(EVAL_FALSE);
-                }
-            } else
-            if(tItem.eval == EVAL_LOGICAL_EQ) {
-                if(dValL == dValR) {
-                    vdStack.push_back(EVAL_TRUE);
-                } else {
-                    vdStack.push_back(EVAL_FALSE);
-                }
-            } else
-            if(tItem.eval == EVAL_LOGICAL_NE) {
-                if(dValL != dValR) {
-                    vdStack.push_back(EVAL_TRUE);
-                } else {
-                    vdStack.push_back(EVAL_FALSE);
-                }
-            } else
-            if(tItem.eval == EVAL_LOGICAL_LT) {
-                if(dValL < dValR) {
-                    vdStack.push_back(EVAL_TRUE);
-                } else {
-                    vdStack.push_back(EVAL_FALSE);
-                }
-            } else
-            if(tItem.eval == EVAL_LOGICAL_GT) {
-                if(dValL > dValR) {
-                    vdStack.push_back(EVAL_TRUE);
-                } else {
-                    vdStack.push_back(EVAL_FALSE);
-                }
-            } else
-            if(tItem.eval == EVAL_LOGICAL_LE) {
-                if(dValL <= dValR) {
-                    vdStack.push_back(EVAL_TRUE);
-                } else {
-                    vdStack.push_back(EVAL_FALSE);
-                }
-            } else
-            if(tItem.eval == EVAL_LOGICAL_GE) {
-                if(dValL >= dValR) {
-                    vdStack.push_back(EVAL_TRUE);
-                } else {
-                    vdStack.push_back(EVAL_FALSE);
-                }
-            } else {
-                printf("Math Eval Error: Unknown error in size = 2, content = '%s'\n", tItem.content.c_str());
-                return false;
-            }
-        } else
-        if(tItem.size == 3) {
-            dValR = vdStack.back(); vdStack.pop_back();
-            dValL = vdStack.back(); vdStack.pop_back();
-            dVal  = vdStack.back(); vdStack.pop_back();
-            if(tItem.eval == EVAL_SPECIAL_IF) {
-                if(dVal != EVAL_FALSE) {
-                    vdStack.push_back(dValL);
-                } else {
-                    vdStack.push_back(dValR);
-                }
-            } else {
-                printf("Math Eval Error: Unknown error in size = 3, content = '%s'\n", tItem.content.c_str());
-                return false;
-            }
-        }
+    bool okGradient = eqGradient(idMode);
+    if(!okGradient) return false;
 
-#ifdef DEBUG
-        printf("DEBUG>  * Stack: ");
-        for(auto dValue : vdStack) {
-            printf("%10.3e | ", dValue);
-        }
-        printf("<< '%s'\n", tItem.content.c_str());
-#endif
+    bool okCompiler = eqCompiler();
+    if(!okCompiler) return false;
+    vector<token>().swap(m_ParseTree);
+
+    // Like sets, gradients run on the stack interpreters only
+    m_RegCode.clear();
+    m_FrameSize = m_WVariable.size() + m_Consts.size();
+    m_RegResult = 0;
+
+    bool okProgram = eqBuildProgram();
+    if(!okProgram) return false;
+
+    m_Parsed = true;
+    return true;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: setBackend
+ * ======================
+ *  Selects the interpreter used by Eval
+ *  MB_STACK runs the stack bytecode, MB_REGISTER runs the three-address register code, and MB_JIT runs native code generated
+ *  from the stack bytecode. MB_JIT falls back to the stack interpreter when the program cannot be compiled or the platform has
+ *  no executable memory; getBackend reports which one is in use. MB_INCREMENTAL keeps the value of every subexpression between
+ *  calls to Eval and only recomputes those that depend on a variable that changed, for callers that change few of many values
+ *  from one call to the next. Batches are evaluated as with MB_STACK.
+ */
+
+bool Math::setBackend(value_t idBackend) {
+
+    if(idBackend != MB_STACK && idBackend != MB_REGISTER && idBackend != MB_JIT && idBackend != MB_INCREMENTAL) {
+        printf("Math Error: Unknown backend %d\n", idBackend);
+        return false;
     }
+    m_Backend = idBackend;
 
-    *pReturn = vdStack.front();
+    // The program is immutable, so a new one is built for the new backend
+    if(m_Parsed) eqBuildProgram();
 
     return true;
 }
@@ -289,314 +247,1812 @@ bool Math::Eval(vdouble_t vdValues, double_t* pReturn) {
 // ****************************************************************************************************************************** //
 
 /**
- *  Function :: eqLexer
- * =====================
- *  Builds the equation lexer
+ *  Method :: getBackend
+ * ======================
+ *  Returns the backend used by Eval, which is MB_STACK if MB_JIT or MB_INCREMENTAL was requested but is not available
  */
 
-bool Math::eqLexer() {
+value_t Math::getBackend() {
 
-    value_t       idCurr;
-    value_t       idPrev  = MT_NONE;
-    char          cPrev   = '#';
-    string_t      sBuffer = "";
-    vector<token> vTokens;
+    if(m_Program) return m_Program->getBackend();
+    if(m_Backend == MB_JIT || m_Backend == MB_INCREMENTAL) return MB_STACK;
 
-#ifdef DEBUG
-    printf("DEBUG> This is eqLexer\n");
-    printf("DEBUG>  * Equation: '%s'\n", m_Equation.c_str());
-#endif
+    return m_Backend;
+}
 
-    for(char cCurr : m_Equation) {
+// ****************************************************************************************************************************** //
 
-        // Get specific type
-        idCurr = MT_NONE;
-        if(isdigit(cCurr)) idCurr = MT_NUMBER;
-        if(isalpha(cCurr)) idCurr = MT_WORD;
-        if(ispunct(cCurr)) idCurr = MT_OPERATOR;
+/**
+ *  Method :: getVariableCount
+ * ============================
+ */
 
-        // Numbers following characters are part of words
-        if(idCurr == MT_NUMBER && idPrev == MT_WORD) idCurr = MT_WORD;
-        // '.' is always part of a number
-        if(cCurr == '.') idCurr = MT_NUMBER;
-        // 'd' or 'e' following a number denotes exponent
-        if((cCurr == 'd' || cCurr == 'e') && idPrev == MT_NUMBER) {
-            idCurr = MT_NUMBER;
-        }
-        // '-' after an 'e' or 'd' that is a number, is also a part of a number
-        if((cCurr == '-' || cCurr == '+') && (cPrev == 'd' || cPrev == 'e') && idPrev == MT_NUMBER) {
-            idCurr = MT_NUMBER;
-        }
-        // Check if operator is actually a separataor
-        if(cCurr == '(' || cCurr == ')' || cCurr == ',') {
-            idCurr = MT_SEPARATOR;
-        }
-        // Check if unary minus
-        if((cCurr == '-' || cCurr == '+') && !(idPrev == MT_NUMBER || idPrev == MT_WORD || (idPrev == MT_NONE && cPrev != '#'))) {
-            idCurr = MT_UNARYOP;
+size_t Math::getVariableCount() {
+    return m_WVariable.size();
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: getEquation
+ * =======================
+ *  Returns the equation as given to setEquation
+ */
+
+string_t Math::getEquation() {
+    if(!m_Equation.empty() && m_Equation.back() == ' ') return m_Equation.substr(0, m_Equation.size()-1);
+    return m_Equation;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: getVariables
+ * ========================
+ */
+
+vstring_t Math::getVariables() {
+    return m_WVariable;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: writeImage
+ * ======================
+ *  Appends the compiled state of this object to a program file image, see programFile.hpp. The image holds the folded tree
+ *  and the stack and register code, so readImage restores the object without parsing, and it can still be used to build
+ *  sets and gradients or change backend. An object without a valid equation is written without code.
+ */
+
+bool Math::writeImage(ImageWriter& iwOut) {
+
+    iwOut.u32(m_Parsed ? 1 : 0);
+    iwOut.u32((uint32_t)m_Backend);
+    iwOut.u64(m_StackSize);
+    iwOut.u64(m_TempSize);
+    iwOut.u64(m_Outputs);
+    iwOut.u64(m_FrameSize);
+    iwOut.u32(m_RegResult);
+    iwOut.u32(0);
+
+    iwOut.text(m_Equation);
+    iwOut.u64(m_WVariable.size());
+    for(const auto& sItem : m_WVariable) iwOut.text(sItem);
+
+    if(!m_Parsed) {
+        for(int i=0; i<4; i++) iwOut.u64(0);
+        return true;
+    }
+
+    iwOut.u64(m_Folded.size());
+    for(const auto& tItem : m_Folded) {
+        iwOut.u32((uint32_t)tItem.type);
+        iwOut.u32((uint32_t)tItem.eval);
+        iwOut.u32((uint32_t)tItem.size);
+        iwOut.u32((uint32_t)tItem.index);
+        iwOut.f64(tItem.value);
+    }
+
+    iwOut.u64(m_Code.size());
+    for(const auto& iOp : m_Code) {
+        iwOut.u32((uint32_t)iOp.op | (uint32_t)iOp.size << 16);
+        iwOut.u32(iOp.arg);
+    }
+
+    iwOut.u64(m_Consts.size());
+    for(double_t dValue : m_Consts) iwOut.f64(dValue);
+
+    iwOut.u64(m_RegCode.size());
+    for(const auto& riIns : m_RegCode) {
+        iwOut.u32(riIns.op);
+        iwOut.u32(riIns.dst);
+        for(int i=0; i<4; i++) iwOut.u32(riIns.arg[i]);
+    }
+
+    return true;
+}
+
+// ****************************************************************************************************************************** //
+
+// Registers the register code refers to, which are the variables and constants, the result, and every destination and
+// operand other than a jump target
+static size_t regFrameSize(const vector<rinstr>& vrCode, size_t nFixed, uint32_t iResult) {
+
+    size_t nFrame = max(nFixed, (size_t)iResult + 1);
+    for(const auto& riIns : vrCode) {
+        if(riIns.op == EVAL_END) continue;
+        bool isJump = riIns.op >= EVAL_JUMP_IF && riIns.op <= EVAL_JUMP_OR;
+        if(!isJump) nFrame = max(nFrame, (size_t)riIns.dst + 1);
+        for(int i=0; i<4; i++) {
+            if(isJump && i == (riIns.op == EVAL_JUMP ? 0 : 1)) continue;
+            nFrame = max(nFrame, (size_t)riIns.arg[i] + 1);
         }
+    }
 
-        // If a new type was encountered, push the previous onto the lexer
-        if(idCurr != idPrev || idPrev == MT_SEPARATOR) {
-            if(idPrev != MT_NONE) {
-                vTokens.push_back(token({idPrev, sBuffer, 0.0, 0, 0}));
-            }
-            sBuffer = "";
+    return nFrame;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: readImage
+ * =====================
+ *  Restores an object written by writeImage and builds its program. The checksum of the file guards against damage, but not
+ *  against an image written with bad sizes, so the operands of the code are checked against the sizes they index, and the
+ *  sizes against those the code needs. A bad image is refused instead of evaluated. Returns false if the image is not valid.
+ */
+bool Math::readImage(ImageReader& irIn) {
+
+    uint32_t isParsed, idBackend, iRegResult, nPad;
+    uint64_t nStack, nTemp, nOutputs, nFrame;
+    size_t   nCount;
+
+    m_Parsed = false;
+    m_Program.reset();
+
+    if(!irIn.u32(&isParsed) || !irIn.u32(&idBackend)) return false;
+    if(!irIn.u64(&nStack) || !irIn.u64(&nTemp) || !irIn.u64(&nOutputs) || !irIn.u64(&nFrame)) return false;
+    if(!irIn.u32(&iRegResult) || !irIn.u32(&nPad)) return false;
+    if(idBackend > MB_INCREMENTAL) return false;
+
+    m_Backend   = (value_t)idBackend;
+    m_StackSize = (size_t)nStack;
+    m_TempSize  = (size_t)nTemp;
+    m_Outputs   = (size_t)nOutputs;
+    m_FrameSize = (size_t)nFrame;
+    m_RegResult = iRegResult;
+
+    if(!irIn.text(&m_Equation) || !irIn.count(&nCount, 8)) return false;
+    m_WVariable.resize(nCount);
+    for(auto& sItem : m_WVariable) {
+        if(!irIn.text(&sItem)) return false;
+    }
+
+    if(!irIn.count(&nCount, 24)) return false;
+    m_Folded.resize(nCount);
+    for(auto& tItem : m_Folded) {
+        uint32_t aField[4];
+        for(int i=0; i<4; i++) {
+            if(!irIn.u32(&aField[i])) return false;
         }
-        sBuffer += cCurr;
+        if(!irIn.f64(&tItem.value)) return false;
+        tItem.type  = (value_t)aField[0];
+        tItem.eval  = (value_t)aField[1];
+        tItem.size  = (value_t)aField[2];
+        tItem.index = (value_t)aField[3];
+        if(tItem.size < 0 || tItem.size > 3 || tItem.eval <= 0 || tItem.eval >= EVAL_MOVE) return false;
+        if(tItem.eval == EVAL_VARIABLE && (tItem.index < 0 || (size_t)tItem.index >= m_WVariable.size())) return false;
+    }
 
-        // Set previous values for next loop
-        idPrev = idCurr;
-        cPrev  = cCurr;
+    if(!irIn.count(&nCount, 8)) return false;
+    m_Code.resize(nCount);
+    for(auto& iOp : m_Code) {
+        uint32_t nOp;
+        if(!irIn.u32(&nOp) || !irIn.u32(&iOp.arg)) return false;
+        iOp.op   = (uint16_t)(nOp & 0xffff);
+        iOp.size = (uint16_t)(nOp >> 16);
+    }
+
+    if(!irIn.count(&nCount, 8)) return false;
+    m_Consts.resize(nCount);
+    for(auto& dValue : m_Consts) {
+        if(!irIn.f64(&dValue)) return false;
     }
 
-    // Clean up lexer and check for invalid entries
-    idPrev = MP_NONE;
-    for(auto tItem : vTokens) {
+    if(!irIn.count(&nCount, 24)) return false;
+    m_RegCode.resize(nCount);
+    for(auto& riIns : m_RegCode) {
+        if(!irIn.u32(&riIns.op) || !irIn.u32(&riIns.dst)) return false;
+        for(int i=0; i<4; i++) {
+            if(!irIn.u32(&riIns.arg[i])) return false;
+        }
+    }
 
-        value_t  idType = MP_NONE;
-        value_t  idEval = EVAL_NONE;
-        value_t  nParms = 0;
-        double_t dValue = 0.0;
+    m_Tokens.clear();
+    m_ParseTree.clear();
+    if(isParsed == 0) return true;
+
+    // Every operand must index into what it refers to, and the buffer sizes must be those the code needs. The stack depth is
+    // walked like eqStackSize does, so an image cannot understate it, and sizes beyond the last index used are refused.
+    size_t nVars  = m_WVariable.size();
+    size_t nDepth = 0;
+    size_t maxDep = 0;
+    size_t nTemps = 0;
+    if(m_Code.empty() || m_Code.back().op != EVAL_END) return false;
+    for(const auto& iOp : m_Code) {
+        if(iOp.op >= EVAL_MOVE || iOp.size > 3) return false;
+        if(iOp.op == EVAL_VARIABLE && iOp.arg >= nVars) return false;
+        if(iOp.op == EVAL_NUMBER && iOp.arg >= m_Consts.size()) return false;
+        if((iOp.op == EVAL_STORE || iOp.op == EVAL_LOAD) && iOp.arg >= m_TempSize) return false;
+        if(iOp.op == EVAL_OUTPUT && iOp.arg >= m_Outputs) return false;
+        if(iOp.op >= EVAL_JUMP_IF && iOp.op <= EVAL_JUMP_OR && iOp.arg >= m_Code.size()) return false;
+        if(iOp.op == EVAL_STORE || iOp.op == EVAL_LOAD) nTemps = max(nTemps, (size_t)iOp.arg + 1);
+        if(iOp.op == EVAL_END) break;
+        if(iOp.size > nDepth) return false;
+        nDepth = iOp.size == 0 ? nDepth+1 : iOp.op == EVAL_OUTPUT ? nDepth-1 : nDepth-iOp.size+1;
+        maxDep = max(maxDep, nDepth);
+    }
+    if(nDepth != (m_Outputs > 0 ? 0 : 1) || maxDep != m_StackSize || m_TempSize != nTemps) return false;
 
-        switch(tItem.type) {
-        case MT_OPERATOR:
-            if(tItem.content == "+") {
-                idType = MP_MATH;
-                idEval = EVAL_MATH_PLUS;
-                nParms = 2;
-            } else
-            if(tItem.content == "-") {
-                idType = MP_MATH;
-                idEval = EVAL_MATH_MINUS;
-                nParms = 2;
-            } else
-            if(tItem.content == "*") {
-                idType = MP_MATH;
-                idEval = EVAL_MATH_MULT;
-                nParms = 2;
-            } else
-            if(tItem.content == "/") {
-                idType = MP_MATH;
-                idEval = EVAL_MATH_DIV;
-                nParms = 2;
-            } else
-            if(tItem.content == "^") {
-                idType = MP_MATH;
-                idEval = EVAL_MATH_POW;
-                nParms = 2;
-            } else
-            if(tItem.content == "&&") {
-                idType = MP_LOGICAL;
-                idEval = EVAL_LOGICAL_AND;
-                nParms = 2;
-            } else
-            if(tItem.content == "||") {
-                idType = MP_LOGICAL;
-                idEval = EVAL_LOGICAL_OR;
-                nParms = 2;
-            } else
-            if(tItem.content == "==") {
-                idType = MP_LOGICAL;
-                idEval = EVAL_LOGICAL_EQ;
-                nParms = 2;
-            } else
-            if(tItem.content == "!=") {
-                idType = MP_LOGICAL;
-                idEval = EVAL_LOGICAL_NE;
-                nParms = 2;
-            } else
-            if(tItem.content == "<") {
-                idType = MP_LOGICAL;
-                idEval = EVAL_LOGICAL_LT;
-                nParms = 2;
-            } else
-            if(tItem.content == ">") {
-                idType = MP_LOGICAL;
-                idEval = EVAL_LOGICAL_GT;
-                nParms = 2;
-            } else
-            if(tItem.content == "<=") {
-                idType = MP_LOGICAL;
-                idEval = EVAL_LOGICAL_LE;
-                nParms = 2;
+    if(!m_RegCode.empty()) {
+        if(m_FrameSize < nVars + m_Consts.size() || m_RegResult >= m_FrameSize) return false;
+        if(m_RegCode.back().op != EVAL_END) return false;
+        if(m_FrameSize != regFrameSize(m_RegCode, nVars + m_Consts.size(), m_RegResult)) return false;
+    } else
+    if(m_FrameSize > nVars + m_Consts.size()) {
+        return false;
+    }
+    for(const auto& riIns : m_RegCode) {
+        if(riIns.op >= EVAL_COUNT || riIns.dst >= m_FrameSize) return false;
+        bool isJump = riIns.op >= EVAL_JUMP_IF && riIns.op <= EVAL_JUMP_OR;
+        for(int i=0; i<4; i++) {
+            if(isJump && i == (riIns.op == EVAL_JUMP ? 0 : 1)) {
+                if(riIns.arg[i] >= m_RegCode.size()) return false;
             } else
-            if(tItem.content == ">=") {
-                idType = MP_LOGICAL;
-                idEval = EVAL_LOGICAL_GE;
-                nParms = 2;
-            } else {
-                idType = MP_INVALID;
-                idEval = EVAL_NONE;
-                nParms = 0;
+            if(riIns.arg[i] >= m_FrameSize) {
+                return false;
             }
-            break;
+        }
+    }
 
-        case MT_UNARYOP:
-            if(tItem.content == "+") {
-                idType = MP_UNARY;
-                idEval = EVAL_UNARY_PLUS;
-                nParms = 1;
-            } else
-            if(tItem.content == "-") {
+    if(!eqBuildProgram()) return false;
+
+    m_Parsed = true;
+    return true;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: getMemoryUsage
+ * ==========================
+ *  Returns an estimate of the bytes held by this object and its compiled program, excluding native JIT code
+ */
+
+size_t Math::getMemoryUsage() {
+
+    size_t nBytes = sizeof(Math) + m_Equation.capacity();
+
+    for(const auto& sItem : m_WVariable) nBytes += sizeof(string_t) + sItem.capacity();
+
+    nBytes += (m_Tokens.capacity() + m_ParseTree.capacity() + m_Folded.capacity())*sizeof(token);
+    nBytes += m_Code.capacity()*sizeof(instr) + m_RegCode.capacity()*sizeof(rinstr) + m_Consts.capacity()*sizeof(double_t);
+    nBytes += (m_Scratch.stack.capacity() + m_Scratch.frame.capacity() + m_Scratch.block.capacity() +
+               m_Scratch.output.capacity())*sizeof(double_t);
+    for(const auto& ifFrame : m_Scratch.caches) nBytes += sizeof(incframe) + ifFrame.values.capacity()*sizeof(double_t);
+    nBytes += m_Scratch.fblock.capacity()*sizeof(float);
+
+    // The program holds copies of the code and the variable names
+    if(m_Program) {
+        nBytes += sizeof(Program) + m_Code.capacity()*sizeof(instr) + m_RegCode.capacity()*sizeof(rinstr);
+        nBytes += m_Consts.capacity()*(sizeof(double_t) + sizeof(float));
+        nBytes += m_WVariable.size()*sizeof(string_t);
+        if(m_Program->m_Inc) {
+            const inccode& icCode = *m_Program->m_Inc;
+            nBytes += sizeof(inccode) + icCode.code.capacity()*sizeof(rinstr) + icCode.consts.capacity()*sizeof(double_t);
+            nBytes += (icCode.first.capacity() + icCode.deps.capacity())*sizeof(uint32_t);
+        }
+        if(m_Program->m_Filter) {
+            const filtercode& fcCode = *m_Program->m_Filter;
+            nBytes += sizeof(filtercode) + fcCode.code.capacity()*sizeof(instr) + fcCode.steps.capacity()*sizeof(filterstep);
+        }
+    }
+
+    return nBytes;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: Eval
+ * ================
+ *  Evaluate the Parsed Function
+ *  Takes vector of values in the same order as the vector of variables
+ */
+
+bool Math::Eval(const vdouble_t& vdValues, double_t* pReturn) {
+    return Eval(vdValues.data(), vdValues.size(), pReturn);
+}
+
+/**
+ *  Method :: Eval
+ * ================
+ *  Evaluate the Parsed Function
+ *  Takes a pointer to nValues values in the same order as the vector of variables
+ *  Runs the compiled program with the scratch buffers of this object, see Program::Eval
+ */
+
+bool Math::Eval(const double_t* pValues, size_t nValues, double_t* pReturn) {
+
+    if(!m_Parsed) {
+        printf("Math Eval Error: No valid equation to evaluate\n");
+        return false;
+    }
+
+    return m_Program->Eval(pValues, nValues, pReturn, m_Scratch);
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: EvalBatch
+ * =====================
+ *  Evaluate the Parsed Function on columns of values, see Program::EvalBatch
+ */
+
+bool Math::EvalBatch(const double_t* const* ppColumns, size_t nRows, double_t* pOutput, size_t nStride) {
+
+    if(!m_Parsed) {
+        printf("Math Eval Error: No valid equation to evaluate\n");
+        return false;
+    }
+
+    return m_Program->EvalBatch(ppColumns, nRows, pOutput, nStride, m_Scratch);
+}
+
+bool Math::EvalBatch(const float* const* ppColumns, size_t nRows, float* pOutput, size_t nStride) {
+
+    if(!m_Parsed) {
+        printf("Math Eval Error: No valid equation to evaluate\n");
+        return false;
+    }
+
+    return m_Program->EvalBatch(ppColumns, nRows, pOutput, nStride, m_Scratch);
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: getProgram
+ * ======================
+ *  Returns the compiled program, or an empty pointer if there is no valid equation. The program stays valid after the
+ *  equation or backend of this object is changed, and can be evaluated from several threads at once with one scratch each.
+ */
+
+shared_ptr<const Program> Math::getProgram() {
+    return m_Program;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: eqLexer
+ * =====================
+ *  Builds the equation lexer
+ *  Tokens refer to the equation text by position only, and words are looked up in the keyword table and the variable hash
+ *  table without copying them, so the lexer runs in time linear in the length of the equation.
+ */
+
+// Operators, matched on the text of an MT_OPERATOR run
+struct lexOperator {
+    const char* text;
+    value_t     type;
+    value_t     eval;
+};
+
+static const lexOperator s_Operators[] = {
+    {"+",  MP_MATH,    EVAL_MATH_PLUS},   {"-",  MP_MATH,    EVAL_MATH_MINUS},  {"*",  MP_MATH,    EVAL_MATH_MULT},
+    {"/",  MP_MATH,    EVAL_MATH_DIV},    {"^",  MP_MATH,    EVAL_MATH_POW},    {"&&", MP_LOGICAL, EVAL_LOGICAL_AND},
+    {"||", MP_LOGICAL, EVAL_LOGICAL_OR},  {"==", MP_LOGICAL, EVAL_LOGICAL_EQ},  {"!=", MP_LOGICAL, EVAL_LOGICAL_NE},
+    {"<",  MP_LOGICAL, EVAL_LOGICAL_LT},  {">",  MP_LOGICAL, EVAL_LOGICAL_GT},  {"<=", MP_LOGICAL, EVAL_LOGICAL_LE},
+    {">=", MP_LOGICAL, EVAL_LOGICAL_GE},
+};
+
+// Keywords, in a perfect hash table indexed by keywordHash. Every keyword has a slot of its own, so a word is a keyword if
+// and only if it equals the text in its slot.
+struct lexKeyword {
+    const char* text;
+    value_t     type;
+    value_t     eval;
+    value_t     parms;
+};
+
+static const lexKeyword s_Keywords[32] = {
+    {},                                    {},                                     {},
+    {},                                    {},                                     {"exp",   MP_FUNC,  EVAL_FUNC_EXP,   1},
+    {"if",    MP_FUNC,  EVAL_SPECIAL_IF, 3}, {},                                   {"tan",   MP_FUNC,  EVAL_FUNC_TAN,   1},
+    {},                                    {},                                     {},
+    {},                                    {"abs",   MP_FUNC,  EVAL_FUNC_ABS,   1}, {"sin",   MP_FUNC,  EVAL_FUNC_SIN,   1},
+    {"acos",  MP_FUNC,  EVAL_FUNC_ACOS,  1}, {},                                   {},
+    {},                                    {},                                     {"mod",   MP_FUNC,  EVAL_FUNC_MOD,   2},
+    {"asin",  MP_FUNC,  EVAL_FUNC_ASIN,  1}, {"atan",  MP_FUNC,  EVAL_FUNC_ATAN,  1}, {},
+    {"log",   MP_FUNC,  EVAL_FUNC_LOG,   1}, {},                                   {},
+    {},                                    {},                                     {"pi",    MP_CONST, EVAL_NUMBER,     0},
+    {"cos",   MP_FUNC,  EVAL_FUNC_COS,   1}, {"atan2", MP_FUNC,  EVAL_FUNC_ATAN2, 2},
+};
+
+static inline size_t keywordHash(const char* pWord, size_t nLen) {
+    return (nLen + 2*(unsigned char)pWord[0] + (unsigned char)pWord[1] + 2*(unsigned char)pWord[nLen-1]) & 31;
+}
+
+static inline bool sameText(const char* pWord, size_t nLen, const char* pText) {
+    return strncmp(pWord, pText, nLen) == 0 && pText[nLen] == '\0';
+}
+
+// FNV-1a, for the variable table
+static inline uint64_t wordHash(const char* pWord, size_t nLen) {
+    uint64_t nHash = 14695981039346656037ULL;
+    for(size_t i=0; i<nLen; i++) {
+        nHash = (nHash ^ (unsigned char)pWord[i])*1099511628211ULL;
+    }
+    return nHash;
+}
+
+bool Math::eqLexer() {
+
+    const char* pText   = m_Equation.data();
+    size_t      nText   = m_Equation.size();
+    value_t     idCurr;
+    value_t     idPrev  = MT_NONE;
+    char        cPrev   = '#';
+    size_t      iStart  = 0;
+    value_t     idLast  = MP_NONE;
+    bool        isValid = true;
+
+    m_Tokens.clear();
+
+    // Open addressing table of variable index+1, at most half full
+    size_t nTable = 16;
+    while(nTable < 2*m_WVariable.size()) nTable *= 2;
+    vector<uint32_t> viTable(nTable, 0);
+    for(size_t i=0; i<m_WVariable.size(); i++) {
+        size_t iSlot = wordHash(m_WVariable[i].data(), m_WVariable[i].size()) & (nTable-1);
+        while(viTable[iSlot] != 0) iSlot = (iSlot+1) & (nTable-1);
+        viTable[iSlot] = (uint32_t)i+1;
+    }
+
+#ifdef DEBUG
+    printf("DEBUG> This is eqLexer\n");
+    printf("DEBUG>  * Equation: '%s'\n", m_Equation.c_str());
+#endif
+
+    // Classifies the characters pWord[0..nLen) lexed as idLex, and appends the token
+    auto addToken = [&](value_t idLex, const char* pWord, size_t nLen) {
+
+        value_t  idType = MP_INVALID;
+        value_t  idEval = EVAL_NONE;
+        value_t  nParms = 0;
+        value_t  iSlot  = -1;
+        double_t dValue = 0.0;
+
+        switch(idLex) {
+        case MT_OPERATOR:
+            for(const auto& loItem : s_Operators) {
+                if(sameText(pWord, nLen, loItem.text)) {
+                    idType = loItem.type;
+                    idEval = loItem.eval;
+                    nParms = 2;
+                    break;
+                }
+            }
+            break;
+
+        case MT_UNARYOP:
+            if(nLen == 1 && (pWord[0] == '+' || pWord[0] == '-')) {
                 idType = MP_UNARY;
-                idEval = EVAL_UNARY_MINUS;
+                idEval = pWord[0] == '+' ? EVAL_UNARY_PLUS : EVAL_UNARY_MINUS;
                 nParms = 1;
-            } else {
-                idType = MP_INVALID;
-                idEval = EVAL_NONE;
-                nParms = 0;
             }
             break;
 
         case MT_NUMBER:
-            try {
-                dValue = stof(tItem.content);
-                idType = MP_NUMBER;
-                idEval = EVAL_NUMBER;
-                nParms = 0;
-            } catch(...) {
-                idType = MP_INVALID;
-                idEval = EVAL_NONE;
-                nParms = 0;
+            // Numbers are read in single precision and rounded to the nearest float, as they always have been
+            {
+                float fValue = 0.0f;
+                bool  okRead = false;
+#ifdef __cpp_lib_to_chars
+                from_chars_result fcRead = from_chars(pWord, pWord+nLen, fValue);
+                okRead = fcRead.ec == errc();
+#else
+                char  aWord[64];
+                char* pEnd = nullptr;
+                if(nLen < sizeof(aWord)) {
+                    memcpy(aWord, pWord, nLen);
+                    aWord[nLen] = '\0';
+                    errno  = 0;
+                    fValue = strtof(aWord, &pEnd);
+                    okRead = pEnd != aWord && errno != ERANGE;
+                }
+#endif
+                if(okRead) {
+                    dValue = fValue;
+                    idType = MP_NUMBER;
+                    idEval = EVAL_NUMBER;
+                }
             }
             break;
 
         case MT_WORD:
-            if(tItem.content == "sin") {
-                idType = MP_FUNC;
-                idEval = EVAL_FUNC_SIN;
-                nParms = 1;
-            } else
-            if(tItem.content == "cos") {
-                idType = MP_FUNC;
-                idEval = EVAL_FUNC_COS;
-                nParms = 1;
-            } else
-            if(tItem.content == "tan") {
-                idType = MP_FUNC;
-                idEval = EVAL_FUNC_TAN;
-                nParms = 1;
-            } else
-            if(tItem.content == "asin") {
-                idType = MP_FUNC;
-                idEval = EVAL_FUNC_ASIN;
-                nParms = 1;
-            } else
-            if(tItem.content == "acos") {
-                idType = MP_FUNC;
-                idEval = EVAL_FUNC_ACOS;
-                nParms = 1;
-            } else
-            if(tItem.content == "atan") {
-                idType = MP_FUNC;
-                idEval = EVAL_FUNC_ATAN;
-                nParms = 1;
-            } else
-            if(tItem.content == "atan2") {
-                idType = MP_FUNC;
-                idEval = EVAL_FUNC_ATAN2;
-                nParms = 2;
-            } else
-            if(tItem.content == "exp") {
-                idType = MP_FUNC;
-                idEval = EVAL_FUNC_EXP;
-                nParms = 1;
-            } else
-            if(tItem.content == "log") {
-                idType = MP_FUNC;
-                idEval = EVAL_FUNC_LOG;
-                nParms = 1;
-            } else
-            if(tItem.content == "abs") {
-                idType = MP_FUNC;
-                idEval = EVAL_FUNC_ABS;
-                nParms = 1;
-            } else
-            if(tItem.content == "mod") {
-                idType = MP_FUNC;
-                idEval = EVAL_FUNC_MOD;
-                nParms = 2;
-            } else
-            if(tItem.content == "if") {
-                idType = MP_FUNC;
-                idEval = EVAL_SPECIAL_IF;
-                nParms = 3;
-            } else
-            if(tItem.content == "pi") {
-                idType = MP_CONST;
-                idEval = EVAL_NUMBER;
-                nParms = 0;
-                dValue = M_PI;
-            } else {
-                for(string_t sItem : m_WVariable) {
-                    if(sItem == tItem.content) {
-                        idType = MP_VARIABLE;
-                        idEval = EVAL_VARIABLE;
-                        nParms = 0;
-                    }
+            if(nLen >= 2) {
+                const lexKeyword& lkItem = s_Keywords[keywordHash(pWord, nLen)];
+                if(lkItem.text != nullptr && sameText(pWord, nLen, lkItem.text)) {
+                    idType = lkItem.type;
+                    idEval = lkItem.eval;
+                    nParms = lkItem.parms;
+                    if(idType == MP_CONST) dValue = M_PI;
+                    break;
                 }
-                if(idType == MP_NONE) {
-                    idType = MP_INVALID;
-                    idEval = EVAL_NONE;
-                    nParms = 0;
+            }
+            for(size_t iPos=wordHash(pWord, nLen) & (nTable-1); viTable[iPos] != 0; iPos=(iPos+1) & (nTable-1)) {
+                const string_t& sVar = m_WVariable[viTable[iPos]-1];
+                if(sVar.size() == nLen && memcmp(sVar.data(), pWord, nLen) == 0) {
+                    idType = MP_VARIABLE;
+                    idEval = EVAL_VARIABLE;
+                    iSlot  = (value_t)viTable[iPos]-1;
+                    break;
                 }
             }
             break;
 
         case MT_SEPARATOR:
-            if(tItem.content == "(") {
-                idType = MP_LBRACK;
-                idEval = EVAL_NONE;
-                nParms = 0;
-            } else
-            if(tItem.content == ")") {
-                idType = MP_RBRACK;
-                idEval = EVAL_NONE;
-                nParms = 0;
-            } else
-            if(tItem.content == ",") {
-                idType = MP_COMMA;
-                idEval = EVAL_NONE;
-                nParms = 0;
-            } else {
-                idType = MP_INVALID;
-                idEval = EVAL_NONE;
-                nParms = 0;
-            }
+            idType = pWord[0] == '(' ? MP_LBRACK : pWord[0] == ')' ? MP_RBRACK : MP_COMMA;
             break;
         }
 
-        if(idType == MP_INVALID || (idType == idPrev && !(idType == MP_LBRACK || idType == MP_RBRACK ))) {
-            printf("Math Error: Cannot parse token '%s'\n", tItem.content.c_str());
+        if(idType == MP_INVALID || (idType == idLast && !(idType == MP_LBRACK || idType == MP_RBRACK ))) {
+            printf("Math Error: Cannot parse token '%.*s'\n", (int)nLen, pWord);
             return false;
-        } else {
-            m_Tokens.push_back(token({idType, tItem.content, dValue, idEval, nParms}));
         }
+        m_Tokens.push_back(token({idType, dValue, idEval, nParms, iSlot}));
+        idLast = idType;
+
+        return true;
+    };
+
+    for(size_t i=0; i<nText && isValid; i++) {
+
+        char cCurr = pText[i];
+
+        // Get specific type
+        idCurr = MT_NONE;
+        if(isdigit((unsigned char)cCurr)) idCurr = MT_NUMBER;
+        if(isalpha((unsigned char)cCurr)) idCurr = MT_WORD;
+        if(ispunct((unsigned char)cCurr)) idCurr = MT_OPERATOR;
+
+        // Numbers following characters are part of words
+        if(idCurr == MT_NUMBER && idPrev == MT_WORD) idCurr = MT_WORD;
+        // '.' is always part of a number
+        if(cCurr == '.') idCurr = MT_NUMBER;
+        // 'd' or 'e' following a number denotes exponent
+        if((cCurr == 'd' || cCurr == 'e') && idPrev == MT_NUMBER) {
+            idCurr = MT_NUMBER;
+        }
+        // '-' after an 'e' or 'd' that is a number, is also a part of a number
+        if((cCurr == '-' || cCurr == '+') && (cPrev == 'd' || cPrev == 'e') && idPrev == MT_NUMBER) {
+            idCurr = MT_NUMBER;
+        }
+        // Check if operator is actually a separataor
+        if(cCurr == '(' || cCurr == ')' || cCurr == ',') {
+            idCurr = MT_SEPARATOR;
+        }
+        // Check if unary minus, a closing bracket ends an operand just like a number or word
+        if((cCurr == '-' || cCurr == '+') && !(idPrev == MT_NUMBER || idPrev == MT_WORD || cPrev == ')' || (idPrev == MT_NONE && cPrev != '#'))) {
+            idCurr = MT_UNARYOP;
+        }
+
+        // If a new type was encountered, classify the previous one, runs of other characters are dropped
+        if(idCurr != idPrev || idPrev == MT_SEPARATOR) {
+            if(idPrev != MT_NONE) {
+                isValid = addToken(idPrev, pText+iStart, i-iStart);
+            }
+            iStart = i;
+        }
+
+        // Set previous values for next loop
+        idPrev = idCurr;
+        cPrev  = cCurr;
+    }
+    if(!isValid) return false;
+
+    // Check that we actually have something
+    if(m_Tokens.size() == 0) {
+        printf("Math Error: No equation\n");
+        return false;
+    }
+
+    // Add end token
+    m_Tokens.push_back(token({MP_END, 0.0, EVAL_END, 0, -1}));
+
+#ifdef DEBUG
+    // Echo lexer for debug
+    printf("DEBUG> Lexer result:\n");
+    size_t lIdx = 0;
+    for(const auto& tItem : m_Tokens) {
+        lIdx++;
+        printf("DEBUG>  * Item %2d : ", int(lIdx));
+        printf("Type = %2d, ",          tItem.eval);
+        printf("Size = %1d, ",          tItem.size);
+        printf("Value = %23.16e, ",     tItem.value);
+        printf("Slot = %2d, ",          tItem.index);
+        printf("Content = '%s'\n",      tokenText(tItem).c_str());
+    }
+#endif
+
+    return true;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: eqParser
+ * ======================
+ *  Parses the equation using the Shunting-yard algorithm
+ *  Based on https://en.wikipedia.org/wiki/Shunting-yard_algorithm
+ *  The operator stack has its top at the back, so every token is pushed and popped once and parsing takes linear time. The
+ *  parse tree is written to m_ParseTree, and the lexer tokens are released afterwards.
+ */
+
+bool Math::eqParser() {
+
+    vector<token>& vtOutput = m_ParseTree;
+    vector<token>  vtStack;
+
+    vtOutput.clear();
+    vtOutput.reserve(m_Tokens.size());
+
+#ifdef DEBUG
+    printf("DEBUG> This is eqParser using Shunting-Yard algorithm\n");
+    uint32_t nStep = 0;
+#endif
+
+    for(const auto& tItem : m_Tokens) {
+
+        int  itemPrec   = 0;
+        int  itemAssoc  = 0;
+        int  stackPrec  = 0;
+        int  stackAssoc = 0;
+        bool isClosed   = false;
+
+        switch(tItem.type) {
+
+        case MP_NUMBER:
+            vtOutput.push_back(tItem);
+            break;
+
+        case MP_VARIABLE:
+            vtOutput.push_back(tItem);
+            break;
+
+        case MP_CONST:
+            vtOutput.push_back(tItem);
+            break;
+
+        case MP_FUNC:
+            vtStack.push_back(tItem);
+            break;
+
+        case MP_LOGICAL:
+            precedenceLogical(tItem.eval,&itemPrec,&itemAssoc);
+            while(!vtStack.empty()) {
+                const token& tStack = vtStack.back();
+                precedenceLogical(tStack.eval,&stackPrec,&stackAssoc);
+                if( tStack.type == MP_MATH &&
+                    ( (itemAssoc == ASSOC_L && itemPrec <= stackPrec) ||
+                        (itemAssoc == ASSOC_R && itemPrec <  stackPrec) ) ) {
+                    vtOutput.push_back(tStack);
+                    vtStack.pop_back();
+                } else {
+                    break;
+                }
+            }
+            vtStack.push_back(tItem);
+
+            break;
+
+        case MP_MATH:
+            precedenceMath(tItem.eval,false,&itemPrec,&itemAssoc);
+            while(!vtStack.empty()) {
+                const token& tStack = vtStack.back();
+                precedenceMath(tStack.eval,false,&stackPrec,&stackAssoc);
+                if( (tStack.type == MP_MATH || tStack.type == MP_UNARY) &&
+                    ( (itemAssoc == ASSOC_L && itemPrec <= stackPrec) ||
+                        (itemAssoc == ASSOC_R && itemPrec <  stackPrec) ) ) {
+                    vtOutput.push_back(tStack);
+                    vtStack.pop_back();
+                } else {
+                    break;
+                }
+            }
+            vtStack.push_back(tItem);
+
+            break;
+
+        case MP_UNARY:
+            precedenceMath(tItem.eval,true,&itemPrec,&itemAssoc);
+            while(!vtStack.empty()) {
+                const token& tStack = vtStack.back();
+                precedenceMath(tStack.eval,true,&stackPrec,&stackAssoc);
+                if( (tStack.type == MP_MATH || tStack.type == MP_UNARY) &&
+                    ( (itemAssoc == ASSOC_L && itemPrec <= stackPrec) ||
+                        (itemAssoc == ASSOC_R && itemPrec <  stackPrec) ) ) {
+                    vtOutput.push_back(tStack);
+                    vtStack.pop_back();
+                } else {
+                    break;
+                }
+            }
+            vtStack.push_back(tItem);
+
+            break;
+
+        case MP_LBRACK:
+            vtStack.push_back(tItem);
+            break;
+
+        case MP_RBRACK:
+            while(!vtStack.empty()) {
+                if(vtStack.back().type != MP_LBRACK) {
+                    vtOutput.push_back(vtStack.back());
+                    vtStack.pop_back();
+                } else {
+                    isClosed = true;
+                    break;
+                }
+            }
+
+            // Check if brackets were closed
+            if(isClosed) {
+                vtStack.pop_back();
+            } else {
+                printf("Math Error: Paranthesis mismatch\n");
+                return false;
+            }
+
+            // Check if the next token on stack is a function
+            if(vtStack.size() > 0 && vtStack.back().type == MP_FUNC) {
+                vtOutput.push_back(vtStack.back());
+                vtStack.pop_back();
+            }
+
+            break;
+
+        case MP_COMMA:
+            while(!vtStack.empty() && vtStack.back().type != MP_LBRACK) {
+                vtOutput.push_back(vtStack.back());
+                vtStack.pop_back();
+            }
+
+            break;
+
+        case MP_END:
+            if(vtStack.size() > 0) {
+                if( vtStack.back().type == MP_LBRACK ||
+                    vtStack.back().type == MP_RBRACK ) {
+                printf("Math Error: Paranthesis mismatch\n");
+                return false;
+                }
+
+                while(!vtStack.empty()) {
+                    vtOutput.push_back(vtStack.back());
+                    vtStack.pop_back();
+                }
+            }
+
+            vtOutput.push_back(tItem);
+
+#ifdef DEBUG
+            nStep++;
+            printf("DEBUG> Step %d\n", nStep);
+            printf("DEBUG>  * Current : %s\n", tokenText(tItem).c_str());
+            printf("DEBUG>  * Output  : ");
+            for(const auto& tTemp : vtOutput) {
+                printf("%s  ",tokenText(tTemp).c_str());
+            }
+            printf("\n");
+#endif
+
+            vector<token>().swap(m_Tokens);
+
+            return eqStackSize();
+        }
+
+#ifdef DEBUG
+        nStep++;
+        printf("DEBUG> Step %d\n", nStep);
+        printf("DEBUG>  * Current : %s\n", tokenText(tItem).c_str());
+        printf("DEBUG>  * Stack   : ");
+        for(auto itTemp=vtStack.rbegin(); itTemp!=vtStack.rend(); ++itTemp) {
+            printf("%s  ",tokenText(*itTemp).c_str());
+        }
+        printf("\n");
+        printf("DEBUG>  * Output  : ");
+        for(const auto& tTemp : vtOutput) {
+            printf("%s  ",tokenText(tTemp).c_str());
+        }
+        printf("\n");
+#endif
+    }
+
+    return false;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: eqStackSize
+ * =========================
+ *  Validates the arity of the parsed equation and computes the maximum stack depth needed to evaluate it
+ */
+
+bool Math::eqStackSize() {
+
+    size_t nDepth = 0;
+    size_t maxDep = 0;
+
+    for(const auto& tItem : m_ParseTree) {
+        if(tItem.eval == EVAL_END) break;
+        if((size_t)tItem.size > nDepth) {
+            printf("Math Error: Missing operand for '%s'\n", tokenText(tItem).c_str());
+            return false;
+        }
+        if(tItem.size == 0) {
+            nDepth++;
+        } else
+        if(tItem.eval == EVAL_OUTPUT) {
+            nDepth--;
+        } else {
+            nDepth -= tItem.size - 1;
+        }
+        if(nDepth > maxDep) maxDep = nDepth;
+    }
+
+    // An equation set leaves nothing on the stack, each of its results is popped by an output
+    if(nDepth != (m_Outputs > 0 ? 0 : 1)) {
+        printf("Math Error: Equation does not reduce to a single value\n");
+        return false;
+    }
+
+    m_StackSize = maxDep;
+
+#ifdef DEBUG
+    printf("DEBUG> Stack depth: %d\n", (int)m_StackSize);
+#endif
+
+    return true;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: eqOptimiser
+ * =========================
+ *  Folds constant subexpressions of the parse tree
+ *  Every operator whose operands are all numbers is evaluated once and replaced by a single number. An if() with a constant
+ *  condition is replaced by the branch it selects, and unary plus is dropped. The stack depth is recomputed afterwards.
+ */
+
+bool Math::eqOptimiser() {
+
+    vector<token>  vtOutput;
+    vector<size_t> viStart;
+    vector<bool>   vbConst;
+    double_t       aArgs[3];
+    double_t       dResult;
+
+    vtOutput.reserve(m_ParseTree.size());
+
+    for(const auto& tItem : m_ParseTree) {
+
+        if(tItem.eval == EVAL_END) {
+            vtOutput.push_back(tItem);
+            break;
+        }
+
+        if(tItem.size == 0) {
+            viStart.push_back(vtOutput.size());
+            vbConst.push_back(tItem.eval == EVAL_NUMBER);
+            vtOutput.push_back(tItem);
+            continue;
+        }
+
+        if(tItem.eval == EVAL_UNARY_PLUS) continue;
+
+        // Each operand is the range from its start up to the start of the next one
+        size_t nArgs   = tItem.size;
+        size_t iFirst  = viStart.size() - nArgs;
+        bool   isConst = true;
+        for(size_t i=0; i<nArgs; i++) {
+            isConst = isConst && vbConst[iFirst+i];
+        }
+
+        if(tItem.eval == EVAL_SPECIAL_IF && vbConst[iFirst]) {
+            size_t iCond = viStart[iFirst];
+            size_t iTrue = viStart[iFirst+1];
+            size_t iElse = viStart[iFirst+2];
+            bool   bCond = vtOutput[iCond].value != EVAL_FALSE;
+            bool   bTake = bCond ? vbConst[iFirst+1] : vbConst[iFirst+2];
+            if(bCond) {
+                vtOutput.erase(vtOutput.begin()+iElse, vtOutput.end());
+            } else {
+                vtOutput.erase(vtOutput.begin()+iTrue, vtOutput.begin()+iElse);
+            }
+            vtOutput.erase(vtOutput.begin()+iCond);
+            viStart.resize(iFirst+1);
+            vbConst.resize(iFirst+1);
+            vbConst[iFirst] = bTake;
+            continue;
+        }
+
+        if(isConst) {
+            for(size_t i=0; i<nArgs; i++) {
+                aArgs[i] = vtOutput[viStart[iFirst+i]].value;
+            }
+            if(evalConstant(tItem.eval, aArgs, &dResult)) {
+                vtOutput.resize(viStart[iFirst]);
+                vtOutput.push_back(token({MP_NUMBER, dResult, EVAL_NUMBER, 0, -1}));
+                viStart.resize(iFirst+1);
+                vbConst.resize(iFirst+1);
+                continue;
+            }
+        }
+
+        viStart.resize(iFirst+1);
+        vbConst.resize(iFirst+1);
+        vbConst[iFirst] = false;
+        vtOutput.push_back(tItem);
+    }
+
+#ifdef DEBUG
+    printf("DEBUG> This is eqOptimiser\n");
+    printf("DEBUG>  * Before : ");
+    for(auto& tTemp : m_ParseTree) {
+        printf("%s  ",tokenText(tTemp).c_str());
+    }
+    printf("\n");
+    printf("DEBUG>  * After  : ");
+    for(auto& tTemp : vtOutput) {
+        printf("%s  ",tokenText(tTemp).c_str());
+    }
+    printf("\n");
+#endif
+
+    m_ParseTree.swap(vtOutput);
+
+    return eqStackSize();
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: eqBranches
+ * ========================
+ *  Marks the branches of if(), && and || that are worth skipping
+ *  A jump token is placed after the condition of an if() and after its first branch, and after the left operand of && and ||,
+ *  when the code that can be skipped costs at least EVAL_BRANCH_COST. The operator itself stays where it is and joins the
+ *  branches again. Every jump token consumes and produces one stack entry, so the stack depth is unchanged, and eqCompiler
+ *  resolves the jump targets. Cheap branches are left to the branch free instructions, which batch evaluation handles better.
+ *  Code that calls mod() is never skipped. mod() fails on values that are not integers, and batch evaluation runs both
+ *  branches when the rows of a tile disagree, so a skip would make Eval accept inputs that EvalBatch rejects.
+ */
+
+static inline uint32_t evalCost(value_t idEval) {
+
+    switch(idEval) {
+    case EVAL_NUMBER:
+    case EVAL_VARIABLE:
+    case EVAL_LOAD:
+    case EVAL_STORE:
+    case EVAL_OUTPUT:
+    case EVAL_UNARY_PLUS:
+        return 0;
+    case EVAL_MATH_DIV:
+        return 4;
+    case EVAL_MATH_POW:
+    case EVAL_FUNC_SIN:
+    case EVAL_FUNC_COS:
+    case EVAL_FUNC_TAN:
+    case EVAL_FUNC_ASIN:
+    case EVAL_FUNC_ACOS:
+    case EVAL_FUNC_ATAN:
+    case EVAL_FUNC_ATAN2:
+    case EVAL_FUNC_EXP:
+    case EVAL_FUNC_LOG:
+    case EVAL_FUNC_MOD:
+        return 16;
+    }
+
+    return 1;
+}
+
+bool Math::eqBranches() {
+
+    vector<size_t>   viStart;
+    vector<uint32_t> vnCost;
+    vector<bool>     vbMod;                                    // Whether each operand calls mod()
+    vector<value_t>  viJump(m_ParseTree.size(), EVAL_NONE);  // Jump token to insert before each token
+    size_t           nJumps = 0;
+
+    for(size_t iTok=0; iTok<m_ParseTree.size(); iTok++) {
+
+        const token& tItem = m_ParseTree[iTok];
+        if(tItem.eval == EVAL_END) break;
+
+        if(tItem.eval == EVAL_OUTPUT) {
+            viStart.pop_back();
+            vnCost.pop_back();
+            vbMod.pop_back();
+            continue;
+        }
+
+        size_t   iFirst = viStart.size() - tItem.size;
+        size_t   iStart = tItem.size > 0 ? viStart[iFirst] : iTok;
+        uint32_t nCost  = evalCost(tItem.eval);
+        bool     hasMod = tItem.eval == EVAL_FUNC_MOD;
+        for(size_t i=iFirst; i<vnCost.size(); i++) {
+            nCost  = min(nCost + vnCost[i], (uint32_t)0x7fffffff);
+            hasMod = hasMod || vbMod[i];
+        }
+
+        if(tItem.eval == EVAL_SPECIAL_IF && max(vnCost[iFirst+1], vnCost[iFirst+2]) >= EVAL_BRANCH_COST &&
+           !vbMod[iFirst+1] && !vbMod[iFirst+2]) {
+            viJump[viStart[iFirst+1]] = EVAL_JUMP_IF;
+            viJump[viStart[iFirst+2]] = EVAL_JUMP;
+            nJumps += 2;
+        } else
+        if((tItem.eval == EVAL_LOGICAL_AND || tItem.eval == EVAL_LOGICAL_OR) && vnCost[iFirst+1] >= EVAL_BRANCH_COST &&
+           !vbMod[iFirst+1]) {
+            viJump[viStart[iFirst+1]] = tItem.eval == EVAL_LOGICAL_AND ? EVAL_JUMP_AND : EVAL_JUMP_OR;
+            nJumps++;
+        }
+
+        viStart.resize(iFirst);
+        vnCost.resize(iFirst);
+        vbMod.resize(iFirst);
+        viStart.push_back(iStart);
+        vnCost.push_back(nCost);
+        vbMod.push_back(hasMod);
+    }
+
+    if(nJumps == 0) return true;
+
+    vector<token> vtOutput;
+    vtOutput.reserve(m_ParseTree.size() + nJumps);
+    for(size_t iTok=0; iTok<m_ParseTree.size(); iTok++) {
+        if(viJump[iTok] != EVAL_NONE) {
+            vtOutput.push_back(token({MP_NONE, 0.0, viJump[iTok], 1, -1}));
+        }
+        vtOutput.push_back(m_ParseTree[iTok]);
+    }
+
+#ifdef DEBUG
+    printf("DEBUG> This is eqBranches\n");
+    printf("DEBUG>  * After  : ");
+    for(auto& tTemp : vtOutput) {
+        printf("%s  ",tokenText(tTemp).c_str());
+    }
+    printf("\n");
+#endif
+
+    m_ParseTree.swap(vtOutput);
+
+    return eqStackSize();
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: eqSubexpressions
+ * ==============================
+ *  Eliminates common subexpressions of the parse tree
+ *  Each subtree is numbered so that structurally equal subtrees get the same number, with the operands of commutative
+ *  operators sorted. The first evaluation of a subtree that occurs more than once is kept in a temporary slot by EVAL_STORE,
+ *  and every later occurrence is replaced by an EVAL_LOAD of that slot. Stores that end up never being loaded, because all
+ *  their later uses were inside a larger replaced subtree, are removed again.
+ *  Subtrees are looked up by their operator, leaf value and operand numbers in a hash table, so numbering is linear.
+ *  Code after a jump token from eqBranches may be skipped, so a store there is only loaded again further along the same
+ *  branch. An occurrence elsewhere is evaluated again and stored to the same slot.
+ */
+
+struct nodeKey {
+    int64_t  leaf;     // Bits of a number, or the slot of a variable
+    uint32_t args[3];  // Numbers of the operands
+    value_t  eval;
+};
+
+static inline uint64_t nodeHash(const nodeKey& nkKey) {
+    uint64_t nHash = (uint64_t)nkKey.leaf*0x9e3779b97f4a7c15ULL;
+    nHash = (nHash ^ ((uint64_t)nkKey.eval << 32 | nkKey.args[0]))*0xbf58476d1ce4e5b9ULL;
+    nHash = (nHash ^ ((uint64_t)nkKey.args[1] << 32 | nkKey.args[2]))*0x94d049bb133111ebULL;
+    return nHash ^ (nHash >> 31);
+}
+
+static inline bool sameNode(const nodeKey& nkA, const nodeKey& nkB) {
+    return nkA.leaf == nkB.leaf && nkA.eval == nkB.eval && nkA.args[0] == nkB.args[0] &&
+           nkA.args[1] == nkB.args[1] && nkA.args[2] == nkB.args[2];
+}
+
+// Returns the number of nkKey in vnKeys, adding it if it is new. viTable is an open addressing table of numbers+1 that is
+// doubled whenever it gets half full.
+static uint32_t internNode(vector<nodeKey>& vnKeys, vector<uint32_t>& viTable, const nodeKey& nkKey) {
+
+    size_t nMask = viTable.size() - 1;
+    size_t iPos  = nodeHash(nkKey) & nMask;
+    while(viTable[iPos] != 0 && !sameNode(vnKeys[viTable[iPos]-1], nkKey)) iPos = (iPos+1) & nMask;
+    if(viTable[iPos] != 0) return viTable[iPos]-1;
+
+    uint32_t iNode = (uint32_t)vnKeys.size();
+    vnKeys.push_back(nkKey);
+    viTable[iPos] = iNode+1;
+
+    if(2*vnKeys.size() > viTable.size()) {
+        viTable.assign(2*viTable.size(), 0);
+        nMask = viTable.size() - 1;
+        for(uint32_t i=0; i<vnKeys.size(); i++) {
+            size_t iNew = nodeHash(vnKeys[i]) & nMask;
+            while(viTable[iNew] != 0) iNew = (iNew+1) & nMask;
+            viTable[iNew] = i+1;
+        }
+    }
+
+    return iNode;
+}
+
+static inline bool isCommutative(value_t idEval) {
+    return idEval == EVAL_MATH_PLUS   || idEval == EVAL_MATH_MULT   ||
+           idEval == EVAL_LOGICAL_AND || idEval == EVAL_LOGICAL_OR  ||
+           idEval == EVAL_LOGICAL_EQ  || idEval == EVAL_LOGICAL_NE;
+}
+
+bool Math::eqSubexpressions() {
+
+    vector<nodeKey>  vnKeys;               // Key of each subtree number
+    vector<uint32_t> viTable(1024, 0);     // Open addressing table of subtree number+1, at most half full
+    vector<uint32_t> viNode(m_ParseTree.size());
+    vector<uint32_t> vnCount;
+    vector<uint32_t> viStack;
+
+    // Number every subtree
+    for(size_t iTok=0; iTok<m_ParseTree.size(); iTok++) {
+
+        const token& tItem = m_ParseTree[iTok];
+        if(tItem.eval == EVAL_END) break;
+
+        if(tItem.eval == EVAL_OUTPUT) {
+            viStack.pop_back();
+            continue;
+        }
+        if(tItem.eval >= EVAL_JUMP_IF && tItem.eval <= EVAL_JUMP_OR) continue;
+
+        nodeKey nkKey = {0, {0, 0, 0}, tItem.eval};
+        if(tItem.eval == EVAL_NUMBER) {
+            memcpy(&nkKey.leaf, &tItem.value, sizeof(nkKey.leaf));
+        } else
+        if(tItem.eval == EVAL_VARIABLE) {
+            nkKey.leaf = tItem.index;
+        }
+
+        size_t iFirst = viStack.size() - tItem.size;
+        for(size_t i=iFirst; i<viStack.size(); i++) {
+            nkKey.args[i-iFirst] = viStack[i];
+        }
+        if(isCommutative(tItem.eval) && nkKey.args[0] > nkKey.args[1]) swap(nkKey.args[0], nkKey.args[1]);
+        viStack.resize(iFirst);
+
+        uint32_t iNode = internNode(vnKeys, viTable, nkKey);
+        if(iNode == vnCount.size()) vnCount.push_back(0);
+        viNode[iTok] = iNode;
+        if(tItem.size > 0) vnCount[iNode]++;
+        viStack.push_back(iNode);
+    }
+    vector<uint32_t>().swap(viTable);
+    vector<nodeKey>().swap(vnKeys);
+
+    // Emit the program, storing the first occurrence of repeated subtrees and loading the rest. Branches are numbered as
+    // they open, and a branch closes when the operand on the stack below its jump token is consumed.
+    vector<token>  vtOutput;
+    vector<size_t> viStart;
+    vector<int>    viSlot(vnCount.size(), -1);
+    vector<size_t> vnLoads;
+    vector<size_t> viStored;         // Branch of the last store to each slot
+    vector<size_t> viBranch{0};      // Open branches, innermost last
+    vector<size_t> viLevel{0};       // Stack depth below which each open branch closes
+    vector<bool>   vbOpen{true};
+
+    vtOutput.reserve(m_ParseTree.size());
+
+    for(size_t iTok=0; iTok<m_ParseTree.size(); iTok++) {
+
+        const token& tItem = m_ParseTree[iTok];
+        if(tItem.eval == EVAL_END) {
+            vtOutput.push_back(tItem);
+            break;
+        }
+
+        if(tItem.eval == EVAL_OUTPUT) {
+            viStart.pop_back();
+            vtOutput.push_back(tItem);
+            continue;
+        }
+
+        if(tItem.eval >= EVAL_JUMP_IF && tItem.eval <= EVAL_JUMP_OR) {
+            if(tItem.eval == EVAL_JUMP) {
+                vbOpen[viBranch.back()] = false;
+                viBranch.pop_back();
+                viLevel.pop_back();
+            }
+            viBranch.push_back(vbOpen.size());
+            viLevel.push_back(tItem.eval == EVAL_JUMP ? viStart.size()-1 : viStart.size());
+            vbOpen.push_back(true);
+            vtOutput.push_back(tItem);
+            continue;
+        }
+
+        size_t iFirst = viStart.size() - tItem.size;
+        size_t iStart = tItem.size > 0 ? viStart[iFirst] : vtOutput.size();
+        size_t iNode  = viNode[iTok];
+        viStart.resize(iFirst);
+        viStart.push_back(iStart);
+
+        while(viLevel.back() > iFirst) {
+            vbOpen[viBranch.back()] = false;
+            viBranch.pop_back();
+            viLevel.pop_back();
+        }
+
+        if(viSlot[iNode] >= 0 && vbOpen[viStored[viSlot[iNode]]]) {
+            vtOutput.resize(iStart);
+            vtOutput.push_back(token({MP_NONE, 0.0, EVAL_LOAD, 0, viSlot[iNode]}));
+            vnLoads[viSlot[iNode]]++;
+            continue;
+        }
+
+        vtOutput.push_back(tItem);
+        if(vnCount[iNode] > 1) {
+            if(viSlot[iNode] < 0) {
+                viSlot[iNode] = (int)vnLoads.size();
+                vnLoads.push_back(0);
+                viStored.push_back(0);
+            }
+            viStored[viSlot[iNode]] = viBranch.back();
+            vtOutput.push_back(token({MP_NONE, 0.0, EVAL_STORE, 1, viSlot[iNode]}));
+        }
+    }
+
+    // Drop unused stores and renumber the slots in use
+    vector<int> viRemap(vnLoads.size(), -1);
+    m_TempSize = 0;
+    for(size_t i=0; i<vnLoads.size(); i++) {
+        if(vnLoads[i] > 0) viRemap[i] = (int)m_TempSize++;
+    }
+
+    size_t nKeep = 0;
+    for(auto& tItem : vtOutput) {
+        if(tItem.eval == EVAL_STORE || tItem.eval == EVAL_LOAD) {
+            if(viRemap[tItem.index] < 0) continue;
+            tItem.index = viRemap[tItem.index];
+        }
+        vtOutput[nKeep++] = tItem;
+    }
+    vtOutput.resize(nKeep);
+
+#ifdef DEBUG
+    printf("DEBUG> This is eqSubexpressions\n");
+    printf("DEBUG>  * Before : ");
+    for(auto& tTemp : m_ParseTree) {
+        printf("%s  ",tokenText(tTemp).c_str());
+    }
+    printf("\n");
+    printf("DEBUG>  * After  : ");
+    for(auto& tTemp : vtOutput) {
+        printf("%s  ",tokenText(tTemp).c_str());
+    }
+    printf("\n");
+    printf("DEBUG>  * Temporaries: %d\n", (int)m_TempSize);
+#endif
+
+    m_ParseTree.swap(vtOutput);
+
+    return eqStackSize();
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: eqGradient
+ * ========================
+ *  Replaces the parse tree by a program that outputs its value followed by the derivative by each variable
+ *  The tree is turned into a graph of numbered nodes, where equal subtrees share a node as in eqSubexpressions, and the
+ *  derivatives are built as new nodes of the same graph. AD_FORWARD pushes the derivative by one variable at a time up from
+ *  the leaves, AD_REVERSE pulls the derivative of the result down to every node in a single sweep, and AD_AUTO builds both
+ *  and keeps the shorter program. Nodes with a number for every operand are folded, and products and sums with 0, 1 or -1
+ *  are simplified, so operands that do not depend on a variable cost nothing. The derivative of an if() selects between the
+ *  derivatives of its branches, and comparisons and logical operators have none.
+ *  The program is emitted from the graph with every node that is used more than once kept in a temporary slot, and slots
+ *  are reused once their last load is done.
+ */
+
+bool Math::eqGradient(value_t idMode) {
+
+    const uint32_t NO_NODE = UINT32_MAX;
+
+    vector<nodeKey>  vnKeys;
+    vector<uint32_t> viTable(1024, 0);
+    vector<value_t>  vnSize;         // Number of operands of each node
+    vector<bool>     vbActive;       // Whether each node depends on a variable through a differentiable path
+    vector<uint32_t> viStack;
+
+    auto addNode = [&](const nodeKey& nkKey, value_t nSize) {
+        uint32_t iNode = internNode(vnKeys, viTable, nkKey);
+        if(iNode < vnSize.size()) return iNode;
+        bool isActive = nkKey.eval == EVAL_VARIABLE;
+        if(nkKey.eval == EVAL_SPECIAL_IF) {
+            isActive = vbActive[nkKey.args[1]] || vbActive[nkKey.args[2]];
+        } else
+        if(nkKey.eval < EVAL_LOGICAL_AND || nkKey.eval > EVAL_LOGICAL_GE) {
+            for(value_t i=0; i<nSize; i++) isActive = isActive || vbActive[nkKey.args[i]];
+        }
+        vnSize.push_back(nSize);
+        vbActive.push_back(isActive);
+        return iNode;
+    };
+    auto makeNode = [&](value_t idEval, value_t nSize, uint32_t iA, uint32_t iB, uint32_t iC) {
+        nodeKey nkKey = {0, {iA, iB, iC}, idEval};
+        if(isCommutative(idEval) && iA > iB) swap(nkKey.args[0], nkKey.args[1]);
+        return addNode(nkKey, nSize);
+    };
+    auto makeNumber = [&](double_t dValue) {
+        nodeKey nkKey = {0, {0, 0, 0}, EVAL_NUMBER};
+        memcpy(&nkKey.leaf, &dValue, sizeof(nkKey.leaf));
+        return addNode(nkKey, 0);
+    };
+    auto isNumber = [&](uint32_t iNode) {
+        return vnKeys[iNode].eval == EVAL_NUMBER;
+    };
+    auto numValue = [&](uint32_t iNode) {
+        double_t dValue;
+        memcpy(&dValue, &vnKeys[iNode].leaf, sizeof(dValue));
+        return dValue;
+    };
+    auto isValue = [&](uint32_t iNode, double_t dValue) {
+        return isNumber(iNode) && numValue(iNode) == dValue;
+    };
+
+    uint32_t iZero  = makeNumber(0.0);
+    uint32_t iOne   = makeNumber(1.0);
+    uint32_t iMinus = makeNumber(-1.0);
+
+    // Builders for the derivative nodes, which fold and simplify
+    auto unary = [&](value_t idEval, uint32_t iA) {
+        double_t aArgs[3] = {0.0, 0.0, 0.0};
+        double_t dResult;
+        if(isNumber(iA)) {
+            aArgs[0] = numValue(iA);
+            if(evalConstant(idEval, aArgs, &dResult)) return makeNumber(dResult);
+        }
+        if(idEval == EVAL_UNARY_MINUS && vnKeys[iA].eval == EVAL_UNARY_MINUS) return vnKeys[iA].args[0];
+        return makeNode(idEval, 1, iA, 0, 0);
+    };
+    auto binary = [&](value_t idEval, uint32_t iA, uint32_t iB) {
+        double_t aArgs[3] = {0.0, 0.0, 0.0};
+        double_t dResult;
+        if(isNumber(iA) && isNumber(iB)) {
+            aArgs[0] = numValue(iA);
+            aArgs[1] = numValue(iB);
+            if(evalConstant(idEval, aArgs, &dResult)) return makeNumber(dResult);
+        }
+        switch(idEval) {
+        case EVAL_MATH_PLUS:
+            if(isValue(iA, 0.0)) return iB;
+            if(isValue(iB, 0.0)) return iA;
+            if(vnKeys[iB].eval == EVAL_UNARY_MINUS) return makeNode(EVAL_MATH_MINUS, 2, iA, vnKeys[iB].args[0], 0);
+            if(vnKeys[iA].eval == EVAL_UNARY_MINUS) return makeNode(EVAL_MATH_MINUS, 2, iB, vnKeys[iA].args[0], 0);
+            break;
+        case EVAL_MATH_MINUS:
+            if(isValue(iB, 0.0)) return iA;
+            if(isValue(iA, 0.0)) return unary(EVAL_UNARY_MINUS, iB);
+            if(vnKeys[iB].eval == EVAL_UNARY_MINUS) return makeNode(EVAL_MATH_PLUS, 2, iA, vnKeys[iB].args[0], 0);
+            break;
+        case EVAL_MATH_MULT:
+            if(isNumber(iA)) swap(iA, iB);
+            if(isValue(iB, 0.0))  return iZero;
+            if(isValue(iB, 1.0))  return iA;
+            if(isValue(iB, -1.0)) return unary(EVAL_UNARY_MINUS, iA);
+            if(vnKeys[iA].eval == EVAL_UNARY_MINUS) {
+                return unary(EVAL_UNARY_MINUS, makeNode(EVAL_MATH_MULT, 2, vnKeys[iA].args[0], iB, 0));
+            }
+            if(vnKeys[iB].eval == EVAL_UNARY_MINUS) {
+                return unary(EVAL_UNARY_MINUS, makeNode(EVAL_MATH_MULT, 2, iA, vnKeys[iB].args[0], 0));
+            }
+            if(vnKeys[iB].eval == EVAL_MATH_DIV && isValue(vnKeys[iB].args[0], 1.0)) {
+                return makeNode(EVAL_MATH_DIV, 2, iA, vnKeys[iB].args[1], 0);
+            }
+            if(vnKeys[iA].eval == EVAL_MATH_DIV && isValue(vnKeys[iA].args[0], 1.0)) {
+                return makeNode(EVAL_MATH_DIV, 2, iB, vnKeys[iA].args[1], 0);
+            }
+            break;
+        case EVAL_MATH_DIV:
+            if(isValue(iA, 0.0)) return iZero;
+            if(isValue(iB, 1.0)) return iA;
+            if(vnKeys[iA].eval == EVAL_UNARY_MINUS) {
+                return unary(EVAL_UNARY_MINUS, makeNode(EVAL_MATH_DIV, 2, vnKeys[iA].args[0], iB, 0));
+            }
+            break;
+        case EVAL_MATH_POW:
+            if(isValue(iB, 0.0)) return iOne;
+            if(isValue(iB, 1.0)) return iA;
+            break;
+        }
+        return makeNode(idEval, 2, iA, iB, 0);
+    };
+    auto select = [&](uint32_t iC, uint32_t iA, uint32_t iB) {
+        if(iA == iB) return iA;
+        if(isNumber(iC)) return numValue(iC) != EVAL_FALSE ? iA : iB;
+        return makeNode(EVAL_SPECIAL_IF, 3, iC, iA, iB);
+    };
+
+    // Derivative of node iNode by its operand k
+    auto partial = [&](uint32_t iNode, value_t k) {
+        nodeKey  nkKey = vnKeys[iNode];
+        uint32_t iA    = nkKey.args[0];
+        uint32_t iB    = nkKey.args[1];
+        uint32_t iDen;
+        switch(nkKey.eval) {
+        case EVAL_UNARY_PLUS:  return iOne;
+        case EVAL_UNARY_MINUS: return iMinus;
+        case EVAL_MATH_PLUS:   return iOne;
+        case EVAL_MATH_MINUS:  return k == 0 ? iOne : iMinus;
+        case EVAL_MATH_MULT:   return k == 0 ? iB : iA;
+        case EVAL_MATH_DIV:
+            if(k == 0) return binary(EVAL_MATH_DIV, iOne, iB);
+            return unary(EVAL_UNARY_MINUS, binary(EVAL_MATH_DIV, iNode, iB));
+        case EVAL_MATH_POW:
+            if(k == 0) return binary(EVAL_MATH_MULT, iB, binary(EVAL_MATH_POW, iA, binary(EVAL_MATH_MINUS, iB, iOne)));
+            // At a == 0 and b > 0 the power is 0 and the log is -inf, but the derivative is 0
+            return select(binary(EVAL_LOGICAL_AND, binary(EVAL_LOGICAL_EQ, iA, iZero), binary(EVAL_LOGICAL_GT, iB, iZero)),
+                iZero, binary(EVAL_MATH_MULT, iNode, unary(EVAL_FUNC_LOG, iA)));
+        case EVAL_FUNC_SIN:    return unary(EVAL_FUNC_COS, iA);
+        case EVAL_FUNC_COS:    return unary(EVAL_UNARY_MINUS, unary(EVAL_FUNC_SIN, iA));
+        case EVAL_FUNC_TAN:    return binary(EVAL_MATH_PLUS, iOne, binary(EVAL_MATH_MULT, iNode, iNode));
+        case EVAL_FUNC_ASIN:
+            return binary(EVAL_MATH_POW, binary(EVAL_MATH_MINUS, iOne, binary(EVAL_MATH_MULT, iA, iA)), makeNumber(-0.5));
+        case EVAL_FUNC_ACOS:
+            return unary(EVAL_UNARY_MINUS,
+                binary(EVAL_MATH_POW, binary(EVAL_MATH_MINUS, iOne, binary(EVAL_MATH_MULT, iA, iA)), makeNumber(-0.5)));
+        case EVAL_FUNC_ATAN:
+            return binary(EVAL_MATH_DIV, iOne, binary(EVAL_MATH_PLUS, iOne, binary(EVAL_MATH_MULT, iA, iA)));
+        case EVAL_FUNC_ATAN2:
+            iDen = binary(EVAL_MATH_PLUS, binary(EVAL_MATH_MULT, iA, iA), binary(EVAL_MATH_MULT, iB, iB));
+            if(k == 0) return binary(EVAL_MATH_DIV, iB, iDen);
+            return unary(EVAL_UNARY_MINUS, binary(EVAL_MATH_DIV, iA, iDen));
+        case EVAL_FUNC_EXP:    return iNode;
+        case EVAL_FUNC_LOG:    return binary(EVAL_MATH_DIV, iOne, iA);
+        case EVAL_FUNC_ABS:    return select(binary(EVAL_LOGICAL_LT, iA, iZero), iMinus, iOne);
+        case EVAL_FUNC_MOD:
+            // The remainder is a - b*trunc(a/b), and trunc(a/b) is (a - remainder)/b
+            if(k == 0) return iOne;
+            return unary(EVAL_UNARY_MINUS, binary(EVAL_MATH_DIV, binary(EVAL_MATH_MINUS, iA, iNode), iB));
+        }
+        return iZero;
+    };
+
+    // Graph of the equation itself
+    for(const auto& tItem : m_ParseTree) {
+
+        if(tItem.eval == EVAL_END) break;
+
+        nodeKey nkKey = {0, {0, 0, 0}, tItem.eval};
+        if(tItem.eval == EVAL_NUMBER) {
+            memcpy(&nkKey.leaf, &tItem.value, sizeof(nkKey.leaf));
+        } else
+        if(tItem.eval == EVAL_VARIABLE) {
+            nkKey.leaf = tItem.index;
+        }
+
+        size_t iFirst = viStack.size() - tItem.size;
+        for(size_t i=iFirst; i<viStack.size(); i++) {
+            nkKey.args[i-iFirst] = viStack[i];
+        }
+        if(isCommutative(tItem.eval) && nkKey.args[0] > nkKey.args[1]) swap(nkKey.args[0], nkKey.args[1]);
+        viStack.resize(iFirst);
+        viStack.push_back(addNode(nkKey, tItem.size));
+    }
+
+    if(viStack.size() != 1) {
+        printf("Math Error: Cannot differentiate an equation that does not reduce to a single value\n");
+        return false;
+    }
+
+    uint32_t iRoot  = viStack.back();
+    size_t   nNodes = vnKeys.size();
+    size_t   nVars  = m_WVariable.size();
+
+    vector<uint32_t> viForward{iRoot};
+    vector<uint32_t> viReverse{iRoot};
+
+    if(idMode != AD_REVERSE) {
+        vector<uint32_t> viTangent(nNodes, iZero);
+        for(size_t v=0; v<nVars; v++) {
+            for(uint32_t n=0; n<nNodes; n++) {
+                if(!vbActive[n]) {
+                    viTangent[n] = iZero;
+                    continue;
+                }
+                nodeKey nkKey = vnKeys[n];
+                if(nkKey.eval == EVAL_VARIABLE) {
+                    viTangent[n] = (size_t)nkKey.leaf == v ? iOne : iZero;
+                } else
+                if(nkKey.eval == EVAL_SPECIAL_IF) {
+                    viTangent[n] = select(nkKey.args[0], viTangent[nkKey.args[1]], viTangent[nkKey.args[2]]);
+                } else {
+                    uint32_t iSum = iZero;
+                    for(value_t k=0; k<vnSize[n]; k++) {
+                        if(viTangent[nkKey.args[k]] == iZero) continue;
+                        iSum = binary(EVAL_MATH_PLUS, iSum, binary(EVAL_MATH_MULT, partial(n, k), viTangent[nkKey.args[k]]));
+                    }
+                    viTangent[n] = iSum;
+                }
+            }
+            viForward.push_back(viTangent[iRoot]);
+        }
+    }
+
+    if(idMode != AD_FORWARD) {
+        vector<uint32_t> viAdjoint(nNodes, NO_NODE);
+        vector<uint32_t> viVarNode(nVars, NO_NODE);
+        auto addAdjoint = [&](uint32_t iNode, uint32_t iTerm) {
+            viAdjoint[iNode] = viAdjoint[iNode] == NO_NODE ? iTerm : binary(EVAL_MATH_PLUS, viAdjoint[iNode], iTerm);
+        };
+        viAdjoint[iRoot] = iOne;
+        for(size_t n=nNodes; n-- > 0;) {
+            uint32_t iAdj  = viAdjoint[n];
+            nodeKey  nkKey = vnKeys[n];
+            if(nkKey.eval == EVAL_VARIABLE && (size_t)nkKey.leaf < nVars) viVarNode[nkKey.leaf] = (uint32_t)n;
+            if(iAdj == NO_NODE || !vbActive[n]) continue;
+            if(nkKey.eval == EVAL_SPECIAL_IF) {
+                if(vbActive[nkKey.args[1]]) addAdjoint(nkKey.args[1], select(nkKey.args[0], iAdj, iZero));
+                if(vbActive[nkKey.args[2]]) addAdjoint(nkKey.args[2], select(nkKey.args[0], iZero, iAdj));
+                continue;
+            }
+            for(value_t k=0; k<vnSize[n]; k++) {
+                if(vbActive[nkKey.args[k]]) addAdjoint(nkKey.args[k], binary(EVAL_MATH_MULT, iAdj, partial((uint32_t)n, k)));
+            }
+        }
+        for(size_t v=0; v<nVars; v++) {
+            uint32_t iAdj = viVarNode[v] == NO_NODE ? NO_NODE : viAdjoint[viVarNode[v]];
+            viReverse.push_back(iAdj == NO_NODE ? iZero : iAdj);
+        }
+    }
+
+    // Emits the nodes of viOutputs and everything they depend on, each output followed by EVAL_OUTPUT
+    auto emitProgram = [&](const vector<uint32_t>& viOutputs, vector<token>& vtOutput, size_t& nTemp) {
+
+        vector<uint32_t> vnUses(vnKeys.size(), 0);
+        vector<bool>     vbSeen(vnKeys.size(), false);
+        vector<uint32_t> viTodo;
+
+        for(uint32_t iOut : viOutputs) {
+            vnUses[iOut]++;
+            if(!vbSeen[iOut]) viTodo.push_back(iOut);
+            vbSeen[iOut] = true;
+        }
+        while(!viTodo.empty()) {
+            uint32_t iNode = viTodo.back();
+            viTodo.pop_back();
+            for(value_t k=0; k<vnSize[iNode]; k++) {
+                uint32_t iArg = vnKeys[iNode].args[k];
+                vnUses[iArg]++;
+                if(!vbSeen[iArg]) viTodo.push_back(iArg);
+                vbSeen[iArg] = true;
+            }
+        }
+
+        vector<int>      viSlot(vnKeys.size(), -1);
+        vector<int>      viFree;
+        vector<uint32_t> viNode;   // Nodes being emitted, with the next operand of each
+        vector<value_t>  viNext;
+
+        nTemp = 0;
+        vtOutput.clear();
+
+        for(size_t k=0; k<viOutputs.size(); k++) {
+            viNode.push_back(viOutputs[k]);
+            viNext.push_back(0);
+            while(!viNode.empty()) {
+                uint32_t       iNode = viNode.back();
+                value_t        iNext = viNext.back();
+                const nodeKey& nkKey = vnKeys[iNode];
+                if(iNext == 0 && viSlot[iNode] >= 0) {
+                    vtOutput.push_back(token({MP_NONE, 0.0, EVAL_LOAD, 0, viSlot[iNode]}));
+                    if(--vnUses[iNode] == 0) viFree.push_back(viSlot[iNode]);
+                } else
+                if(nkKey.eval == EVAL_NUMBER) {
+                    vtOutput.push_back(token({MP_NUMBER, numValue(iNode), EVAL_NUMBER, 0, -1}));
+                } else
+                if(nkKey.eval == EVAL_VARIABLE) {
+                    vtOutput.push_back(token({MP_VARIABLE, 0.0, EVAL_VARIABLE, 0, (value_t)nkKey.leaf}));
+                } else
+                if(iNext < vnSize[iNode]) {
+                    viNext.back()++;
+                    viNode.push_back(nkKey.args[iNext]);
+                    viNext.push_back(0);
+                    continue;
+                } else {
+                    vtOutput.push_back(token({MP_NONE, 0.0, nkKey.eval, vnSize[iNode], -1}));
+                    if(--vnUses[iNode] > 0) {
+                        if(viFree.empty()) {
+                            viSlot[iNode] = (int)nTemp++;
+                        } else {
+                            viSlot[iNode] = viFree.back();
+                            viFree.pop_back();
+                        }
+                        vtOutput.push_back(token({MP_NONE, 0.0, EVAL_STORE, 1, viSlot[iNode]}));
+                    }
+                }
+                viNode.pop_back();
+                viNext.pop_back();
+            }
+            vtOutput.push_back(token({MP_NONE, 0.0, EVAL_OUTPUT, 1, (value_t)k}));
+        }
+        vtOutput.push_back(token({MP_END, 0.0, EVAL_END, 0, -1}));
+    };
+
+    vector<token> vtOutput;
+    vector<token> vtOther;
+    size_t        nTemp  = 0;
+    size_t        nOther = 0;
+
+    emitProgram(idMode == AD_REVERSE ? viReverse : viForward, vtOutput, nTemp);
+    if(idMode == AD_AUTO) {
+        emitProgram(viReverse, vtOther, nOther);
+        if(vtOther.size() < vtOutput.size()) {
+            vtOutput.swap(vtOther);
+            nTemp = nOther;
+        }
+    }
+
+#ifdef DEBUG
+    printf("DEBUG> This is eqGradient\n");
+    printf("DEBUG>  * Before : ");
+    for(auto& tTemp : m_ParseTree) {
+        printf("%s  ",tokenText(tTemp).c_str());
+    }
+    printf("\n");
+    printf("DEBUG>  * After  : ");
+    for(auto& tTemp : vtOutput) {
+        printf("%s  ",tokenText(tTemp).c_str());
+    }
+    printf("\n");
+    printf("DEBUG>  * Temporaries: %d\n", (int)nTemp);
+#endif
+
+    m_ParseTree.swap(vtOutput);
+    m_TempSize = nTemp;
+
+    return eqStackSize();
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: evalConstant
+ * ==========================
+ *  Evaluates a single operator on constant operands for eqOptimiser
+ *  Returns false if the operator cannot be evaluated at compile time
+ */
+
+bool Math::evalConstant(value_t idEval, const double_t* pArgs, double_t* pResult) {
+
+    double_t dL = pArgs[0];
+    double_t dR = pArgs[1];
+
+    switch(idEval) {
+    case EVAL_UNARY_PLUS:  *pResult = dL;             break;
+    case EVAL_UNARY_MINUS: *pResult = -dL;            break;
+    case EVAL_MATH_PLUS:   *pResult = dL + dR;        break;
+    case EVAL_MATH_MINUS:  *pResult = dL - dR;        break;
+    case EVAL_MATH_MULT:   *pResult = dL * dR;        break;
+    case EVAL_MATH_DIV:    *pResult = dL / dR;        break;
+    case EVAL_MATH_POW:    *pResult = pow(dL, dR);    break;
+    case EVAL_LOGICAL_AND: *pResult = (dL && dR) ? EVAL_TRUE : EVAL_FALSE; break;
+    case EVAL_LOGICAL_OR:  *pResult = (dL || dR) ? EVAL_TRUE : EVAL_FALSE; break;
+    case EVAL_LOGICAL_EQ:  *pResult = (dL == dR) ? EVAL_TRUE : EVAL_FALSE; break;
+    case EVAL_LOGICAL_NE:  *pResult = (dL != dR) ? EVAL_TRUE : EVAL_FALSE; break;
+    case EVAL_LOGICAL_LT:  *pResult = (dL <  dR) ? EVAL_TRUE : EVAL_FALSE; break;
+    case EVAL_LOGICAL_GT:  *pResult = (dL >  dR) ? EVAL_TRUE : EVAL_FALSE; break;
+    case EVAL_LOGICAL_LE:  *pResult = (dL <= dR) ? EVAL_TRUE : EVAL_FALSE; break;
+    case EVAL_LOGICAL_GE:  *pResult = (dL >= dR) ? EVAL_TRUE : EVAL_FALSE; break;
+    case EVAL_FUNC_SIN:    *pResult = sin(dL);        break;
+    case EVAL_FUNC_COS:    *pResult = cos(dL);        break;
+    case EVAL_FUNC_TAN:    *pResult = tan(dL);        break;
+    case EVAL_FUNC_ASIN:   *pResult = asin(dL);       break;
+    case EVAL_FUNC_ACOS:   *pResult = acos(dL);       break;
+    case EVAL_FUNC_ATAN:   *pResult = atan(dL);       break;
+    case EVAL_FUNC_ATAN2:  *pResult = atan2(dL, dR);  break;
+    case EVAL_FUNC_EXP:    *pResult = exp(dL);        break;
+    case EVAL_FUNC_LOG:    *pResult = log(dL);        break;
+    case EVAL_FUNC_ABS:    *pResult = abs(dL);        break;
+    case EVAL_FUNC_MOD:
+        // Non-integer operands are left for Eval to report
+        if(dL != floor(dL) || dR != floor(dR)) return false;
+        *pResult = (int)floor(dL)%(int)floor(dR);
+        break;
+    case EVAL_SPECIAL_IF:
+        *pResult = (dL != EVAL_FALSE) ? dR : pArgs[2];
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: eqCompiler
+ * ========================
+ *  Compiles the parse tree into a dense array of fixed size instructions for the interpreter
+ *  Number values go to the constant table, and variables and temporaries keep their slot index. A jump gets the index of the
+ *  instruction it continues at: the second branch for the jump after the condition of an if(), and the instruction after
+ *  the joining operator for the others. Jumps nest like brackets, and an operator joins the innermost open jump when its
+ *  first operand is the stack entry the jump was placed after.
+ */
+
+bool Math::eqCompiler() {
+
+    vector<size_t> viJump;   // Open jumps
+    vector<size_t> viJoin;   // Stack entry of the first operand of the operator that joins each open jump
+    size_t         nDepth = 0;
+
+    m_Code.clear();
+    m_Consts.clear();
+    m_Code.reserve(m_ParseTree.size());
+
+    for(const auto& tItem : m_ParseTree) {
+
+        instr iOp;
+        iOp.op   = (uint16_t)tItem.eval;
+        iOp.size = (uint16_t)tItem.size;
+        iOp.arg  = 0;
+
+        if(tItem.eval != EVAL_END) {
+            size_t iFirst = nDepth - tItem.size;
+            if(tItem.eval == EVAL_JUMP) {
+                m_Code[viJump.back()].arg = (uint32_t)m_Code.size()+1;
+                viJump.pop_back();
+                viJoin.pop_back();
+                iFirst--;
+            }
+            if(tItem.eval >= EVAL_JUMP_IF && tItem.eval <= EVAL_JUMP_OR) {
+                viJump.push_back(m_Code.size());
+                viJoin.push_back(iFirst);
+            } else
+            if(tItem.size > 0 && !viJoin.empty() && viJoin.back() == iFirst) {
+                m_Code[viJump.back()].arg = (uint32_t)m_Code.size()+1;
+                viJump.pop_back();
+                viJoin.pop_back();
+            }
+            nDepth = tItem.size == 0 ? nDepth+1 : tItem.eval == EVAL_OUTPUT ? nDepth-1 : nDepth-tItem.size+1;
+        }
+
+        if(tItem.eval == EVAL_NUMBER) {
+            iOp.arg = (uint32_t)m_Consts.size();
+            m_Consts.push_back(tItem.value);
+        } else
+        if(tItem.eval == EVAL_VARIABLE || tItem.eval == EVAL_STORE || tItem.eval == EVAL_LOAD || tItem.eval == EVAL_OUTPUT) {
+            iOp.arg = (uint32_t)tItem.index;
+        } else
+        if(tItem.eval <= 0 || tItem.eval >= EVAL_MOVE) {
+            printf("Math Error: Cannot compile token '%s'\n", tokenText(tItem).c_str());
+            return false;
+        }
+
+        m_Code.push_back(iOp);
 
-        idPrev = idType;
+        if(tItem.eval == EVAL_END) break;
     }
 
-    // Check that we actually have something
-    if(m_Tokens.size() == 0) {
-        printf("Math Error: No equation\n");
+    if(!viJump.empty()) {
+        printf("Math Error: Jump without a joining operator\n");
         return false;
     }
 
-    // Add end token
-    m_Tokens.push_back(token({MP_END, "end", 0.0, EVAL_END, 0}));
-
 #ifdef DEBUG
-    // Echo lexer for debug
-    printf("DEBUG> Lexer result:\n");
-    size_t lIdx = 0;
-    for(auto tItem : m_Tokens) {
-        lIdx++;
-        printf("DEBUG>  * Item %2d : ", int(lIdx));
-        printf("Type = %2d, ",          tItem.eval);
-        printf("Size = %1d, ",          tItem.size);
-        printf("Value = %23.16e, ",     tItem.value);
-        printf("Content = '%s'\n",      tItem.content.c_str());
+    printf("DEBUG> Compiled program:\n");
+    for(size_t i=0; i<m_Code.size(); i++) {
+        printf("DEBUG>  * %4d : Op = %2d, Size = %1d, Arg = %4d, Content = '%s'\n",
+            (int)i, m_Code[i].op, m_Code[i].size, (int)m_Code[i].arg, evalName(m_Code[i].op));
     }
 #endif
 
@@ -606,236 +2062,480 @@ bool Math::eqLexer() {
 // ****************************************************************************************************************************** //
 
 /**
- *  Function :: eqParser
- * ======================
- *  Parses the equation using the Shunting-yard algorithm
- *  Based on https://en.wikipedia.org/wiki/Shunting-yard_algorithm
+ *  Function :: eqRegisterCompiler
+ * ================================
+ *  Translates the stack bytecode into three-address code for evalRegister
+ *  The register frame holds the variables, then the constants, then one register per stack level, then one register per
+ *  temporary slot. Leaves emit no instructions; their frame register is used directly as an operand. A multiplication that
+ *  feeds an addition or subtraction is fused into a multiply-add, and a comparison that feeds an if() is fused into a select,
+ *  as long as the operands of the fused instruction have not been overwritten in between.
+ *  The branches of an if() with jumps each move their result to the register of the condition's stack level, which holds the
+ *  result after the join. Jump targets are register instruction indices.
  */
 
-bool Math::eqParser() {
+bool Math::eqRegisterCompiler() {
+
+    uint32_t iConst  = (uint32_t)m_WVariable.size();
+    uint32_t iStack  = iConst + (uint32_t)m_Consts.size();
+    uint32_t iPinned = iStack + (uint32_t)m_StackSize;
+    uint32_t nFrame  = iPinned + (uint32_t)m_TempSize;
+
+    vector<rinstr>   vrCode;
+    vector<size_t>   viWrite(nFrame, 0);  // Sequence number (index+1) of the last instruction writing each register
+    vector<uint32_t> viRef;               // Register holding each stack entry
+    vector<int>      viProd;              // Instruction producing each stack entry, or -1
+    vector<bool>     vbDead;
+    vector<size_t>   viJump;              // Open jumps, as instruction indices
+    vector<size_t>   viJoin;              // Stack entry of the first operand of the operator that joins each open jump
+
+    // Checks that no source of instruction iProd has been written after it
+    auto isFusable = [&](int iProd, size_t nArgs) {
+        if(iProd < 0) return false;
+        for(size_t i=0; i<nArgs; i++) {
+            if(viWrite[vrCode[iProd].arg[i]] > (size_t)iProd+1) return false;
+        }
+        return true;
+    };
+    auto emitInstr = [&](const rinstr& rIns) {
+        vrCode.push_back(rIns);
+        vbDead.push_back(false);
+        if(rIns.op != EVAL_JUMP_IF && rIns.op != EVAL_JUMP) viWrite[rIns.dst] = vrCode.size();
+    };
+
+    for(const auto& iOp : m_Code) {
+
+        if(iOp.op == EVAL_END) break;
+
+        switch(iOp.op) {
+        case EVAL_NUMBER:
+            viRef.push_back(iConst + iOp.arg);
+            viProd.push_back(-1);
+            continue;
+        case EVAL_VARIABLE:
+            viRef.push_back(iOp.arg);
+            viProd.push_back(-1);
+            continue;
+        case EVAL_LOAD:
+            viRef.push_back(iPinned + iOp.arg);
+            viProd.push_back(-1);
+            continue;
+        case EVAL_STORE:
+            emitInstr(rinstr({EVAL_MOVE, iPinned + iOp.arg, {viRef.back(), 0, 0, 0}}));
+            viRef.back()  = iPinned + iOp.arg;
+            viProd.back() = -1;
+            continue;
+        case EVAL_UNARY_PLUS:
+            continue;
+        case EVAL_JUMP_IF:
+            viJump.push_back(vrCode.size());
+            viJoin.push_back(viRef.size()-1);
+            emitInstr(rinstr({EVAL_JUMP_IF, 0, {viRef.back(), 0, 0, 0}}));
+            viProd.back() = -1;
+            continue;
+        case EVAL_JUMP:
+            emitInstr(rinstr({EVAL_MOVE, iStack + (uint32_t)viJoin.back(), {viRef.back(), 0, 0, 0}}));
+            vrCode[viJump.back()].arg[1] = (uint32_t)vrCode.size()+1;
+            viJump.back() = vrCode.size();
+            emitInstr(rinstr({EVAL_JUMP, 0, {0, 0, 0, 0}}));
+            viProd.back() = -1;
+            continue;
+        case EVAL_JUMP_AND:
+        case EVAL_JUMP_OR:
+            viJump.push_back(vrCode.size());
+            viJoin.push_back(viRef.size()-1);
+            emitInstr(rinstr({iOp.op, iStack + (uint32_t)viRef.size()-1, {viRef.back(), 0, 0, 0}}));
+            viProd.back() = -1;
+            continue;
+        }
 
-    vector<token> vtOutput;
-    vector<token> vtStack;
+        size_t   iFirst = viRef.size() - iOp.size;
+        uint32_t iDst   = iStack + (uint32_t)iFirst;
+
+        // The second branch of an if() with jumps ends like the first, with a move to the result register
+        bool isJoin = !viJoin.empty() && viJoin.back() == iFirst && iOp.size > 1;
+        if(isJoin && iOp.op == EVAL_SPECIAL_IF) {
+            emitInstr(rinstr({EVAL_MOVE, iDst, {viRef.back(), 0, 0, 0}}));
+            vrCode[viJump.back()].arg[0] = (uint32_t)vrCode.size();
+            viJump.pop_back();
+            viJoin.pop_back();
+            viRef.resize(iFirst);
+            viProd.resize(iFirst);
+            viRef.push_back(iDst);
+            viProd.push_back(-1);
+            continue;
+        }
+        rinstr   rIns   = {iOp.op, iDst, {0, 0, 0, 0}};
+        for(size_t i=0; i<iOp.size; i++) {
+            rIns.arg[i] = viRef[iFirst+i];
+        }
 
-#ifdef DEBUG
-    printf("DEBUG> This is eqParser using Shunting-Yard algorithm\n");
-    uint32_t nStep = 0;
-#endif
+        int iProdL = viProd[iFirst];
+        int iProdR = iOp.size > 1 ? viProd[iFirst+1] : -1;
+        int iFused = -1;
 
-    for(auto tItem : m_Tokens) {
+        if(iOp.op == EVAL_MATH_PLUS || iOp.op == EVAL_MATH_MINUS) {
+            bool isMultR = iProdR >= 0 && vrCode[iProdR].op == EVAL_MATH_MULT && isFusable(iProdR, 2);
+            bool isMultL = iProdL >= 0 && vrCode[iProdL].op == EVAL_MATH_MULT && isFusable(iProdL, 2);
+            if(iOp.op == EVAL_MATH_PLUS && isMultR) {
+                rIns   = {EVAL_MULADD, iDst, {vrCode[iProdR].arg[0], vrCode[iProdR].arg[1], rIns.arg[0], 0}};
+                iFused = iProdR;
+            } else
+            if(isMultL) {
+                rIns   = {(uint32_t)(iOp.op == EVAL_MATH_PLUS ? EVAL_MULADD : EVAL_MULSUB), iDst,
+                          {vrCode[iProdL].arg[0], vrCode[iProdL].arg[1], rIns.arg[1], 0}};
+                iFused = iProdL;
+            } else
+            if(isMultR) {
+                rIns   = {EVAL_NMULADD, iDst, {vrCode[iProdR].arg[0], vrCode[iProdR].arg[1], rIns.arg[0], 0}};
+                iFused = iProdR;
+            }
+        } else
+        if(iOp.op == EVAL_SPECIAL_IF && iProdL >= 0 && isFusable(iProdL, 2)) {
+            uint32_t idSel = 0;
+            switch(vrCode[iProdL].op) {
+                case EVAL_LOGICAL_EQ: idSel = EVAL_SELECT_EQ; break;
+                case EVAL_LOGICAL_NE: idSel = EVAL_SELECT_NE; break;
+                case EVAL_LOGICAL_LT: idSel = EVAL_SELECT_LT; break;
+                case EVAL_LOGICAL_GT: idSel = EVAL_SELECT_GT; break;
+                case EVAL_LOGICAL_LE: idSel = EVAL_SELECT_LE; break;
+                case EVAL_LOGICAL_GE: idSel = EVAL_SELECT_GE; break;
+            }
+            if(idSel > 0) {
+                rIns   = {idSel, iDst, {vrCode[iProdL].arg[0], vrCode[iProdL].arg[1], rIns.arg[1], rIns.arg[2]}};
+                iFused = iProdL;
+            }
+        }
 
-        int  itemPrec   = 0;
-        int  itemAssoc  = 0;
-        int  stackPrec  = 0;
-        int  stackAssoc = 0;
-        int  iErase     = 0;
-        bool isClosed   = false;
+        // The fused instruction is the only reader of the producer's result, so the producer can be dropped
+        if(iFused >= 0) vbDead[iFused] = true;
 
-        switch(tItem.type) {
+        emitInstr(rIns);
+        if(isJoin) {
+            vrCode[viJump.back()].arg[1] = (uint32_t)vrCode.size();
+            viJump.pop_back();
+            viJoin.pop_back();
+        }
+        viRef.resize(iFirst);
+        viProd.resize(iFirst);
+        viRef.push_back(iDst);
+        viProd.push_back((int)vrCode.size()-1);
+    }
 
-        case MP_NUMBER:
-            vtOutput.push_back(tItem);
-            break;
+    if(viRef.size() != 1) {
+        printf("Math Error: Register compiler failed\n");
+        return false;
+    }
 
-        case MP_VARIABLE:
-            vtOutput.push_back(tItem);
-            break;
+    // Jump targets move down past the dropped instructions
+    vector<uint32_t> viIndex(vrCode.size()+1, 0);
+    for(size_t i=0; i<vrCode.size(); i++) {
+        viIndex[i+1] = viIndex[i] + (vbDead[i] ? 0 : 1);
+    }
 
-        case MP_CONST:
-            vtOutput.push_back(tItem);
-            break;
+    m_RegCode.clear();
+    for(size_t i=0; i<vrCode.size(); i++) {
+        if(vbDead[i]) continue;
+        rinstr rIns = vrCode[i];
+        if(rIns.op == EVAL_JUMP) rIns.arg[0] = viIndex[rIns.arg[0]];
+        if(rIns.op == EVAL_JUMP_IF || rIns.op == EVAL_JUMP_AND || rIns.op == EVAL_JUMP_OR) rIns.arg[1] = viIndex[rIns.arg[1]];
+        m_RegCode.push_back(rIns);
+    }
+    m_RegCode.push_back(rinstr({EVAL_END, 0, {0, 0, 0, 0}}));
+    m_RegResult = viRef.back();
 
-        case MP_FUNC:
-            vtStack.insert(vtStack.begin(), tItem);
-            break;
+    // Registers of the dropped instructions are only kept in the frame if they lie below one still in use
+    m_FrameSize = regFrameSize(m_RegCode, m_WVariable.size() + m_Consts.size(), m_RegResult);
 
-        case MP_LOGICAL:
-            iErase = 0;
+#ifdef DEBUG
+    printf("DEBUG> Register program, frame size %d:\n", (int)m_FrameSize);
+    for(size_t i=0; i<m_RegCode.size(); i++) {
+        printf("DEBUG>  * %4d : Op = %2d, Dst = %4d, Args = %4d %4d %4d %4d\n", (int)i, (int)m_RegCode[i].op,
+            (int)m_RegCode[i].dst, (int)m_RegCode[i].arg[0], (int)m_RegCode[i].arg[1], (int)m_RegCode[i].arg[2],
+            (int)m_RegCode[i].arg[3]);
+    }
+    printf("DEBUG>  * Result in register %d\n", (int)m_RegResult);
+#endif
 
-            precedenceLogical(tItem.content,&itemPrec,&itemAssoc);
-            for(auto tStack : vtStack) {
-                precedenceLogical(tStack.content,&stackPrec,&stackAssoc);
-                if( tStack.type == MP_MATH &&
-                    ( (itemAssoc == ASSOC_L && itemPrec <= stackPrec) ||
-                        (itemAssoc == ASSOC_R && itemPrec <  stackPrec) ) ) {
-                    vtOutput.push_back(tStack);
-                    iErase++;
-                } else {
-                    break;
-                }
-            }
+    return true;
+}
 
-            if(iErase > 0) {
-                vtStack.erase(vtStack.begin(),vtStack.begin()+iErase);
-            }
-            vtStack.insert(vtStack.begin(), tItem);
+// ****************************************************************************************************************************** //
 
-            break;
+/**
+ *  Function :: eqIncremental
+ * ===========================
+ *  Compiles the folded parse tree into the code of the incremental backend, see Program::evalIncremental
+ *  Equal subtrees share a node as in eqSubexpressions, and every node other than a leaf becomes one instruction with its own
+ *  frame register, so its value stays in the frame between evaluations. The frame holds the variables, then the constants,
+ *  then the instruction results in program order. Since an if() is evaluated as a select, both branches are kept up to date.
+ *  For each variable, the instructions that depend on it are listed in program order, which is the order they must be rerun
+ *  in when the variable changes.
+ */
 
-        case MP_MATH:
-            iErase = 0;
+bool Math::eqIncremental(inccode& icCode) {
 
-            precedenceMath(tItem.content,false,&itemPrec,&itemAssoc);
-            for(auto tStack : vtStack) {
-                precedenceMath(tStack.content,false,&stackPrec,&stackAssoc);
-                if( (tStack.type == MP_MATH || tStack.type == MP_UNARY) &&
-                    ( (itemAssoc == ASSOC_L && itemPrec <= stackPrec) ||
-                        (itemAssoc == ASSOC_R && itemPrec <  stackPrec) ) ) {
-                    vtOutput.push_back(tStack);
-                    iErase++;
-                } else {
-                    break;
-                }
-            }
+    vector<nodeKey>  vnKeys;
+    vector<uint32_t> viTable(1024, 0);
+    vector<value_t>  vnSize;
+    vector<uint32_t> viStack;
 
-            if(iErase > 0) {
-                vtStack.erase(vtStack.begin(),vtStack.begin()+iErase);
-            }
-            vtStack.insert(vtStack.begin(), tItem);
+    for(const auto& tItem : m_Folded) {
 
-            break;
+        if(tItem.eval == EVAL_END) break;
+        if(tItem.eval == EVAL_UNARY_PLUS) continue;
 
-        case MP_UNARY:
-            iErase = 0;
+        nodeKey nkKey = {0, {0, 0, 0}, tItem.eval};
+        if(tItem.eval == EVAL_NUMBER) {
+            memcpy(&nkKey.leaf, &tItem.value, sizeof(nkKey.leaf));
+        } else
+        if(tItem.eval == EVAL_VARIABLE) {
+            nkKey.leaf = tItem.index;
+        }
 
-            precedenceMath(tItem.content,true,&itemPrec,&itemAssoc);
-            for(auto tStack : vtStack) {
-                precedenceMath(tStack.content,true,&stackPrec,&stackAssoc);
-                if( (tStack.type == MP_MATH || tStack.type == MP_UNARY) &&
-                    ( (itemAssoc == ASSOC_L && itemPrec <= stackPrec) ||
-                        (itemAssoc == ASSOC_R && itemPrec <  stackPrec) ) ) {
-                    vtOutput.push_back(tStack);
-                    iErase++;
-                } else {
-                    break;
-                }
-            }
+        size_t iFirst = viStack.size() - tItem.size;
+        for(size_t i=iFirst; i<viStack.size(); i++) {
+            nkKey.args[i-iFirst] = viStack[i];
+        }
+        if(isCommutative(tItem.eval) && nkKey.args[0] > nkKey.args[1]) swap(nkKey.args[0], nkKey.args[1]);
+        viStack.resize(iFirst);
 
-            if(iErase > 0) {
-                vtStack.erase(vtStack.begin(),vtStack.begin()+iErase);
-            }
-            vtStack.insert(vtStack.begin(), tItem);
+        uint32_t iNode = internNode(vnKeys, viTable, nkKey);
+        if(iNode == vnSize.size()) vnSize.push_back(tItem.size);
+        viStack.push_back(iNode);
+    }
 
-            break;
+    if(viStack.size() != 1) return false;
 
-        case MP_LBRACK:
-            vtStack.insert(vtStack.begin(), tItem);
-            break;
+    uint32_t nVars  = (uint32_t)m_WVariable.size();
+    size_t   nNodes = vnKeys.size();
 
-        case MP_RBRACK:
-            iErase   = 0;
-            isClosed = false;
+    // Frame registers of the leaves first, as the registers of the instructions follow the constants
+    vector<uint32_t> viReg(nNodes);
+    icCode.consts.clear();
+    for(size_t n=0; n<nNodes; n++) {
+        if(vnKeys[n].eval == EVAL_VARIABLE) {
+            viReg[n] = (uint32_t)vnKeys[n].leaf;
+        } else
+        if(vnKeys[n].eval == EVAL_NUMBER) {
+            double_t dValue;
+            memcpy(&dValue, &vnKeys[n].leaf, sizeof(dValue));
+            viReg[n] = nVars + (uint32_t)icCode.consts.size();
+            icCode.consts.push_back(dValue);
+        }
+    }
 
-            for(auto tStack : vtStack) {
-                if(tStack.type != MP_LBRACK) {
-                    vtOutput.push_back(tStack);
-                    iErase++;
-                } else {
-                    isClosed = true;
-                    break;
-                }
-            }
+    // Nodes are numbered after their operands, so node order is a valid program order
+    vector<uint32_t> viCode(nNodes, 0);
+    uint32_t iBase = nVars + (uint32_t)icCode.consts.size();
+    icCode.code.clear();
+    for(size_t n=0; n<nNodes; n++) {
+        const nodeKey& nkKey = vnKeys[n];
+        if(nkKey.eval == EVAL_VARIABLE || nkKey.eval == EVAL_NUMBER) continue;
+        rinstr riIns = {(uint32_t)nkKey.eval, iBase + (uint32_t)icCode.code.size(), {0, 0, 0, 0}};
+        for(value_t i=0; i<vnSize[n]; i++) riIns.arg[i] = viReg[nkKey.args[i]];
+        viCode[n] = (uint32_t)icCode.code.size();
+        viReg[n]  = riIns.dst;
+        icCode.code.push_back(riIns);
+    }
 
-            if(iErase > 0) {
-                vtStack.erase(vtStack.begin(),vtStack.begin()+iErase);
-            }
+    // Instructions that depend on each variable
+    vector<bool> vbDep(nNodes);
+    icCode.first.assign(1, 0);
+    icCode.deps.clear();
+    for(uint32_t v=0; v<nVars; v++) {
+        for(size_t n=0; n<nNodes; n++) {
+            const nodeKey& nkKey = vnKeys[n];
+            bool isDep = nkKey.eval == EVAL_VARIABLE && nkKey.leaf == v;
+            for(value_t i=0; i<vnSize[n]; i++) isDep = isDep || vbDep[nkKey.args[i]];
+            vbDep[n] = isDep;
+            if(isDep && vnSize[n] > 0) icCode.deps.push_back(viCode[n]);
+        }
+        icCode.first.push_back((uint32_t)icCode.deps.size());
+    }
 
-            // Check if brackets were closed
-            if(isClosed) {
-                vtStack.erase(vtStack.begin());
-            } else {
-                printf("Math Error: Paranthesis mismatch\n");
-                return false;
-            }
+    icCode.result = viReg[viStack.back()];
+    icCode.frame  = iBase + icCode.code.size();
 
-            // Check if the next token on stack is a function
-            if(vtStack.front().type == MP_FUNC) {
-                vtOutput.push_back(vtStack.front());
-                vtStack.erase(vtStack.begin());
-            }
+#ifdef DEBUG
+    printf("DEBUG> Incremental program, frame size %d:\n", (int)icCode.frame);
+    for(size_t i=0; i<icCode.code.size(); i++) {
+        printf("DEBUG>  * %4d : Op = %2d, Dst = %4d, Args = %4d %4d %4d\n", (int)i, (int)icCode.code[i].op,
+            (int)icCode.code[i].dst, (int)icCode.code[i].arg[0], (int)icCode.code[i].arg[1], (int)icCode.code[i].arg[2]);
+    }
+    for(uint32_t v=0; v<nVars; v++) {
+        printf("DEBUG>  * %-5s : %d dependent instructions\n", m_WVariable[v].c_str(), (int)(icCode.first[v+1] - icCode.first[v]));
+    }
+    printf("DEBUG>  * Result in register %d\n", (int)icCode.result);
+#endif
 
-            break;
+    return true;
+}
 
-        case MP_COMMA:
-            iErase   = 0;
-            isClosed = false;
+// ****************************************************************************************************************************** //
 
-            for(auto tStack : vtStack) {
-                if(tStack.type != MP_LBRACK) {
-                    vtOutput.push_back(tStack);
-                    iErase++;
-                } else {
-                    isClosed = true;
-                    break;
-                }
-            }
+/**
+ *  Function :: eqFilter
+ * ======================
+ *  Builds the filter plan of a program whose result is a comparison, && or ||, see Program::EvalFilter. The compiled code is
+ *  walked once to find the tree of those operators at the top. Every other subtree is a contiguous range of the code, which
+ *  becomes an operand program, or a single constant or column that is read directly. Stores make their subtree an operand
+ *  program, so that the store still runs. Where the compiler put a jump before the right operand of && or ||, the plan can
+ *  skip it as well, since such code keeps no temporaries used elsewhere. Returns false if there is no such tree at the top.
+ */
 
-            if(iErase > 0) {
-                vtStack.erase(vtStack.begin(),vtStack.begin()+iErase);
+struct filterNode {
+    value_t op;     // Comparison, && or ||, or EVAL_NONE for a subtree evaluated as a number
+    size_t  start;  // Range of the code of the subtree
+    size_t  end;
+    size_t  left;   // Operand nodes
+    size_t  right;
+};
+
+bool Math::eqFilter(filtercode& fcCode) {
+
+    vector<filterNode> vfNodes;
+    vector<size_t>     viStack;
+
+    for(size_t i=0; i<m_Code.size() && m_Code[i].op != EVAL_END; i++) {
+
+        const instr& iOp = m_Code[i];
+        if(iOp.op >= EVAL_JUMP_IF && iOp.op <= EVAL_JUMP_OR) continue;
+        if(iOp.op == EVAL_OUTPUT || viStack.size() < iOp.size) return false;
+
+        filterNode fnNode = {EVAL_NONE, i, i+1, 0, 0};
+        if(iOp.size > 0) {
+            size_t iFirst = viStack.size() - iOp.size;
+            fnNode.start = vfNodes[viStack[iFirst]].start;
+            if(iOp.size == 2 && iOp.op >= EVAL_LOGICAL_AND && iOp.op <= EVAL_LOGICAL_GE) {
+                fnNode.op    = iOp.op;
+                fnNode.left  = viStack[iFirst];
+                fnNode.right = viStack[iFirst+1];
             }
+            viStack.resize(iFirst);
+        }
+        viStack.push_back(vfNodes.size());
+        vfNodes.push_back(fnNode);
+    }
 
-            break;
+    if(viStack.size() != 1 || vfNodes[viStack[0]].op == EVAL_NONE) return false;
 
-        case MP_END:
-            iErase = 0;
+    // Operands are read directly if they are a single constant or column, and copied out as programs otherwise
+    auto makeOperand = [&](const filterNode& fnNode, instr* pOperand) {
+        if(fnNode.end - fnNode.start == 1) {
+            const instr& iLeaf = m_Code[fnNode.start];
+            if(iLeaf.op == EVAL_NUMBER || iLeaf.op == EVAL_VARIABLE) {
+                *pOperand = iLeaf;
+                return true;
+            }
+        }
+        *pOperand = instr({EVAL_END, 0, (uint32_t)fcCode.code.size()});
+        for(size_t i=fnNode.start; i<fnNode.end; i++) {
+            instr iOp = m_Code[i];
+            if(iOp.op >= EVAL_JUMP_IF && iOp.op <= EVAL_JUMP_OR) {
+                if(iOp.arg < fnNode.start || iOp.arg > fnNode.end) return false;
+                iOp.arg -= (uint32_t)fnNode.start;
+            }
+            fcCode.code.push_back(iOp);
+        }
+        fcCode.code.push_back(instr({EVAL_END, 0, 0}));
+        return true;
+    };
+
+    // The tree is emitted in the order of the code, so operand programs keep the order of their stores and loads
+    size_t nDepth = 0;
+    function<bool(size_t)> emitNode = [&](size_t iNode) {
+        const filterNode& fnNode = vfNodes[iNode];
+        filterstep fsStep = {fnNode.op, 0, instr({EVAL_END, 0, 0}), instr({EVAL_END, 0, 0})};
+
+        if(fnNode.op == EVAL_LOGICAL_AND || fnNode.op == EVAL_LOGICAL_OR) {
+            if(!emitNode(fnNode.left)) return false;
+            size_t iJump = fcCode.steps.size();
+            value_t idJump = m_Code[vfNodes[fnNode.right].start-1].op;
+            bool    isJump = idJump == (fnNode.op == EVAL_LOGICAL_AND ? EVAL_JUMP_AND : EVAL_JUMP_OR);
+            if(isJump) fcCode.steps.push_back(filterstep({idJump, 0, fsStep.left, fsStep.right}));
+            if(!emitNode(fnNode.right)) return false;
+            fcCode.steps.push_back(fsStep);
+            if(isJump) fcCode.steps[iJump].target = (uint32_t)fcCode.steps.size();
+            nDepth--;
+            return true;
+        }
 
-            if(vtStack.size() > 0) {
-                if( vtStack.front().type == MP_LBRACK ||
-                    vtStack.front().type == MP_RBRACK ) {
-                printf("Math Error: Paranthesis mismatch\n");
-                return false;
-                }
+        if(fnNode.op == EVAL_NONE) {
+            if(!makeOperand(fnNode, &fsStep.left)) return false;
+        } else {
+            if(!makeOperand(vfNodes[fnNode.left], &fsStep.left))   return false;
+            if(!makeOperand(vfNodes[fnNode.right], &fsStep.right)) return false;
+        }
+        fcCode.steps.push_back(fsStep);
+        nDepth++;
+        fcCode.depth = max(fcCode.depth, nDepth);
+        return true;
+    };
 
-                for(auto tStack : vtStack) {
-                    vtOutput.push_back(tStack);
-                    iErase++;
-                }
-                if(iErase > 0) {
-                    vtStack.erase(vtStack.begin(),vtStack.begin()+iErase);
-                }
-            }
+    return emitNode(viStack[0]);
+}
 
-            vtOutput.push_back(tItem);
-            m_ParseTree = vtOutput;
+// ****************************************************************************************************************************** //
 
-#ifdef DEBUG
-            nStep++;
-            printf("DEBUG> Step %d\n", nStep);
-            printf("DEBUG>  * Current : %s\n", tItem.content.c_str());
-            printf("DEBUG>  * Stack   : ");
-            for(auto tTemp : vtStack) {
-                printf("%s  ",tTemp.content.c_str());
-            }
-            printf("\n");
-            printf("DEBUG>  * Output  : ");
-            for(auto tTemp : vtOutput) {
-                printf("%s  ",tTemp.content.c_str());
-            }
-            printf("\n");
+/**
+ *  Function :: eqBuildProgram
+ * ============================
+ *  Collects the compiled code into a new immutable Program for the selected backend, and generates native code for it if the
+ *  backend is MB_JIT, or the code of the incremental backend if it is MB_INCREMENTAL. A program the JIT cannot handle still
+ *  evaluates with the stack interpreter. The scratch buffers of this object are sized for the program here, so that Eval
+ *  and EvalBatch do not need to allocate.
+ */
+
+bool Math::eqBuildProgram() {
+
+    shared_ptr<Program> pProgram = make_shared<Program>();
+
+    pProgram->m_Backend   = m_Backend;
+    pProgram->m_StackSize = m_StackSize;
+    pProgram->m_TempSize  = m_TempSize;
+    pProgram->m_FrameSize = m_FrameSize;
+    pProgram->m_RegResult = m_RegResult;
+    pProgram->m_Outputs   = m_Outputs;
+    pProgram->m_Variables = m_WVariable;
+    pProgram->m_Code      = m_Code;
+    pProgram->m_Consts    = m_Consts;
+    pProgram->m_ConstsF.assign(m_Consts.begin(), m_Consts.end());
+    pProgram->m_RegCode   = m_RegCode;
+
+#ifdef JIT_BACKEND
+    if(m_Backend == MB_JIT && m_Outputs == 0) {
+        shared_ptr<JitCode> pJit = make_shared<JitCode>();
+        if(pJit->Compile(m_Code, m_Consts, m_StackSize, m_TempSize)) pProgram->m_Jit = pJit;
+    }
 #endif
 
-            return true;
-            break;
-        }
+    if(m_Backend == MB_INCREMENTAL && m_Outputs == 0) {
+        shared_ptr<inccode> pInc = make_shared<inccode>();
+        if(eqIncremental(*pInc)) pProgram->m_Inc = pInc;
+    }
+
+    if(m_Outputs == 0) {
+        shared_ptr<filtercode> pFilter = make_shared<filtercode>();
+        if(eqFilter(*pFilter)) pProgram->m_Filter = pFilter;
+    }
 
 #ifdef DEBUG
-        nStep++;
-        printf("DEBUG> Step %d\n", nStep);
-        printf("DEBUG>  * Current : %s\n", tItem.content.c_str());
-        printf("DEBUG>  * Stack   : ");
-        for(auto tTemp : vtStack) {
-            printf("%s  ",tTemp.content.c_str());
-        }
-        printf("\n");
-        printf("DEBUG>  * Output  : ");
-        for(auto tTemp : vtOutput) {
-            printf("%s  ",tTemp.content.c_str());
-        }
-        printf("\n");
+    if(m_Backend == MB_JIT) {
+        printf("DEBUG> JIT compiler: %s\n", pProgram->m_Jit ? "native code" : "not available, using the stack interpreter");
+    }
 #endif
+
+    // Batches are interpreted in tiles of rows small enough for the stack and temporaries of a tile to stay in the L1 cache.
+    // Tiles are a whole number of the widest SIMD vector, 16 floats. The packed native code has its own fixed layout.
+    if(!pProgram->m_Jit) {
+        size_t nTile = EVAL_TILE_BYTES/((m_StackSize + m_TempSize)*sizeof(double_t));
+        pProgram->m_Tile = min((size_t)EVAL_BLOCK, max((size_t)16, nTile/16*16));
     }
 
-    return false;
+    pProgram->Prepare(m_Scratch);
+    m_Program = pProgram;
+
+    return true;
 }
 
 // ****************************************************************************************************************************** //
@@ -843,46 +2543,29 @@ bool Math::eqParser() {
 /**
  *  Function :: precedenceLogical
  * ===============================
- *  Returns precedence and associativity of operator
+ *  Returns precedence and associativity of operator, and leaves them unchanged for other tokens
  */
 
-void Math::precedenceLogical(string_t sOperator, int32_t* pPrecedence, int32_t* pAssoc) {
+void Math::precedenceLogical(value_t idEval, int32_t* pPrecedence, int32_t* pAssoc) {
 
-    if(sOperator == "&&") {
+    switch(idEval) {
+    case EVAL_LOGICAL_AND:
         *pPrecedence = 3;
         *pAssoc = ASSOC_L;
-    } else
-    if(sOperator == "||") {
+        break;
+    case EVAL_LOGICAL_OR:
         *pPrecedence = 2;
         *pAssoc = ASSOC_L;
-    } else
-    if(sOperator == "==") {
-        *pPrecedence = 9;
-        *pAssoc = ASSOC_L;
-    } else
-    if(sOperator == "<") {
-        *pPrecedence = 9;
-        *pAssoc = ASSOC_L;
-    } else
-    if(sOperator == ">") {
-        *pPrecedence = 9;
-        *pAssoc = ASSOC_L;
-    } else
-    if(sOperator == ">=") {
-        *pPrecedence = 9;
-        *pAssoc = ASSOC_L;
-    } else
-    if(sOperator == "<=") {
-        *pPrecedence = 9;
-        *pAssoc = ASSOC_L;
-    } else
-    if(sOperator == "!=") {
-        *pPrecedence = 9;
-        *pAssoc = ASSOC_L;
-    } else
-    if(sOperator == "<>") {
+        break;
+    case EVAL_LOGICAL_EQ:
+    case EVAL_LOGICAL_NE:
+    case EVAL_LOGICAL_LT:
+    case EVAL_LOGICAL_GT:
+    case EVAL_LOGICAL_LE:
+    case EVAL_LOGICAL_GE:
         *pPrecedence = 9;
         *pAssoc = ASSOC_L;
+        break;
     }
 
     return;
@@ -893,33 +2576,26 @@ void Math::precedenceLogical(string_t sOperator, int32_t* pPrecedence, int32_t*
 /**
  *  Function :: precedenceMath
  * ============================
- *  Returns precedence and associativity of operator
+ *  Returns precedence and associativity of operator, and leaves them unchanged for other tokens
+ *  A plus or minus, binary or unary, gets the precedence selected by isUnary.
  */
 
-void Math::precedenceMath(string_t sOperator, bool isUnary, int32_t* pPrecedence, int32_t* pAssoc) {
+void Math::precedenceMath(value_t idEval, bool isUnary, int32_t* pPrecedence, int32_t* pAssoc) {
 
-    if(sOperator == "^") {
+    switch(idEval) {
+    case EVAL_MATH_POW:
         *pPrecedence = 5;
         *pAssoc = ASSOC_R;
-    } else
-    if(sOperator == "*") {
+        break;
+    case EVAL_MATH_MULT:
+    case EVAL_MATH_DIV:
         *pPrecedence = 3;
         *pAssoc = ASSOC_L;
-    } else
-    if(sOperator == "/") {
-        *pPrecedence = 3;
-        *pAssoc = ASSOC_L;
-    } else
-    if(sOperator == "+") {
-        if(isUnary) {
-            *pPrecedence = 4;
-            *pAssoc = ASSOC_R;
-        } else {
-            *pPrecedence = 2;
-            *pAssoc = ASSOC_L;
-        }
-    } else
-    if(sOperator == "-") {
+        break;
+    case EVAL_MATH_PLUS:
+    case EVAL_MATH_MINUS:
+    case EVAL_UNARY_PLUS:
+    case EVAL_UNARY_MINUS:
         if(isUnary) {
             *pPrecedence = 4;
             *pAssoc = ASSOC_R;
@@ -927,6 +2603,7 @@ void Math::precedenceMath(string_t sOperator, bool isUnary, int32_t* pPrecedence
             *pPrecedence = 2;
             *pAssoc = ASSOC_L;
         }
+        break;
     }
 
     return;
@@ -934,4 +2611,55 @@ void Math::precedenceMath(string_t sOperator, bool isUnary, int32_t* pPrecedence
 
 // ****************************************************************************************************************************** //
 
+/**
+ *  Function :: tokenText
+ * =======================
+ *  Text of a token for error and debug output
+ */
+
+string_t Math::tokenText(const token& tItem) {
+
+    if(tItem.eval == EVAL_VARIABLE && tItem.index >= 0 && (size_t)tItem.index < m_WVariable.size()) {
+        return m_WVariable[tItem.index];
+    }
+    if(tItem.eval == EVAL_NUMBER) {
+        char sValue[32];
+        snprintf(sValue, sizeof(sValue), "%.17g", tItem.value);
+        return sValue;
+    }
+    if(tItem.eval == EVAL_STORE || tItem.eval == EVAL_LOAD || tItem.eval == EVAL_OUTPUT) {
+        return evalName(tItem.eval) + to_string(tItem.index);
+    }
+    if(tItem.type == MP_LBRACK) return "(";
+    if(tItem.type == MP_RBRACK) return ")";
+    if(tItem.type == MP_COMMA)  return ",";
+
+    return evalName(tItem.eval);
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: evalName
+ * ======================
+ *  Name of an instruction, for error and debug output
+ */
+
+const char* smath::evalName(value_t idEval) {
+
+    static const char* aNames[EVAL_COUNT] = {
+        "none",   "number", "variable", "pi",     "+",      "-",      "+",      "-",      "*",      "/",
+        "^",      "&&",     "||",       "==",     "!=",     "<",      ">",      "<=",     ">=",     "sin",
+        "cos",    "tan",    "asin",     "acos",   "atan",   "atan2",  "exp",    "log",    "abs",    "mod",
+        "if",     "end",    "store",    "load",   "output", "jump_if", "jump", "jump_and", "jump_or", "move",
+        "muladd", "mulsub", "nmuladd", "select_eq", "select_ne", "select_lt", "select_gt", "select_le", "select_ge",
+    };
+
+    if(idEval < 0 || idEval >= EVAL_COUNT) return "unknown";
+
+    return aNames[idEval];
+}
+
+// ****************************************************************************************************************************** //
+
 // End Class Math
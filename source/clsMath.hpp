@@ -68,26 +68,258 @@
 #define EVAL_FUNC_MOD     29
 #define EVAL_SPECIAL_IF   30
 #define EVAL_END          31
+#define EVAL_STORE        32
+#define EVAL_LOAD         33
+#define EVAL_OUTPUT       34
+#define EVAL_JUMP_IF      35
+#define EVAL_JUMP         36
+#define EVAL_JUMP_AND     37
+#define EVAL_JUMP_OR      38
+
+// Opcodes from EVAL_MOVE on only occur in register code. EVAL_COUNT is one past the last opcode of either code.
+#define EVAL_MOVE         39
+#define EVAL_MULADD       40
+#define EVAL_MULSUB       41
+#define EVAL_NMULADD      42
+#define EVAL_SELECT_EQ    43
+#define EVAL_SELECT_NE    44
+#define EVAL_SELECT_LT    45
+#define EVAL_SELECT_GT    46
+#define EVAL_SELECT_LE    47
+#define EVAL_SELECT_GE    48
+#define EVAL_COUNT        49
+
+#define MB_STACK       0
+#define MB_REGISTER    1
+#define MB_JIT         2
+#define MB_INCREMENTAL 3
+
+#define AD_AUTO      0
+#define AD_FORWARD   1
+#define AD_REVERSE   2
+
+#define PM_OFF       0
+#define PM_CALLS     1
+#define PM_OPS       2
+
+#define RD_SUM       0
+#define RD_MIN       1
+#define RD_MAX       2
+#define RD_MEAN      3
+#define RD_COUNT     4
+
+#define EVAL_BLOCK       256
+#define EVAL_TILE_BYTES  32768
+#define EVAL_BRANCH_COST 12
+#define EVAL_INC_MERGE   8
+#define EVAL_INC_FRAMES  16
+#define EVAL_RED_LANES   4
 
 // Includes
 #include <iostream>
 #include <cmath>
 #include <vector>
+#include <map>
+#include <cstdint>
+#include <memory>
+#include <atomic>
 
 // TypeDefs
 typedef std::vector<std::string> vstring_t;
 typedef std::vector<double_t>    vdouble_t;
+typedef std::vector<float>       vfloat_t;
 typedef std::string              string_t;
 typedef int32_t                  value_t;
 
 namespace smath {
 
+class JitCode;
+class ImageWriter;
+class ImageReader;
+
 struct token {
     value_t  type;
-    string_t content;
     double_t value;
     value_t  eval;
     value_t  size;
+    value_t  index;
+};
+
+struct instr {
+    uint16_t op;
+    uint16_t size;
+    uint32_t arg;
+};
+
+struct rinstr {
+    uint32_t op;
+    uint32_t dst;
+    uint32_t arg[4];
+};
+
+// Code of the incremental backend, with one instruction per distinct subexpression, each writing its own frame register
+struct inccode {
+    std::vector<rinstr>   code;
+    std::vector<uint32_t> first;   // Start of the list of each variable in deps, followed by the end of the last list
+    std::vector<uint32_t> deps;    // Instructions that depend on each variable, in program order
+    vdouble_t             consts;  // Values of the frame registers after the variables
+    uint32_t              result = 0;
+    size_t                frame  = 0;
+};
+
+// One step of a filter plan. Comparisons and EVAL_NONE push the mask of their operands, which are a constant, a column, or
+// the operand program starting at arg in the code of the plan when op is EVAL_END. EVAL_NONE tests left against EVAL_FALSE.
+// EVAL_LOGICAL_AND and EVAL_LOGICAL_OR combine the two top masks, and EVAL_JUMP_AND and EVAL_JUMP_OR continue at step
+// target when the top mask decides the result for every row of the tile.
+struct filterstep {
+    value_t  op;
+    uint32_t target;
+    instr    left;
+    instr    right;
+};
+
+// Filter plan of an equation whose result is a comparison, && or ||, see Program::EvalFilter
+struct filtercode {
+    std::vector<instr>      code;       // Operand programs, each ending with EVAL_END
+    std::vector<filterstep> steps;
+    size_t                  depth = 0;  // Most masks on the mask stack at once
+};
+
+// Frame of the incremental backend for one program, holding the values of its last Eval
+struct incframe {
+    uint64_t  program = 0;      // Id of the program the frame belongs to
+    bool      valid   = false;  // Whether the frame holds the values of a finished Eval
+    vdouble_t values;
+};
+
+// Per-thread evaluation buffers, owned by the caller of Program::Eval and Program::EvalBatch
+struct scratch {
+    uint64_t                     program = 0;  // Id of the program the register frame holds constants for
+    vdouble_t                    stack;        // Eval stack followed by the temporaries
+    vdouble_t                    frame;        // Register frame
+    vdouble_t                    block;        // EvalBatch stack, temporaries and JIT input block
+    vdouble_t                    output;       // Results of Eval for a program with several outputs
+    std::vector<incframe>        caches;       // Incremental frames of the last EVAL_INC_FRAMES programs, most recent first
+    vfloat_t                     fblock;       // Single precision EvalBatch stack and temporaries, sized on first use
+    vdouble_t                    tile;         // Results of the tile EvalReduce or EvalFilter is working on
+    std::vector<const double_t*> columns;      // Columns of that tile
+    std::vector<uint64_t>        masks;        // Mask stack of EvalFilter, one bit per row of the tile
+};
+
+// Executions of one instruction and the time stamp counter cycles they took, see Program::getProfile
+struct opstats {
+    uint64_t count;
+    uint64_t cycles;
+};
+
+// Profile of a program, collected while profiling is turned on with Program::setProfiling
+struct evalprofile {
+    uint64_t calls;            // Calls to Eval and EvalBatch
+    uint64_t rows;             // Rows evaluated, one per call to Eval
+    uint64_t cycles;           // Cycles spent in those calls
+    opstats  ops[EVAL_COUNT];  // Instructions run by the interpreters with PM_OPS, counted once per row
+};
+
+// Partial result of Program::EvalReduce. Partials are combined with reduceMerge, and are all zero before the first row.
+struct reduction {
+    double_t sum;    // Sum of the results, with the rounding error of the sum in comp
+    double_t comp;
+    double_t value;  // Smallest or largest result, NaN if any result was
+    uint64_t rows;   // Rows folded
+    uint64_t count;  // Rows with a result other than EVAL_FALSE
+};
+
+struct profcounters;
+
+// Name of an instruction, for error and debug output
+const char* evalName(value_t idEval);
+
+// Combining and finishing the partial results of EvalReduce
+void     reduceMerge(reduction* pInto, const reduction& rdPart, value_t idReduce);
+double_t reduceValue(const reduction& rdTotal, value_t idReduce);
+
+class Program {
+
+friend class Math;
+
+public:
+
+   /**
+    * Constructor/Destructor
+    */
+
+    Program();
+    ~Program();
+
+   /**
+    * Methods
+    */
+
+    bool    Eval(const double_t*, size_t, double_t*, scratch&) const;
+    bool    Eval(const double_t*, size_t, double_t*, size_t, scratch&) const;
+    bool    EvalBatch(const double_t* const*, size_t, double_t*, size_t, scratch&) const;
+    bool    EvalBatch(const double_t* const*, size_t, double_t* const*, size_t, scratch&) const;
+    bool    EvalBatch(const float* const*, size_t, float*, size_t, scratch&) const;
+    bool    EvalBatch(const float* const*, size_t, float* const*, size_t, scratch&) const;
+    bool    EvalReduce(const double_t* const*, size_t, size_t, size_t, value_t, reduction*, scratch&) const;
+    bool    EvalFilter(const double_t* const*, size_t, size_t, uint64_t*, size_t*, size_t*, scratch&) const;
+    void    Prepare(scratch&) const;
+    bool    isPrepared(const scratch&) const;
+
+    value_t getBackend() const;
+    size_t  getVariableCount() const;
+    size_t  getOutputCount() const;
+
+    evalprofile getProfile() const;
+    void        resetProfile() const;
+    void        addProfile(size_t, uint64_t, const opstats*) const;
+
+    static void    setProfiling(value_t);
+    static value_t getProfiling();
+
+private:
+
+   /**
+    * Member Functions
+    */
+
+    bool    evalScalar(const double_t*, size_t, double_t*, scratch&, opstats*) const;
+    bool    evalIncremental(const double_t*, size_t, double_t*, scratch&) const;
+    incframe& incFrame(scratch&) const;
+    bool    evalRows(const double_t* const*, size_t, double_t* const*, size_t, scratch&, opstats*) const;
+
+    template<bool isProfiled>
+    bool    evalStack(const double_t*, double_t*, scratch&, opstats*) const;
+    template<bool isProfiled>
+    bool    evalRegister(const double_t*, size_t, double_t*, scratch&, opstats*) const;
+    template<typename T>
+    bool    evalTiles(const T*, const T* const*, size_t, T* const*, size_t, T*, T*, opstats*, const instr*) const;
+    bool    filterTile(const double_t* const*, size_t, size_t, uint64_t*, scratch&, opstats*) const;
+
+   /**
+    * Member Variables
+    */
+
+    uint64_t                 m_Id;
+    value_t                  m_Backend   = MB_STACK;
+    size_t                   m_StackSize = 0;
+    size_t                   m_TempSize  = 0;
+    size_t                   m_FrameSize = 0;
+    uint32_t                 m_RegResult = 0;
+    size_t                   m_Outputs   = 0;
+    size_t                   m_Tile      = EVAL_BLOCK;
+
+    vstring_t                m_Variables;
+    std::vector<instr>       m_Code;
+    vdouble_t                m_Consts;
+    vfloat_t                 m_ConstsF;
+    std::vector<rinstr>      m_RegCode;
+    std::shared_ptr<JitCode> m_Jit;
+    std::shared_ptr<const inccode> m_Inc;
+    std::shared_ptr<const filtercode> m_Filter;
+
+    mutable std::atomic<profcounters*> m_Profile{nullptr};
+
 };
 
 class Math {
@@ -107,12 +339,29 @@ public:
 
     bool setVariables(vstring_t);
     bool setEquation(string_t);
+    bool setEquationSet(const std::vector<const Math*>&);
+    bool setGradient(const Math*, value_t idMode=AD_AUTO);
+    bool setBackend(value_t);
+
+    value_t   getBackend();
+    size_t    getVariableCount();
+    size_t    getMemoryUsage();
+    string_t  getEquation();
+    vstring_t getVariables();
 
    /**
     * Methods
     */
 
-    bool Eval(vdouble_t, double_t*);
+    bool Eval(const vdouble_t&, double_t*);
+    bool Eval(const double_t*, size_t, double_t*);
+    bool EvalBatch(const double_t* const*, size_t, double_t*, size_t nStride=1);
+    bool EvalBatch(const float* const*, size_t, float*, size_t nStride=1);
+
+    std::shared_ptr<const Program> getProgram();
+
+    bool writeImage(ImageWriter&);
+    bool readImage(ImageReader&);
 
    /**
     * Properties
@@ -126,22 +375,50 @@ private:
 
     bool    eqLexer();
     bool    eqParser();
+    bool    eqStackSize();
+    bool    eqOptimiser();
+    bool    eqBranches();
+    bool    eqSubexpressions();
+    bool    eqGradient(value_t);
+    bool    eqCompiler();
+    bool    eqRegisterCompiler();
+    bool    eqIncremental(inccode&);
+    bool    eqFilter(filtercode&);
+    bool    eqBuildProgram();
+
+    bool    evalConstant(value_t, const double_t*, double_t*);
 
     value_t validWord(string_t*);
 
-    void    precedenceLogical(string_t, int32_t*, int32_t*);
-    void    precedenceMath(string_t, bool, int32_t*, int32_t*);
+    void    precedenceLogical(value_t, int32_t*, int32_t*);
+    void    precedenceMath(value_t, bool, int32_t*, int32_t*);
+
+    string_t tokenText(const token&);
 
    /**
     * Member Variables
     */
 
     bool               m_Parsed    = false;
+    value_t            m_Backend   = MB_STACK;
+    size_t             m_StackSize = 0;
+    size_t             m_TempSize  = 0;
+    size_t             m_Outputs   = 0;
 
     string_t           m_Equation;
     vstring_t          m_WVariable;
     std::vector<token> m_Tokens;
     std::vector<token> m_ParseTree;
+    std::vector<token> m_Folded;
+    std::vector<instr> m_Code;
+    vdouble_t          m_Consts;
+
+    std::vector<rinstr> m_RegCode;
+    size_t              m_FrameSize = 0;
+    uint32_t            m_RegResult = 0;
+
+    std::shared_ptr<const Program> m_Program;
+    scratch                        m_Scratch;
 
 };
 
@@ -0,0 +1,1637 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  Compiled Program
+ *  The evaluators for a compiled equation. A Program is not changed after Math has built it, and keeps all per-evaluation
+ *  state in the caller's scratch, so one Program can be evaluated from any number of threads at once.
+ */
+
+#include "clsMath.hpp"
+#ifdef SIMD_KERNELS
+#include "simdKernel.hpp"
+#endif
+#ifdef JIT_BACKEND
+#include "jitCompiler.hpp"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+using namespace smath;
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Constructor
+ * =============
+ *  Every program gets a unique id, so a scratch can tell whether its register frame was set up for this program
+ */
+
+static atomic<uint64_t> s_NextId(1);
+
+Program::Program() {
+    m_Id = s_NextId++;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: Prepare
+ * ===================
+ *  Sizes the buffers of sWork for this program and copies the constants into its register frame. Only allocates the first
+ *  time a scratch is used with a program larger than any before it, so calling it ahead of time keeps evaluation allocation
+ *  free. Buffers never shrink, so Eval and EvalBatch skip this while sWork was last prepared for the same program.
+ */
+
+void Program::Prepare(scratch& sWork) const {
+
+    size_t nVars  = m_Variables.size();
+    size_t nStack = m_StackSize + m_TempSize;
+    size_t nBlock = (m_StackSize + m_TempSize)*m_Tile + (m_Jit ? nVars+1 : 0)*EVAL_BLOCK;
+
+    if(sWork.stack.size() < nStack)      sWork.stack.resize(nStack);
+    if(sWork.frame.size() < m_FrameSize) sWork.frame.resize(m_FrameSize);
+    if(sWork.block.size() < nBlock)      sWork.block.resize(nBlock);
+    if(sWork.output.size() < m_Outputs)  sWork.output.resize(m_Outputs);
+    if(sWork.tile.size() < 2*EVAL_BLOCK) sWork.tile.resize(2*EVAL_BLOCK);
+    if(sWork.columns.size() < nVars)     sWork.columns.resize(nVars);
+    if(m_Filter && sWork.masks.size() < m_Filter->depth*((m_Tile+63)/64)) {
+        sWork.masks.resize(m_Filter->depth*((m_Tile+63)/64));
+    }
+    if(m_Inc) incFrame(sWork);
+
+    if(sWork.program != m_Id) {
+        copy(m_Consts.begin(), m_Consts.end(), sWork.frame.begin() + nVars);
+        sWork.program = m_Id;
+    }
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: isPrepared
+ * ======================
+ *  Returns true if sWork was last prepared for this program, so that its buffers are already large enough for it
+ */
+
+bool Program::isPrepared(const scratch& sWork) const {
+    return sWork.program == m_Id;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: getBackend
+ * ======================
+ *  Returns the backend used by Eval, which is MB_STACK if MB_JIT or MB_INCREMENTAL was requested but is not available
+ */
+
+value_t Program::getBackend() const {
+
+    if(m_Backend == MB_JIT && !m_Jit) return MB_STACK;
+    if(m_Backend == MB_INCREMENTAL && !m_Inc) return MB_STACK;
+
+    return m_Backend;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: getVariableCount
+ * ============================
+ */
+
+size_t Program::getVariableCount() const {
+    return m_Variables.size();
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: getOutputCount
+ * ==========================
+ *  Returns the number of outputs of a program built by Math::setEquationSet or Math::setGradient, and 0 for a single equation
+ */
+
+size_t Program::getOutputCount() const {
+    return m_Outputs;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Profiling
+ * ===========
+ *  Profiling is off by default, and is turned on for every program in the process with setProfiling. PM_CALLS counts the
+ *  calls, rows and cycles of each program on the same code paths as without profiling. PM_OPS also counts the instructions
+ *  run and the cycles between them, which needs the interpreters, so programs built for MB_JIT or MB_INCREMENTAL and batches
+ *  that would run on a SIMD kernel are interpreted while it is on. Each call gathers its counts on the stack and adds them to
+ *  the atomic counters of its program when it returns, so threads only share a cache line once per call. Cycles are read
+ *  from the time stamp counter where there is one, and are nanoseconds of a steady clock otherwise.
+ */
+
+struct smath::profcounters {
+    atomic<uint64_t> calls{0};
+    atomic<uint64_t> rows{0};
+    atomic<uint64_t> cycles{0};
+    atomic<uint64_t> count[EVAL_COUNT];
+    atomic<uint64_t> opcycles[EVAL_COUNT];
+
+    profcounters() {
+        for(size_t i=0; i<EVAL_COUNT; i++) {
+            count[i]    = 0;
+            opcycles[i] = 0;
+        }
+    }
+};
+
+Program::~Program() {
+    delete m_Profile.load();
+}
+
+static atomic<value_t> s_Profiling(PM_OFF);
+
+static inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Adds the cycles from its construction to its destruction to the profile of a program, with the instructions counted in
+// ops() if the mode is PM_OPS. Does nothing with PM_OFF.
+class profileScope {
+
+public:
+
+    profileScope(const Program* pProgram, size_t nRows, value_t idMode) : m_Program(pProgram), m_Rows(nRows), m_Mode(idMode) {
+        if(m_Mode == PM_OFF) return;
+        if(m_Mode == PM_OPS) memset(m_Ops, 0, sizeof(m_Ops));
+        m_Start = readCycles();
+    }
+    ~profileScope() {
+        if(m_Mode == PM_OFF) return;
+        m_Program->addProfile(m_Rows, readCycles() - m_Start, m_Mode == PM_OPS ? m_Ops : nullptr);
+    }
+
+    opstats* ops() { return m_Mode == PM_OPS ? m_Ops : nullptr; };
+
+private:
+
+    const Program* m_Program;
+    size_t         m_Rows;
+    value_t        m_Mode;
+    uint64_t       m_Start = 0;
+    opstats        m_Ops[EVAL_COUNT];
+
+};
+
+void Program::setProfiling(value_t idMode) {
+    if(idMode != PM_OFF && idMode != PM_CALLS && idMode != PM_OPS) {
+        printf("Math Error: Unknown profiling mode %d\n", idMode);
+        return;
+    }
+    s_Profiling.store(idMode);
+}
+
+value_t Program::getProfiling() {
+    return s_Profiling.load();
+}
+
+void Program::addProfile(size_t nRows, uint64_t nCycles, const opstats* pOps) const {
+
+    profcounters* pProfile = m_Profile.load(memory_order_acquire);
+    if(pProfile == nullptr) {
+        profcounters* pNew = new profcounters();
+        if(m_Profile.compare_exchange_strong(pProfile, pNew, memory_order_acq_rel)) {
+            pProfile = pNew;
+        } else {
+            delete pNew;
+        }
+    }
+
+    pProfile->calls.fetch_add(1, memory_order_relaxed);
+    pProfile->rows.fetch_add(nRows, memory_order_relaxed);
+    pProfile->cycles.fetch_add(nCycles, memory_order_relaxed);
+    if(pOps == nullptr) return;
+    for(size_t i=0; i<EVAL_COUNT; i++) {
+        if(pOps[i].count == 0) continue;
+        pProfile->count[i].fetch_add(pOps[i].count, memory_order_relaxed);
+        pProfile->opcycles[i].fetch_add(pOps[i].cycles, memory_order_relaxed);
+    }
+}
+
+// Counters are read one at a time while other threads may add to them, so the totals of a busy program can be off by the
+// calls in flight
+evalprofile Program::getProfile() const {
+
+    evalprofile epProfile;
+    memset(&epProfile, 0, sizeof(epProfile));
+
+    const profcounters* pProfile = m_Profile.load(memory_order_acquire);
+    if(pProfile == nullptr) return epProfile;
+
+    epProfile.calls  = pProfile->calls.load(memory_order_relaxed);
+    epProfile.rows   = pProfile->rows.load(memory_order_relaxed);
+    epProfile.cycles = pProfile->cycles.load(memory_order_relaxed);
+    for(size_t i=0; i<EVAL_COUNT; i++) {
+        epProfile.ops[i].count  = pProfile->count[i].load(memory_order_relaxed);
+        epProfile.ops[i].cycles = pProfile->opcycles[i].load(memory_order_relaxed);
+    }
+
+    return epProfile;
+}
+
+void Program::resetProfile() const {
+
+    profcounters* pProfile = m_Profile.load(memory_order_acquire);
+    if(pProfile == nullptr) return;
+
+    pProfile->calls  = 0;
+    pProfile->rows   = 0;
+    pProfile->cycles = 0;
+    for(size_t i=0; i<EVAL_COUNT; i++) {
+        pProfile->count[i]    = 0;
+        pProfile->opcycles[i] = 0;
+    }
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Dispatch Macros
+ * =================
+ *  The interpreter loop is written once and dispatched either through a table of label addresses (computed goto) on compilers
+ *  that support it, or through a dense switch that the compiler turns into a jump table.
+ */
+
+#if defined(__GNUC__) && !defined(DEBUG)
+#define EVAL_COMPUTED_GOTO
+#endif
+
+#ifdef EVAL_COMPUTED_GOTO
+#define OP_CASE(eval) L_##eval:
+#define OP_FIRST      pIns = pCode++; goto *aJump[pIns->op]
+#define OP_NEXT       OP_TICK; pIns = pCode++; goto *aJump[pIns->op]
+#else
+#define OP_CASE(eval) case eval:
+#define OP_NEXT       OP_TICK; break
+#endif
+
+// In a profiled interpreter, the cycles since the last instruction finished are added to the one that just did
+#define OP_TICK       if(isProfiled) {                             \
+                          uint64_t nNow = readCycles();            \
+                          pOps[pIns->op].count++;                  \
+                          pOps[pIns->op].cycles += nNow - nTick;   \
+                          nTick = nNow;                            \
+                      }
+
+/**
+ *  Method :: Eval
+ * ================
+ *  Evaluate the Parsed Function
+ *  Takes a pointer to nValues values in the same order as the vector of variables
+ *  Executes the compiled bytecode from eqCompiler on the stack in sWork
+ *  Using Reverse Polish notation
+ *  https://en.wikipedia.org/wiki/Reverse_Polish_notation
+ *  Jumps skip the branch that is not taken. A false if() condition stays on the stack below an unused entry in place of the
+ *  first branch, so that the joining if() selects the second branch.
+ *  With nReturn values in pReturn, a program with several outputs writes output k to pReturn[k], and always runs on the
+ *  stack interpreter. While profiling is on, the call is added to the profile of the program.
+ */
+
+bool Program::Eval(const double_t* pValues, size_t nValues, double_t* pReturn, scratch& sWork) const {
+    return Eval(pValues, nValues, pReturn, 1, sWork);
+}
+
+bool Program::Eval(const double_t* pValues, size_t nValues, double_t* pReturn, size_t nReturn, scratch& sWork) const {
+
+#ifdef DEBUG
+    printf("DEBUG> Evaluating Equation\n");
+    for(size_t i=0; i<m_Variables.size() && i<nValues; i++) {
+        printf("DEBUG>  * %-5s = %10.3e\n", m_Variables[i].c_str(), pValues[i]);
+    }
+    printf("DEBUG> Computing\n");
+#endif
+
+    if(m_Variables.size() != nValues) {
+        printf("Math Eval Error: Values vector must be the same length as variables vector\n");
+        return false;
+    }
+
+    if(nReturn < max((size_t)1, m_Outputs)) {
+        printf("Math Eval Error: The program has %d outputs, but there is room for %d\n", (int)m_Outputs, (int)nReturn);
+        return false;
+    }
+
+    value_t idProfile = s_Profiling.load(memory_order_relaxed);
+    if(idProfile == PM_OFF) return evalScalar(pValues, nValues, pReturn, sWork, nullptr);
+
+    profileScope psScope(this, 1, idProfile);
+    return evalScalar(pValues, nValues, pReturn, sWork, psScope.ops());
+}
+
+// Picks the evaluator for one row. Instructions are counted in pOps if it is given, which needs an interpreter.
+bool Program::evalScalar(const double_t* pValues, size_t nValues, double_t* pReturn, scratch& sWork, opstats* pOps) const {
+
+#ifdef JIT_BACKEND
+    if(m_Jit && pOps == nullptr) {
+        *pReturn = m_Jit->scalarFunction()(pValues);
+        return true;
+    }
+#endif
+
+    if(sWork.program != m_Id) Prepare(sWork);
+
+    if(m_Backend == MB_REGISTER && m_Outputs == 0) {
+        if(pOps) return evalRegister<true>(pValues, nValues, pReturn, sWork, pOps);
+        return evalRegister<false>(pValues, nValues, pReturn, sWork, nullptr);
+    }
+
+    if(pOps) return evalStack<true>(pValues, pReturn, sWork, pOps);
+    if(m_Inc && evalIncremental(pValues, nValues, pReturn, sWork)) return true;
+
+    return evalStack<false>(pValues, pReturn, sWork, nullptr);
+}
+
+// The stack interpreter
+template<bool isProfiled>
+bool Program::evalStack(const double_t* pValues, double_t* pReturn, scratch& sWork, opstats* pOps) const {
+
+    const instr*    pBegin = m_Code.data();
+    const instr*    pCode  = pBegin;
+    const instr*    pIns   = pCode;
+    const double_t* pConst = m_Consts.data();
+    double_t*       pStack = sWork.stack.data();
+    double_t*       pTemp  = pStack + m_StackSize;
+    double_t*       pTop   = pStack - 1;
+    uint64_t        nTick  = isProfiled ? readCycles() : 0;
+
+#ifdef EVAL_COMPUTED_GOTO
+    static const void* aJump[EVAL_COUNT] = {
+        &&L_EVAL_NONE,        &&L_EVAL_NUMBER,      &&L_EVAL_VARIABLE,    &&L_EVAL_NONE,
+        &&L_EVAL_UNARY_PLUS,  &&L_EVAL_UNARY_MINUS, &&L_EVAL_MATH_PLUS,   &&L_EVAL_MATH_MINUS,
+        &&L_EVAL_MATH_MULT,   &&L_EVAL_MATH_DIV,    &&L_EVAL_MATH_POW,    &&L_EVAL_LOGICAL_AND,
+        &&L_EVAL_LOGICAL_OR,  &&L_EVAL_LOGICAL_EQ,  &&L_EVAL_LOGICAL_NE,  &&L_EVAL_LOGICAL_LT,
+        &&L_EVAL_LOGICAL_GT,  &&L_EVAL_LOGICAL_LE,  &&L_EVAL_LOGICAL_GE,  &&L_EVAL_FUNC_SIN,
+        &&L_EVAL_FUNC_COS,    &&L_EVAL_FUNC_TAN,    &&L_EVAL_FUNC_ASIN,   &&L_EVAL_FUNC_ACOS,
+        &&L_EVAL_FUNC_ATAN,   &&L_EVAL_FUNC_ATAN2,  &&L_EVAL_FUNC_EXP,    &&L_EVAL_FUNC_LOG,
+        &&L_EVAL_FUNC_ABS,    &&L_EVAL_FUNC_MOD,    &&L_EVAL_SPECIAL_IF,  &&L_EVAL_END,
+        &&L_EVAL_STORE,       &&L_EVAL_LOAD,        &&L_EVAL_OUTPUT,      &&L_EVAL_JUMP_IF,
+        &&L_EVAL_JUMP,        &&L_EVAL_JUMP_AND,    &&L_EVAL_JUMP_OR,     &&L_EVAL_NONE,
+        &&L_EVAL_NONE,        &&L_EVAL_NONE,        &&L_EVAL_NONE,        &&L_EVAL_NONE,
+        &&L_EVAL_NONE,        &&L_EVAL_NONE,        &&L_EVAL_NONE,        &&L_EVAL_NONE,
+        &&L_EVAL_NONE,
+    };
+    OP_FIRST;
+#else
+    for(;;) {
+    pIns = pCode++;
+    switch(pIns->op) {
+#endif
+
+    OP_CASE(EVAL_NUMBER)
+        *++pTop = pConst[pIns->arg];
+        OP_NEXT;
+    OP_CASE(EVAL_VARIABLE)
+        *++pTop = pValues[pIns->arg];
+        OP_NEXT;
+    OP_CASE(EVAL_UNARY_PLUS)
+        OP_NEXT;
+    OP_CASE(EVAL_UNARY_MINUS)
+        *pTop = -*pTop;
+        OP_NEXT;
+    OP_CASE(EVAL_MATH_PLUS)
+        pTop--; *pTop = pTop[0] + pTop[1];
+        OP_NEXT;
+    OP_CASE(EVAL_MATH_MINUS)
+        pTop--; *pTop = pTop[0] - pTop[1];
+        OP_NEXT;
+    OP_CASE(EVAL_MATH_MULT)
+        pTop--; *pTop = pTop[0] * pTop[1];
+        OP_NEXT;
+    OP_CASE(EVAL_MATH_DIV)
+        pTop--; *pTop = pTop[0] / pTop[1];
+        OP_NEXT;
+    OP_CASE(EVAL_MATH_POW)
+        pTop--; *pTop = pow(pTop[0], pTop[1]);
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_AND)
+        pTop--; *pTop = (pTop[0] && pTop[1]) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_OR)
+        pTop--; *pTop = (pTop[0] || pTop[1]) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_EQ)
+        pTop--; *pTop = (pTop[0] == pTop[1]) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_NE)
+        pTop--; *pTop = (pTop[0] != pTop[1]) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_LT)
+        pTop--; *pTop = (pTop[0] <  pTop[1]) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_GT)
+        pTop--; *pTop = (pTop[0] >  pTop[1]) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_LE)
+        pTop--; *pTop = (pTop[0] <= pTop[1]) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_GE)
+        pTop--; *pTop = (pTop[0] >= pTop[1]) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_SIN)
+        *pTop = sin(*pTop);
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_COS)
+        *pTop = cos(*pTop);
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_TAN)
+        *pTop = tan(*pTop);
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_ASIN)
+        *pTop = asin(*pTop);
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_ACOS)
+        *pTop = acos(*pTop);
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_ATAN)
+        *pTop = atan(*pTop);
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_ATAN2)
+        pTop--; *pTop = atan2(pTop[0], pTop[1]);
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_EXP)
+        *pTop = exp(*pTop);
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_LOG)
+        *pTop = log(*pTop);
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_ABS)
+        *pTop = abs(*pTop);
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_MOD)
+        pTop--;
+        if(pTop[0] != floor(pTop[0]) || pTop[1] != floor(pTop[1])) {
+            printf("Math Eval Error: Function mod() requires integer values\n");
+            return false;
+        }
+        *pTop = (int)floor(pTop[0])%(int)floor(pTop[1]);
+        OP_NEXT;
+    OP_CASE(EVAL_SPECIAL_IF)
+        pTop -= 2; *pTop = (pTop[0] != EVAL_FALSE) ? pTop[1] : pTop[2];
+        OP_NEXT;
+    OP_CASE(EVAL_STORE)
+        pTemp[pIns->arg] = *pTop;
+        OP_NEXT;
+    OP_CASE(EVAL_LOAD)
+        *++pTop = pTemp[pIns->arg];
+        OP_NEXT;
+    OP_CASE(EVAL_OUTPUT)
+        pReturn[pIns->arg] = *pTop--;
+        OP_NEXT;
+    OP_CASE(EVAL_JUMP_IF)
+        if(*pTop == EVAL_FALSE) {
+            pTop++;
+            pCode = pBegin + pIns->arg;
+        }
+        OP_NEXT;
+    OP_CASE(EVAL_JUMP)
+        pTop--; *pTop = pTop[1];
+        pCode = pBegin + pIns->arg;
+        OP_NEXT;
+    OP_CASE(EVAL_JUMP_AND)
+        if(*pTop == EVAL_FALSE) {
+            *pTop = EVAL_FALSE;
+            pCode = pBegin + pIns->arg;
+        }
+        OP_NEXT;
+    OP_CASE(EVAL_JUMP_OR)
+        if(*pTop != EVAL_FALSE) {
+            *pTop = EVAL_TRUE;
+            pCode = pBegin + pIns->arg;
+        }
+        OP_NEXT;
+    OP_CASE(EVAL_END)
+        if(m_Outputs == 0) *pReturn = pStack[0];
+        return true;
+#ifdef EVAL_COMPUTED_GOTO
+    L_EVAL_NONE:
+#else
+    default:
+#endif
+        printf("Math Eval Error: Unknown instruction %d '%s'\n", pIns->op, evalName(pIns->op));
+        return false;
+
+#ifndef EVAL_COMPUTED_GOTO
+    }
+#ifdef DEBUG
+    printf("DEBUG>  * Stack: ");
+    for(double_t* pVal=pStack; pVal<=pTop; pVal++) {
+        printf("%10.3e | ", *pVal);
+    }
+    printf("<< '%s'\n", evalName(pIns->op));
+#endif
+    }
+#endif
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: evalRegister
+ * ==========================
+ *  Evaluate the Parsed Function with the register code from eqRegisterCompiler
+ *  The values are copied to the start of the register frame, after which every instruction reads its operands directly from
+ *  the frame and writes its result to a frame register. Jumps continue at an index into the register code.
+ */
+
+template<bool isProfiled>
+bool Program::evalRegister(const double_t* pValues, size_t nValues, double_t* pReturn, scratch& sWork, opstats* pOps) const {
+
+    const rinstr* pBegin = m_RegCode.data();
+    const rinstr* pCode  = pBegin;
+    const rinstr* pIns   = pCode;
+    double_t*     pFrame = sWork.frame.data();
+    uint64_t      nTick  = isProfiled ? readCycles() : 0;
+
+    memcpy(pFrame, pValues, nValues*sizeof(double_t));
+
+#define R(n) pFrame[pIns->arg[n]]
+#define D    pFrame[pIns->dst]
+
+#ifdef EVAL_COMPUTED_GOTO
+    static const void* aJump[EVAL_COUNT] = {
+        &&L_EVAL_NONE,        &&L_EVAL_NONE,        &&L_EVAL_NONE,        &&L_EVAL_NONE,
+        &&L_EVAL_NONE,        &&L_EVAL_UNARY_MINUS, &&L_EVAL_MATH_PLUS,   &&L_EVAL_MATH_MINUS,
+        &&L_EVAL_MATH_MULT,   &&L_EVAL_MATH_DIV,    &&L_EVAL_MATH_POW,    &&L_EVAL_LOGICAL_AND,
+        &&L_EVAL_LOGICAL_OR,  &&L_EVAL_LOGICAL_EQ,  &&L_EVAL_LOGICAL_NE,  &&L_EVAL_LOGICAL_LT,
+        &&L_EVAL_LOGICAL_GT,  &&L_EVAL_LOGICAL_LE,  &&L_EVAL_LOGICAL_GE,  &&L_EVAL_FUNC_SIN,
+        &&L_EVAL_FUNC_COS,    &&L_EVAL_FUNC_TAN,    &&L_EVAL_FUNC_ASIN,   &&L_EVAL_FUNC_ACOS,
+        &&L_EVAL_FUNC_ATAN,   &&L_EVAL_FUNC_ATAN2,  &&L_EVAL_FUNC_EXP,    &&L_EVAL_FUNC_LOG,
+        &&L_EVAL_FUNC_ABS,    &&L_EVAL_FUNC_MOD,    &&L_EVAL_SPECIAL_IF,  &&L_EVAL_END,
+        &&L_EVAL_NONE,        &&L_EVAL_NONE,        &&L_EVAL_NONE,        &&L_EVAL_JUMP_IF,
+        &&L_EVAL_JUMP,        &&L_EVAL_JUMP_AND,    &&L_EVAL_JUMP_OR,     &&L_EVAL_MOVE,
+        &&L_EVAL_MULADD,      &&L_EVAL_MULSUB,      &&L_EVAL_NMULADD,     &&L_EVAL_SELECT_EQ,
+        &&L_EVAL_SELECT_NE,   &&L_EVAL_SELECT_LT,   &&L_EVAL_SELECT_GT,   &&L_EVAL_SELECT_LE,
+        &&L_EVAL_SELECT_GE,
+    };
+    OP_FIRST;
+#else
+    for(;;) {
+    pIns = pCode++;
+    switch(pIns->op) {
+#endif
+
+    OP_CASE(EVAL_MOVE)
+        D = R(0);
+        OP_NEXT;
+    OP_CASE(EVAL_UNARY_MINUS)
+        D = -R(0);
+        OP_NEXT;
+    OP_CASE(EVAL_MATH_PLUS)
+        D = R(0) + R(1);
+        OP_NEXT;
+    OP_CASE(EVAL_MATH_MINUS)
+        D = R(0) - R(1);
+        OP_NEXT;
+    OP_CASE(EVAL_MATH_MULT)
+        D = R(0) * R(1);
+        OP_NEXT;
+    OP_CASE(EVAL_MATH_DIV)
+        D = R(0) / R(1);
+        OP_NEXT;
+    OP_CASE(EVAL_MATH_POW)
+        D = pow(R(0), R(1));
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_AND)
+        D = (R(0) && R(1)) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_OR)
+        D = (R(0) || R(1)) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_EQ)
+        D = (R(0) == R(1)) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_NE)
+        D = (R(0) != R(1)) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_LT)
+        D = (R(0) <  R(1)) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_GT)
+        D = (R(0) >  R(1)) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_LE)
+        D = (R(0) <= R(1)) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_LOGICAL_GE)
+        D = (R(0) >= R(1)) ? EVAL_TRUE : EVAL_FALSE;
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_SIN)
+        D = sin(R(0));
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_COS)
+        D = cos(R(0));
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_TAN)
+        D = tan(R(0));
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_ASIN)
+        D = asin(R(0));
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_ACOS)
+        D = acos(R(0));
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_ATAN)
+        D = atan(R(0));
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_ATAN2)
+        D = atan2(R(0), R(1));
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_EXP)
+        D = exp(R(0));
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_LOG)
+        D = log(R(0));
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_ABS)
+        D = abs(R(0));
+        OP_NEXT;
+    OP_CASE(EVAL_FUNC_MOD)
+        if(R(0) != floor(R(0)) || R(1) != floor(R(1))) {
+            printf("Math Eval Error: Function mod() requires integer values\n");
+            return false;
+        }
+        D = (int)floor(R(0))%(int)floor(R(1));
+        OP_NEXT;
+    OP_CASE(EVAL_SPECIAL_IF)
+        D = (R(0) != EVAL_FALSE) ? R(1) : R(2);
+        OP_NEXT;
+    OP_CASE(EVAL_MULADD)
+        D = R(0) * R(1) + R(2);
+        OP_NEXT;
+    OP_CASE(EVAL_MULSUB)
+        D = R(0) * R(1) - R(2);
+        OP_NEXT;
+    OP_CASE(EVAL_NMULADD)
+        D = R(2) - R(0) * R(1);
+        OP_NEXT;
+    OP_CASE(EVAL_SELECT_EQ)
+        D = (R(0) == R(1)) ? R(2) : R(3);
+        OP_NEXT;
+    OP_CASE(EVAL_SELECT_NE)
+        D = (R(0) != R(1)) ? R(2) : R(3);
+        OP_NEXT;
+    OP_CASE(EVAL_SELECT_LT)
+        D = (R(0) <  R(1)) ? R(2) : R(3);
+        OP_NEXT;
+    OP_CASE(EVAL_SELECT_GT)
+        D = (R(0) >  R(1)) ? R(2) : R(3);
+        OP_NEXT;
+    OP_CASE(EVAL_SELECT_LE)
+        D = (R(0) <= R(1)) ? R(2) : R(3);
+        OP_NEXT;
+    OP_CASE(EVAL_SELECT_GE)
+        D = (R(0) >= R(1)) ? R(2) : R(3);
+        OP_NEXT;
+    OP_CASE(EVAL_JUMP_IF)
+        if(R(0) == EVAL_FALSE) pCode = pBegin + pIns->arg[1];
+        OP_NEXT;
+    OP_CASE(EVAL_JUMP)
+        pCode = pBegin + pIns->arg[0];
+        OP_NEXT;
+    OP_CASE(EVAL_JUMP_AND)
+        if(R(0) == EVAL_FALSE) {
+            D = EVAL_FALSE;
+            pCode = pBegin + pIns->arg[1];
+        }
+        OP_NEXT;
+    OP_CASE(EVAL_JUMP_OR)
+        if(R(0) != EVAL_FALSE) {
+            D = EVAL_TRUE;
+            pCode = pBegin + pIns->arg[1];
+        }
+        OP_NEXT;
+    OP_CASE(EVAL_END)
+        *pReturn = pFrame[m_RegResult];
+        return true;
+#ifdef EVAL_COMPUTED_GOTO
+    L_EVAL_NONE:
+#else
+    default:
+#endif
+        printf("Math Eval Error: Unknown register instruction %d\n", (int)pIns->op);
+        return false;
+
+#ifndef EVAL_COMPUTED_GOTO
+    }
+    }
+#endif
+
+#undef R
+#undef D
+}
+
+#undef OP_CASE
+#undef OP_FIRST
+#undef OP_NEXT
+#undef OP_TICK
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: evalIncremental
+ * =============================
+ *  Evaluate the Parsed Function with the code from Math::eqIncremental, keeping the value of every subexpression in the
+ *  cache of sWork. The first call runs all of the code. After that, only the variables whose values differ from the last
+ *  call are written, and the instructions that depend on any of them are rerun in program order by merging their lists.
+ *  When more than EVAL_INC_MERGE variables change, all of the code is run again. sWork keeps a frame for each of the last
+ *  EVAL_INC_FRAMES programs it evaluated with this backend, so equations evaluated in turn each keep their own values.
+ *  Returns false without an error if mod() gets a value that is not an integer, so that Eval can run the stack interpreter,
+ *  which only reports the error if the mod() is on a branch that is taken.
+ */
+
+static inline bool evalNode(const rinstr& riIns, double_t* pFrame) {
+
+#define R(n) pFrame[riIns.arg[n]]
+#define D    pFrame[riIns.dst]
+
+    switch(riIns.op) {
+    case EVAL_UNARY_MINUS: D = -R(0);                                      break;
+    case EVAL_MATH_PLUS:   D = R(0) + R(1);                                break;
+    case EVAL_MATH_MINUS:  D = R(0) - R(1);                                break;
+    case EVAL_MATH_MULT:   D = R(0) * R(1);                                break;
+    case EVAL_MATH_DIV:    D = R(0) / R(1);                                break;
+    case EVAL_MATH_POW:    D = pow(R(0), R(1));                            break;
+    case EVAL_LOGICAL_AND: D = (R(0) && R(1)) ? EVAL_TRUE : EVAL_FALSE;    break;
+    case EVAL_LOGICAL_OR:  D = (R(0) || R(1)) ? EVAL_TRUE : EVAL_FALSE;    break;
+    case EVAL_LOGICAL_EQ:  D = (R(0) == R(1)) ? EVAL_TRUE : EVAL_FALSE;    break;
+    case EVAL_LOGICAL_NE:  D = (R(0) != R(1)) ? EVAL_TRUE : EVAL_FALSE;    break;
+    case EVAL_LOGICAL_LT:  D = (R(0) <  R(1)) ? EVAL_TRUE : EVAL_FALSE;    break;
+    case EVAL_LOGICAL_GT:  D = (R(0) >  R(1)) ? EVAL_TRUE : EVAL_FALSE;    break;
+    case EVAL_LOGICAL_LE:  D = (R(0) <= R(1)) ? EVAL_TRUE : EVAL_FALSE;    break;
+    case EVAL_LOGICAL_GE:  D = (R(0) >= R(1)) ? EVAL_TRUE : EVAL_FALSE;    break;
+    case EVAL_FUNC_SIN:    D = sin(R(0));                                  break;
+    case EVAL_FUNC_COS:    D = cos(R(0));                                  break;
+    case EVAL_FUNC_TAN:    D = tan(R(0));                                  break;
+    case EVAL_FUNC_ASIN:   D = asin(R(0));                                 break;
+    case EVAL_FUNC_ACOS:   D = acos(R(0));                                 break;
+    case EVAL_FUNC_ATAN:   D = atan(R(0));                                 break;
+    case EVAL_FUNC_ATAN2:  D = atan2(R(0), R(1));                          break;
+    case EVAL_FUNC_EXP:    D = exp(R(0));                                  break;
+    case EVAL_FUNC_LOG:    D = log(R(0));                                  break;
+    case EVAL_FUNC_ABS:    D = abs(R(0));                                  break;
+    case EVAL_FUNC_MOD:
+        if(R(0) != floor(R(0)) || R(1) != floor(R(1))) return false;
+        D = (int)floor(R(0))%(int)floor(R(1));
+        break;
+    case EVAL_SPECIAL_IF:  D = (R(0) != EVAL_FALSE) ? R(1) : R(2);         break;
+    default:
+        return false;
+    }
+
+#undef R
+#undef D
+
+    return true;
+}
+
+bool Program::evalIncremental(const double_t* pValues, size_t nValues, double_t* pReturn, scratch& sWork) const {
+
+    const inccode& icCode  = *m_Inc;
+    const rinstr*  pCode   = icCode.code.data();
+    incframe&      ifFrame = incFrame(sWork);
+    double_t*      pFrame  = ifFrame.values.data();
+
+    uint32_t aChanged[EVAL_INC_MERGE];
+    size_t   nChanged = 0;
+    bool     isFull   = !ifFrame.valid;
+
+    if(isFull) {
+        copy(icCode.consts.begin(), icCode.consts.end(), pFrame + nValues);
+    } else {
+        for(size_t v=0; v<nValues; v++) {
+            if(memcmp(pFrame + v, pValues + v, sizeof(double_t)) == 0) continue;
+            if(nChanged == EVAL_INC_MERGE) {
+                isFull = true;
+                break;
+            }
+            aChanged[nChanged++] = (uint32_t)v;
+        }
+    }
+    ifFrame.valid = false;
+
+    if(isFull) {
+        memcpy(pFrame, pValues, nValues*sizeof(double_t));
+        for(size_t i=0; i<icCode.code.size(); i++) {
+            if(!evalNode(pCode[i], pFrame)) return false;
+        }
+    } else {
+        // The instructions to rerun are the union of the sorted lists of the changed variables
+        const uint32_t* aPos[EVAL_INC_MERGE];
+        const uint32_t* aEnd[EVAL_INC_MERGE];
+        const uint32_t* pDeps = icCode.deps.data();
+        for(size_t k=0; k<nChanged; k++) {
+            uint32_t v = aChanged[k];
+            pFrame[v] = pValues[v];
+            aPos[k] = pDeps + icCode.first[v];
+            aEnd[k] = pDeps + icCode.first[v+1];
+        }
+        for(;;) {
+            uint32_t iNext = UINT32_MAX;
+            for(size_t k=0; k<nChanged; k++) {
+                if(aPos[k] < aEnd[k] && *aPos[k] < iNext) iNext = *aPos[k];
+            }
+            if(iNext == UINT32_MAX) break;
+            for(size_t k=0; k<nChanged; k++) {
+                if(aPos[k] < aEnd[k] && *aPos[k] == iNext) aPos[k]++;
+            }
+            if(!evalNode(pCode[iNext], pFrame)) return false;
+        }
+    }
+
+    ifFrame.valid = true;
+    *pReturn = pFrame[icCode.result];
+
+    return true;
+}
+
+// Returns the incremental frame of this program in sWork, moved to the front of the list. A program without one takes over
+// the frame used least recently once there are EVAL_INC_FRAMES of them.
+incframe& Program::incFrame(scratch& sWork) const {
+
+    vector<incframe>& vfFrames = sWork.caches;
+
+    size_t iFrame = 0;
+    while(iFrame < vfFrames.size() && vfFrames[iFrame].program != m_Id) iFrame++;
+
+    if(iFrame == vfFrames.size()) {
+        if(vfFrames.size() < EVAL_INC_FRAMES) {
+            vfFrames.reserve(EVAL_INC_FRAMES);
+            vfFrames.emplace_back();
+        }
+        iFrame = vfFrames.size() - 1;
+        vfFrames[iFrame].program = m_Id;
+        vfFrames[iFrame].valid   = false;
+    }
+    if(iFrame > 0) rotate(vfFrames.begin(), vfFrames.begin() + iFrame, vfFrames.begin() + iFrame + 1);
+
+    incframe& ifFrame = vfFrames.front();
+    if(ifFrame.values.size() < m_Inc->frame) ifFrame.values.resize(m_Inc->frame);
+
+    return ifFrame;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: evalTiles
+ * =======================
+ *  The tile interpreter behind EvalBatch, for double or float columns. Runs the SIMD kernel for T when one was selected,
+ *  otherwise the RPN program is executed once per tile of m_Tile rows, with each stack entry holding a full tile.
+ *  A jump is only taken when it would be taken for every row of the tile. Otherwise both branches are evaluated, and the
+ *  joining operator combines them row by row as it would without jumps.
+ *  With pOps given, the interpreter is always used, and each instruction is counted once per row of the tiles it ran on.
+ *  pCode is the program to run, which is m_Code or an operand program of the filter plan.
+ */
+
+template<typename T>
+static inline size_t countFalse(const T* pVal, size_t nBlock) {
+    size_t nFalse = 0;
+    for(size_t i=0; i<nBlock; i++) nFalse += pVal[i] == (T)EVAL_FALSE;
+    return nFalse;
+}
+
+#ifdef SIMD_KERNELS
+static inline simdkernel_t  pickKernel(const double_t*) { return simdKernel(); }
+static inline simdkernelf_t pickKernel(const float*)    { return simdKernelF(); }
+#endif
+
+template<typename T>
+bool Program::evalTiles(const T* pConst, const T* const* ppColumns, size_t nRows, T* const* ppOutputs, size_t nStride,
+                        T* pStack, T* pTemp, opstats* pOps, const instr* pCode) const {
+
+    size_t nTile = m_Tile;
+
+#ifdef SIMD_KERNELS
+    auto pKernel = pickKernel(pConst);
+    if(pKernel != nullptr && pOps == nullptr) {
+        return pKernel(pCode, pConst, ppColumns, nRows, nStride, ppOutputs, nTile, pStack, pTemp);
+    }
+#endif
+
+    for(size_t iRow=0; iRow<nRows; iRow+=nTile) {
+
+        size_t nBlock = min(nTile, nRows-iRow);
+        T*     pTop   = pStack - nTile;
+        T*     pL;
+        T*     pC;
+
+        const instr* pPrev = nullptr;
+        uint64_t     nTick = pOps ? readCycles() : 0;
+
+        for(size_t iIns=0; pCode[iIns].op != EVAL_END; iIns++) {
+
+            const instr& iOp = pCode[iIns];
+
+            if(pOps) {
+                uint64_t nNow = readCycles();
+                if(pPrev) {
+                    pOps[pPrev->op].count  += nBlock;
+                    pOps[pPrev->op].cycles += nNow - nTick;
+                }
+                pPrev = &iOp;
+                nTick = nNow;
+            }
+
+            if(iOp.size == 0) {
+                pTop += nTile;
+                if(iOp.op == EVAL_NUMBER) {
+                    T tVal = pConst[iOp.arg];
+                    for(size_t i=0; i<nBlock; i++) pTop[i] = tVal;
+                } else
+                if(iOp.op == EVAL_LOAD) {
+                    const T* pVal = pTemp + iOp.arg*nTile;
+                    for(size_t i=0; i<nBlock; i++) pTop[i] = pVal[i];
+                } else {
+                    const T* pCol = ppColumns[iOp.arg] + iRow*nStride;
+                    for(size_t i=0; i<nBlock; i++) pTop[i] = pCol[i*nStride];
+                }
+                continue;
+            }
+
+            // Operands are consumed in place, the result replaces the left-most one
+            pTop -= (iOp.size-1)*nTile;
+            pL    = pTop + nTile;
+            pC    = pTop + 2*nTile;
+
+            switch(iOp.op) {
+            case EVAL_UNARY_PLUS:
+                break;
+            case EVAL_STORE:
+                for(size_t i=0; i<nBlock; i++) pTemp[iOp.arg*nTile+i] = pTop[i];
+                break;
+            case EVAL_OUTPUT:
+                for(size_t i=0; i<nBlock; i++) ppOutputs[iOp.arg][iRow+i] = pTop[i];
+                pTop -= nTile;
+                break;
+            case EVAL_UNARY_MINUS:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = -pTop[i];
+                break;
+            case EVAL_FUNC_SIN:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = sin(pTop[i]);
+                break;
+            case EVAL_FUNC_COS:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = cos(pTop[i]);
+                break;
+            case EVAL_FUNC_TAN:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = tan(pTop[i]);
+                break;
+            case EVAL_FUNC_ASIN:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = asin(pTop[i]);
+                break;
+            case EVAL_FUNC_ACOS:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = acos(pTop[i]);
+                break;
+            case EVAL_FUNC_ATAN:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = atan(pTop[i]);
+                break;
+            case EVAL_FUNC_EXP:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = exp(pTop[i]);
+                break;
+            case EVAL_FUNC_LOG:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = log(pTop[i]);
+                break;
+            case EVAL_FUNC_ABS:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = abs(pTop[i]);
+                break;
+            case EVAL_MATH_PLUS:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = pTop[i] + pL[i];
+                break;
+            case EVAL_MATH_MINUS:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = pTop[i] - pL[i];
+                break;
+            case EVAL_MATH_MULT:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = pTop[i] * pL[i];
+                break;
+            case EVAL_MATH_DIV:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = pTop[i] / pL[i];
+                break;
+            case EVAL_MATH_POW:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = pow(pTop[i],pL[i]);
+                break;
+            case EVAL_FUNC_ATAN2:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = atan2(pTop[i],pL[i]);
+                break;
+            case EVAL_FUNC_MOD:
+                for(size_t i=0; i<nBlock; i++) {
+                    if(pTop[i] == floor(pTop[i]) && pL[i] == floor(pL[i])) {
+                        pTop[i] = (int)floor(pTop[i])%(int)floor(pL[i]);
+                    } else {
+                        printf("Math Eval Error: Function mod() requires integer values\n");
+                        return false;
+                    }
+                }
+                break;
+            case EVAL_LOGICAL_AND:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = (pTop[i] && pL[i]) ? EVAL_TRUE : EVAL_FALSE;
+                break;
+            case EVAL_LOGICAL_OR:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = (pTop[i] || pL[i]) ? EVAL_TRUE : EVAL_FALSE;
+                break;
+            case EVAL_LOGICAL_EQ:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = (pTop[i] == pL[i]) ? EVAL_TRUE : EVAL_FALSE;
+                break;
+            case EVAL_LOGICAL_NE:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = (pTop[i] != pL[i]) ? EVAL_TRUE : EVAL_FALSE;
+                break;
+            case EVAL_LOGICAL_LT:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = (pTop[i] <  pL[i]) ? EVAL_TRUE : EVAL_FALSE;
+                break;
+            case EVAL_LOGICAL_GT:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = (pTop[i] >  pL[i]) ? EVAL_TRUE : EVAL_FALSE;
+                break;
+            case EVAL_LOGICAL_LE:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = (pTop[i] <= pL[i]) ? EVAL_TRUE : EVAL_FALSE;
+                break;
+            case EVAL_LOGICAL_GE:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = (pTop[i] >= pL[i]) ? EVAL_TRUE : EVAL_FALSE;
+                break;
+            case EVAL_SPECIAL_IF:
+                for(size_t i=0; i<nBlock; i++) pTop[i] = (pTop[i] != EVAL_FALSE) ? pL[i] : pC[i];
+                break;
+            case EVAL_JUMP_IF:
+                if(countFalse(pTop, nBlock) == nBlock) {
+                    pTop += nTile;
+                    iIns  = iOp.arg-1;
+                }
+                break;
+            case EVAL_JUMP:
+                pC = pTop - nTile;
+                if(countFalse(pC, nBlock) == 0) {
+                    for(size_t i=0; i<nBlock; i++) pC[i] = pTop[i];
+                    pTop = pC;
+                    iIns = iOp.arg-1;
+                }
+                break;
+            case EVAL_JUMP_AND:
+                if(countFalse(pTop, nBlock) == nBlock) {
+                    for(size_t i=0; i<nBlock; i++) pTop[i] = EVAL_FALSE;
+                    iIns = iOp.arg-1;
+                }
+                break;
+            case EVAL_JUMP_OR:
+                if(countFalse(pTop, nBlock) == 0) {
+                    for(size_t i=0; i<nBlock; i++) pTop[i] = EVAL_TRUE;
+                    iIns = iOp.arg-1;
+                }
+                break;
+            default:
+                printf("Math Eval Error: Unknown instruction %d '%s'\n", iOp.op, evalName(iOp.op));
+                return false;
+            }
+        }
+
+        if(pPrev) {
+            pOps[pPrev->op].count  += nBlock;
+            pOps[pPrev->op].cycles += readCycles() - nTick;
+        }
+
+        if(pTop == pStack) {
+            for(size_t i=0; i<nBlock; i++) ppOutputs[0][iRow+i] = pStack[i];
+        }
+    }
+
+    return true;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: EvalBatch
+ * =====================
+ *  Evaluate the Parsed Function on columns of values
+ *  Takes one column pointer per variable, in the order of the variables vector, the number of rows, and an output buffer of
+ *  at least nRows values. nStride is the distance between consecutive rows in the input columns.
+ */
+
+bool Program::EvalBatch(const double_t* const* ppColumns, size_t nRows, double_t* pOutput, size_t nStride,
+                        scratch& sWork) const {
+
+    if(m_Outputs > 1) {
+        printf("Math Eval Error: An equation set needs one output column per equation\n");
+        return false;
+    }
+
+    return EvalBatch(ppColumns, nRows, &pOutput, nStride, sWork);
+}
+
+/**
+ *  Method :: EvalBatch
+ * =====================
+ *  Evaluate the Parsed Function on columns of values, writing to the output columns in ppOutputs
+ *  An equation set writes one column per equation, a single equation writes only the first.
+ *  The RPN program is executed once per tile of m_Tile rows, with each stack entry holding a full tile. With the MB_JIT
+ *  backend the tile is copied to a contiguous buffer and run through the packed native code, four rows at a time, unless
+ *  instructions are being profiled. The tile buffers are taken from sWork.
+ */
+
+bool Program::EvalBatch(const double_t* const* ppColumns, size_t nRows, double_t* const* ppOutputs, size_t nStride,
+                        scratch& sWork) const {
+
+    if(m_Variables.size() > 0 && ppColumns == nullptr) {
+        printf("Math Eval Error: No value columns given\n");
+        return false;
+    }
+    if(ppOutputs == nullptr) {
+        printf("Math Eval Error: No output columns given\n");
+        return false;
+    }
+
+    if(sWork.program != m_Id) Prepare(sWork);
+
+    profileScope psScope(this, nRows, s_Profiling.load(memory_order_relaxed));
+
+    return evalRows(ppColumns, nRows, ppOutputs, nStride, sWork, psScope.ops());
+}
+
+// Runs the packed native code or the tile interpreter on sWork, which must be prepared for this program
+bool Program::evalRows(const double_t* const* ppColumns, size_t nRows, double_t* const* ppOutputs, size_t nStride,
+                       scratch& sWork, opstats* pOps) const {
+
+    double_t* pStack = sWork.block.data();
+    double_t* pTemp  = pStack + m_StackSize*m_Tile;
+
+#ifdef JIT_BACKEND
+    if(m_Jit && m_Jit->packedFunction() != nullptr && pOps == nullptr) {
+        jitpacked_t pPacked = m_Jit->packedFunction();
+        size_t      nVars   = m_Variables.size();
+        double_t*   pBlock  = pTemp + m_TempSize*EVAL_BLOCK;
+        double_t*   pOut    = pBlock + nVars*EVAL_BLOCK;
+
+        for(size_t iRow=0; iRow<nRows; iRow+=EVAL_BLOCK) {
+            size_t nBlock = min((size_t)EVAL_BLOCK, nRows-iRow);
+            size_t nVec   = (nBlock+3)/4;
+            for(size_t v=0; v<nVars; v++) {
+                const double_t* pCol = ppColumns[v] + iRow*nStride;
+                double_t*       pVal = pBlock + v*EVAL_BLOCK;
+                for(size_t i=0; i<nBlock; i++) pVal[i] = pCol[i*nStride];
+                for(size_t i=nBlock; i<4*nVec; i++) pVal[i] = 0.0;
+            }
+            pPacked(pBlock, pOut, nVec);
+            memcpy(ppOutputs[0] + iRow, pOut, nBlock*sizeof(double_t));
+        }
+
+        return true;
+    }
+#endif
+
+    return evalTiles(m_Consts.data(), ppColumns, nRows, ppOutputs, nStride, pStack, pTemp, pOps, m_Code.data());
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: EvalReduce
+ * ======================
+ *  Folds the results of rows iFirst to iFirst+nRows-1 of the columns into pReduce, without an output column. Each tile of
+ *  EVAL_BLOCK rows is evaluated like EvalBatch into sWork.tile, which stays in cache, and folded from there. Row i of the
+ *  call goes to lane i % EVAL_RED_LANES, each lane with its own Kahan sum, so the lanes are independent and can be vectorised.
+ *  The lanes are merged into pReduce in order at the end, so the result only depends on how the rows were split into calls.
+ *  RD_MIN and RD_MAX give NaN if any result is NaN, and RD_COUNT counts the rows with a result other than EVAL_FALSE.
+ */
+
+static inline double_t reduceMin(double_t dA, double_t dB) {
+    return (dB < dA || dB != dB) ? dB : dA;
+}
+
+static inline double_t reduceMax(double_t dA, double_t dB) {
+    return (dB > dA || dB != dB) ? dB : dA;
+}
+
+bool Program::EvalReduce(const double_t* const* ppColumns, size_t iFirst, size_t nRows, size_t nStride, value_t idReduce,
+                         reduction* pReduce, scratch& sWork) const {
+
+    if(idReduce < RD_SUM || idReduce > RD_COUNT) {
+        printf("Math Eval Error: Unknown reduction %d\n", idReduce);
+        return false;
+    }
+    if(m_Outputs > 1) {
+        printf("Math Eval Error: An equation set cannot be reduced to one value\n");
+        return false;
+    }
+    if(m_Variables.size() > 0 && ppColumns == nullptr) {
+        printf("Math Eval Error: No value columns given\n");
+        return false;
+    }
+
+    if(sWork.program != m_Id) Prepare(sWork);
+
+    profileScope psScope(this, nRows, s_Profiling.load(memory_order_relaxed));
+
+    size_t           nVars = m_Variables.size();
+    double_t*        pTile = sWork.tile.data();
+    const double_t** pCols = sWork.columns.data();
+
+    double_t aSum[EVAL_RED_LANES]   = {0.0};
+    double_t aComp[EVAL_RED_LANES]  = {0.0};
+    double_t aPlain[EVAL_RED_LANES] = {0.0};
+    double_t aValue[EVAL_RED_LANES];
+    uint64_t aCount[EVAL_RED_LANES] = {0};
+    for(size_t l=0; l<EVAL_RED_LANES; l++) aValue[l] = idReduce == RD_MIN ? INFINITY : -INFINITY;
+
+    for(size_t iRow=0; iRow<nRows; iRow+=EVAL_BLOCK) {
+
+        size_t nBlock = min((size_t)EVAL_BLOCK, nRows-iRow);
+        for(size_t v=0; v<nVars; v++) pCols[v] = ppColumns[v] + (iFirst+iRow)*nStride;
+        if(!evalRows(pCols, nBlock, &pTile, nStride, sWork, psScope.ops())) return false;
+
+        // EVAL_BLOCK is a whole number of lanes, so row i of the tile is in lane i % EVAL_RED_LANES of the call as well
+        size_t nFull = nBlock/EVAL_RED_LANES*EVAL_RED_LANES;
+        switch(idReduce) {
+        case RD_SUM:
+        case RD_MEAN:
+            for(size_t i=0; i<nFull; i+=EVAL_RED_LANES) {
+                for(size_t l=0; l<EVAL_RED_LANES; l++) {
+                    aPlain[l] += pTile[i+l];
+                    double_t dY = pTile[i+l] - aComp[l];
+                    double_t dT = aSum[l] + dY;
+                    aComp[l] = (dT - aSum[l]) - dY;
+                    aSum[l]  = dT;
+                }
+            }
+            for(size_t i=nFull; i<nBlock; i++) {
+                size_t   l  = i - nFull;
+                aPlain[l] += pTile[i];
+                double_t dY = pTile[i] - aComp[l];
+                double_t dT = aSum[l] + dY;
+                aComp[l] = (dT - aSum[l]) - dY;
+                aSum[l]  = dT;
+            }
+            break;
+        case RD_MIN:
+            for(size_t i=0; i<nBlock; i++) aValue[i % EVAL_RED_LANES] = reduceMin(aValue[i % EVAL_RED_LANES], pTile[i]);
+            break;
+        case RD_MAX:
+            for(size_t i=0; i<nBlock; i++) aValue[i % EVAL_RED_LANES] = reduceMax(aValue[i % EVAL_RED_LANES], pTile[i]);
+            break;
+        case RD_COUNT:
+            for(size_t i=0; i<nBlock; i++) aCount[i % EVAL_RED_LANES] += pTile[i] != EVAL_FALSE;
+            break;
+        }
+    }
+
+    // Kahan's compensation is the error still to be subtracted from the sum. It is NaN once the sum is infinite, which the
+    // plain sum of the lane shows.
+    for(size_t l=0; l<EVAL_RED_LANES && l<nRows; l++) {
+        size_t    nLane  = (nRows - l + EVAL_RED_LANES - 1)/EVAL_RED_LANES;
+        reduction rdLane = {aSum[l], -aComp[l], aValue[l], nLane, aCount[l]};
+        if(!isfinite(aPlain[l])) {
+            rdLane.sum  = aPlain[l];
+            rdLane.comp = 0.0;
+        }
+        reduceMerge(pReduce, rdLane, idReduce);
+    }
+
+    return true;
+}
+
+/**
+ *  Function :: reduceMerge
+ * =========================
+ *  Adds the partial result rdPart to pInto. The sums are added with Neumaier's variant of Kahan summation, which keeps the
+ *  rounding error of the addition whichever of the two is larger. An infinite or NaN sum has no error to keep.
+ */
+
+void smath::reduceMerge(reduction* pInto, const reduction& rdPart, value_t idReduce) {
+
+    if(rdPart.rows == 0) return;
+
+    double_t dSum = pInto->sum + rdPart.sum;
+    if(!isfinite(dSum)) {
+        pInto->comp = 0.0;
+    } else {
+        if(abs(pInto->sum) >= abs(rdPart.sum)) {
+            pInto->comp += (pInto->sum - dSum) + rdPart.sum;
+        } else {
+            pInto->comp += (rdPart.sum - dSum) + pInto->sum;
+        }
+        pInto->comp += rdPart.comp;
+    }
+    pInto->sum = dSum;
+
+    if(pInto->rows == 0) {
+        pInto->value = rdPart.value;
+    } else
+    if(idReduce == RD_MIN) {
+        pInto->value = reduceMin(pInto->value, rdPart.value);
+    } else
+    if(idReduce == RD_MAX) {
+        pInto->value = reduceMax(pInto->value, rdPart.value);
+    }
+
+    pInto->rows  += rdPart.rows;
+    pInto->count += rdPart.count;
+}
+
+/**
+ *  Function :: reduceValue
+ * =========================
+ *  The value of a reduction over all rows merged into rdTotal. RD_MIN, RD_MAX and RD_MEAN of no rows are NaN.
+ */
+
+double_t smath::reduceValue(const reduction& rdTotal, value_t idReduce) {
+
+    switch(idReduce) {
+    case RD_SUM:
+        return rdTotal.sum + rdTotal.comp;
+    case RD_MEAN:
+        return rdTotal.rows > 0 ? (rdTotal.sum + rdTotal.comp)/(double_t)rdTotal.rows : NAN;
+    case RD_MIN:
+    case RD_MAX:
+        return rdTotal.rows > 0 ? rdTotal.value : NAN;
+    case RD_COUNT:
+        return (double_t)rdTotal.count;
+    }
+
+    return NAN;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: EvalFilter
+ * ======================
+ *  Evaluates an equation as a condition on columns of values, selecting the rows where its result is not EVAL_FALSE, as
+ *  if() would. If pBitmap is given, bit i % 64 of pBitmap[i/64] is set for each selected row i, and the bits after the last
+ *  row are cleared. If pSelection is given, the indices of the selected rows are written to it in order. pCount, if given,
+ *  is set to the number of selected rows. Either output must have room for every row.
+ *  An equation whose result is a comparison, && or || runs its filter plan from eqFilter one tile of m_Tile rows at a time.
+ *  Comparisons test their operands row by row into a mask of one bit per row, && and || combine the two top masks with a
+ *  bitwise and or or, and the right operand is skipped when the left mask already decides every row of the tile. Any other
+ *  equation is evaluated like EvalBatch, a tile at a time, and its results are packed into a mask.
+ */
+
+static inline size_t countBits(uint64_t nBits) {
+#if defined(__GNUC__)
+    return (size_t)__builtin_popcountll(nBits);
+#else
+    size_t nCount = 0;
+    for(; nBits != 0; nBits &= nBits-1) nCount++;
+    return nCount;
+#endif
+}
+
+static inline size_t lowestBit(uint64_t nBits) {
+#if defined(__GNUC__)
+    return (size_t)__builtin_ctzll(nBits);
+#else
+    size_t iBit = 0;
+    while((nBits & 1) == 0) {
+        nBits >>= 1;
+        iBit++;
+    }
+    return iBit;
+#endif
+}
+
+// Sets bit i % 64 of pMask[i/64] to fTest of row i of the two operands, for the nBlock rows of a tile. A stride of 0 repeats
+// the first value, for a constant.
+template<typename F>
+static inline void packMask(const double_t* pL, size_t nLStride, const double_t* pR, size_t nRStride, size_t nBlock,
+                            uint64_t* pMask, F fTest) {
+    for(size_t w=0; w*64<nBlock; w++) {
+        size_t   nEnd  = min((size_t)64, nBlock - w*64);
+        uint64_t nBits = 0;
+        for(size_t i=0; i<nEnd; i++) {
+            size_t iRow = w*64 + i;
+            nBits |= (uint64_t)fTest(pL[iRow*nLStride], pR[iRow*nRStride]) << i;
+        }
+        pMask[w] = nBits;
+    }
+}
+
+static void compareMask(value_t idOp, const double_t* pL, size_t nLStride, const double_t* pR, size_t nRStride,
+                        size_t nBlock, uint64_t* pMask) {
+    switch(idOp) {
+    case EVAL_LOGICAL_EQ:
+        packMask(pL, nLStride, pR, nRStride, nBlock, pMask, [](double_t a, double_t b) { return a == b; });
+        break;
+    case EVAL_LOGICAL_NE:
+        packMask(pL, nLStride, pR, nRStride, nBlock, pMask, [](double_t a, double_t b) { return a != b; });
+        break;
+    case EVAL_LOGICAL_LT:
+        packMask(pL, nLStride, pR, nRStride, nBlock, pMask, [](double_t a, double_t b) { return a <  b; });
+        break;
+    case EVAL_LOGICAL_GT:
+        packMask(pL, nLStride, pR, nRStride, nBlock, pMask, [](double_t a, double_t b) { return a >  b; });
+        break;
+    case EVAL_LOGICAL_LE:
+        packMask(pL, nLStride, pR, nRStride, nBlock, pMask, [](double_t a, double_t b) { return a <= b; });
+        break;
+    case EVAL_LOGICAL_GE:
+        packMask(pL, nLStride, pR, nRStride, nBlock, pMask, [](double_t a, double_t b) { return a >= b; });
+        break;
+    }
+}
+
+// Computes the mask of one tile of nBlock rows into pResult, with ppColumns pointing at the first row of the tile
+bool Program::filterTile(const double_t* const* ppColumns, size_t nBlock, size_t nStride, uint64_t* pResult, scratch& sWork,
+                         opstats* pOps) const {
+
+    static const double_t dFalse = EVAL_FALSE;
+
+    double_t* pLeft  = sWork.tile.data();
+    double_t* pRight = pLeft + EVAL_BLOCK;
+
+    if(!m_Filter) {
+        if(!evalRows(ppColumns, nBlock, &pLeft, nStride, sWork, pOps)) return false;
+        compareMask(EVAL_LOGICAL_NE, pLeft, 1, &dFalse, 0, nBlock, pResult);
+        return true;
+    }
+
+    double_t* pStack = sWork.block.data();
+    double_t* pTemp  = pStack + m_StackSize*m_Tile;
+    size_t    nWords = (m_Tile+63)/64;
+    size_t    nUsed  = (nBlock+63)/64;
+    uint64_t* pMasks = sWork.masks.data();
+    uint64_t* pTop   = pMasks - nWords;
+
+    // Points pVal at the values of an operand for the tile, running its operand program into pOut if it has one
+    auto loadOperand = [&](const instr& iOp, double_t* pOut, const double_t** ppVal, size_t* pStride) {
+        if(iOp.op == EVAL_NUMBER) {
+            *ppVal   = &m_Consts[iOp.arg];
+            *pStride = 0;
+            return true;
+        }
+        if(iOp.op == EVAL_VARIABLE) {
+            *ppVal   = ppColumns[iOp.arg];
+            *pStride = nStride;
+            return true;
+        }
+        *ppVal   = pOut;
+        *pStride = 1;
+        return evalTiles(m_Consts.data(), ppColumns, nBlock, &pOut, nStride, pStack, pTemp, pOps, &m_Filter->code[iOp.arg]);
+    };
+
+    const vector<filterstep>& vfSteps = m_Filter->steps;
+    for(size_t iStep=0; iStep<vfSteps.size(); iStep++) {
+
+        const filterstep& fsStep = vfSteps[iStep];
+        const double_t*   pL;
+        const double_t*   pR;
+        size_t            nLStride, nRStride;
+        bool              isTaken;
+
+        switch(fsStep.op) {
+        case EVAL_LOGICAL_AND:
+            pTop -= nWords;
+            for(size_t w=0; w<nUsed; w++) pTop[w] &= pTop[w+nWords];
+            break;
+        case EVAL_LOGICAL_OR:
+            pTop -= nWords;
+            for(size_t w=0; w<nUsed; w++) pTop[w] |= pTop[w+nWords];
+            break;
+        case EVAL_JUMP_AND:
+            isTaken = true;
+            for(size_t w=0; w<nUsed; w++) isTaken = isTaken && pTop[w] == 0;
+            if(isTaken) iStep = fsStep.target-1;
+            break;
+        case EVAL_JUMP_OR:
+            isTaken = true;
+            for(size_t w=0; w<nUsed; w++) {
+                size_t nEnd = min((size_t)64, nBlock - w*64);
+                isTaken = isTaken && pTop[w] == (nEnd == 64 ? ~(uint64_t)0 : ((uint64_t)1 << nEnd) - 1);
+            }
+            if(isTaken) iStep = fsStep.target-1;
+            break;
+        case EVAL_NONE:
+            if(!loadOperand(fsStep.left, pLeft, &pL, &nLStride)) return false;
+            pTop += nWords;
+            compareMask(EVAL_LOGICAL_NE, pL, nLStride, &dFalse, 0, nBlock, pTop);
+            break;
+        default:
+            if(!loadOperand(fsStep.left, pLeft, &pL, &nLStride))   return false;
+            if(!loadOperand(fsStep.right, pRight, &pR, &nRStride)) return false;
+            pTop += nWords;
+            compareMask(fsStep.op, pL, nLStride, pR, nRStride, nBlock, pTop);
+            break;
+        }
+    }
+
+    for(size_t w=0; w<nUsed; w++) pResult[w] = pMasks[w];
+
+    return true;
+}
+
+bool Program::EvalFilter(const double_t* const* ppColumns, size_t nRows, size_t nStride, uint64_t* pBitmap,
+                         size_t* pSelection, size_t* pCount, scratch& sWork) const {
+
+    if(m_Outputs > 1) {
+        printf("Math Eval Error: An equation set cannot be evaluated as a condition\n");
+        return false;
+    }
+    if(m_Variables.size() > 0 && ppColumns == nullptr) {
+        printf("Math Eval Error: No value columns given\n");
+        return false;
+    }
+
+    if(sWork.program != m_Id) Prepare(sWork);
+
+    profileScope psScope(this, nRows, s_Profiling.load(memory_order_relaxed));
+
+    size_t           nVars = m_Variables.size();
+    size_t           nTile = m_Filter ? m_Tile : EVAL_BLOCK;
+    const double_t** pCols = sWork.columns.data();
+    uint64_t         aMask[EVAL_BLOCK/64];
+    size_t           nSelected = 0;
+
+    // Bits of the bitmap are collected in nPending until a word is full, since a tile need not be a whole number of words
+    uint64_t nPending = 0;
+    size_t   nFill    = 0;
+
+    for(size_t iRow=0; iRow<nRows; iRow+=nTile) {
+
+        size_t nBlock = min(nTile, nRows-iRow);
+        for(size_t v=0; v<nVars; v++) pCols[v] = ppColumns[v] + iRow*nStride;
+        if(!filterTile(pCols, nBlock, nStride, aMask, sWork, psScope.ops())) return false;
+
+        for(size_t w=0; w*64<nBlock; w++) {
+            uint64_t nBits = aMask[w];
+            size_t   nLen  = min((size_t)64, nBlock - w*64);
+            nSelected += countBits(nBits);
+
+            if(pSelection) {
+                for(uint64_t nRest=nBits; nRest != 0; nRest &= nRest-1) *pSelection++ = iRow + w*64 + lowestBit(nRest);
+            }
+            if(pBitmap) {
+                nPending |= nBits << nFill;
+                if(nFill + nLen >= 64) {
+                    *pBitmap++ = nPending;
+                    nPending   = nFill > 0 ? nBits >> (64 - nFill) : 0;
+                    nFill      = nFill + nLen - 64;
+                } else {
+                    nFill += nLen;
+                }
+            }
+        }
+    }
+    if(pBitmap && nFill > 0) *pBitmap = nPending;
+    if(pCount) *pCount = nSelected;
+
+    return true;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: EvalBatch
+ * =====================
+ *  Single precision versions of the two methods above. The constants are rounded to float when the program is built, and
+ *  every operation is evaluated on float values, so a tile holds twice as many values per SIMD vector. Math functions may
+ *  be computed in double precision and rounded. The MB_JIT backend has no float code, so these always run the interpreter.
+ *  The float tile buffers are allocated in sWork the first time they are needed.
+ */
+
+bool Program::EvalBatch(const float* const* ppColumns, size_t nRows, float* pOutput, size_t nStride, scratch& sWork) const {
+
+    if(m_Outputs > 1) {
+        printf("Math Eval Error: An equation set needs one output column per equation\n");
+        return false;
+    }
+
+    return EvalBatch(ppColumns, nRows, &pOutput, nStride, sWork);
+}
+
+bool Program::EvalBatch(const float* const* ppColumns, size_t nRows, float* const* ppOutputs, size_t nStride,
+                        scratch& sWork) const {
+
+    if(m_Variables.size() > 0 && ppColumns == nullptr) {
+        printf("Math Eval Error: No value columns given\n");
+        return false;
+    }
+    if(ppOutputs == nullptr) {
+        printf("Math Eval Error: No output columns given\n");
+        return false;
+    }
+
+    size_t nBlock = (m_StackSize + m_TempSize)*m_Tile;
+    if(sWork.fblock.size() < nBlock) sWork.fblock.resize(nBlock);
+
+    profileScope psScope(this, nRows, s_Profiling.load(memory_order_relaxed));
+
+    float* pStack = sWork.fblock.data();
+    float* pTemp  = pStack + m_StackSize*m_Tile;
+
+    return evalTiles(m_ConstsF.data(), ppColumns, nRows, ppOutputs, nStride, pStack, pTemp, psScope.ops(), m_Code.data());
+}
+
+// ****************************************************************************************************************************** //
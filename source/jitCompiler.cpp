@@ -0,0 +1,598 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  JIT Compiler
+ *  Code generation for the scalar (SSE2) and packed (AVX, 4 rows per iteration) variants
+ */
+
+#include "jitCompiler.hpp"
+
+#include <cstring>
+#include <sys/mman.h>
+
+using namespace std;
+using namespace smath;
+
+// Integer registers
+#define JR_RAX   0
+#define JR_RSP   4
+#define JR_RBX   3
+#define JR_R12  12
+#define JR_R13  13
+
+// Registers available for stack levels, xmm14 and xmm15 are scratch
+#define JIT_REGS    14
+#define JIT_SCRATCH 15
+
+// Bytes per constant, spill and temporary slot, one ymm register
+#define JIT_SLOT    32
+
+// Comparison predicates for cmpsd and vcmppd
+#define JP_EQ       0x00
+#define JP_LT       0x01
+#define JP_LE       0x02
+#define JP_NE       0x04
+#define JP_LT_OQ    0x11
+#define JP_LE_OQ    0x12
+#define JP_GE_OQ    0x1d
+#define JP_GT_OQ    0x1e
+
+// Second opcode byte of jcc rel32
+#define JC_E        0x84
+#define JC_NE       0x85
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Class :: jitAssembler
+ * =======================
+ *  Emits the handful of instructions the code generator needs. Memory operands are always [base + disp32].
+ */
+
+namespace {
+
+class jitAssembler {
+
+public:
+
+    vector<uint8_t> m_Code;
+
+    void byte(uint8_t uVal) {
+        m_Code.push_back(uVal);
+    }
+
+    void bytes(std::initializer_list<uint8_t> vuVal) {
+        m_Code.insert(m_Code.end(), vuVal);
+    }
+
+    void dword(uint32_t uVal) {
+        for(int i=0; i<4; i++) byte((uint8_t)(uVal >> 8*i));
+    }
+
+    void qword(uint64_t uVal) {
+        for(int i=0; i<8; i++) byte((uint8_t)(uVal >> 8*i));
+    }
+
+    void modMem(int iReg, int iBase, int32_t iDisp) {
+        byte((uint8_t)(0x80 | (iReg & 7) << 3 | (iBase & 7)));
+        if((iBase & 7) == JR_RSP) byte(0x24);
+        dword((uint32_t)iDisp);
+    }
+
+    // Legacy SSE instruction, register to register
+    void sse(uint8_t uPre, uint8_t uOp, int iReg, int iRM) {
+        byte(uPre);
+        if(iReg > 7 || iRM > 7) byte((uint8_t)(0x40 | (iReg >> 3) << 2 | (iRM >> 3)));
+        bytes({0x0f, uOp, (uint8_t)(0xc0 | (iReg & 7) << 3 | (iRM & 7))});
+    }
+
+    // Legacy SSE instruction, register and memory
+    void sseMem(uint8_t uPre, uint8_t uOp, int iReg, int iBase, int32_t iDisp) {
+        byte(uPre);
+        if(iReg > 7 || iBase > 7) byte((uint8_t)(0x40 | (iReg >> 3) << 2 | (iBase >> 3)));
+        bytes({0x0f, uOp});
+        modMem(iReg, iBase, iDisp);
+    }
+
+    // Three byte VEX prefix, 256 bit, 66 prefix
+    void vexPrefix(uint8_t uMap, int iReg, int iSrc, int iRM) {
+        byte(0xc4);
+        byte((uint8_t)((~iReg >> 3 & 1) << 7 | 1 << 6 | (~iRM >> 3 & 1) << 5 | uMap));
+        byte((uint8_t)((~iSrc & 15) << 3 | 1 << 2 | 1));
+    }
+
+    // AVX instruction, register to register
+    void vex(uint8_t uMap, uint8_t uOp, int iReg, int iSrc, int iRM) {
+        vexPrefix(uMap, iReg, iSrc, iRM);
+        bytes({uOp, (uint8_t)(0xc0 | (iReg & 7) << 3 | (iRM & 7))});
+    }
+
+    // AVX instruction, register and memory
+    void vexMem(uint8_t uMap, uint8_t uOp, int iReg, int iSrc, int iBase, int32_t iDisp) {
+        vexPrefix(uMap, iReg, iSrc, iBase);
+        byte(uOp);
+        modMem(iReg, iBase, iDisp);
+    }
+
+    void callAbs(const void* pFunc) {
+        bytes({0x48, 0xb8});
+        qword((uint64_t)pFunc);
+        bytes({0xff, 0xd0});
+    }
+
+    // Jump with a 32 bit displacement, uCond is the second opcode byte of a jcc or 0 for jmp. Returns the position of the
+    // displacement, for patch.
+    size_t jump(uint8_t uCond) {
+        if(uCond == 0) byte(0xe9); else bytes({0x0f, uCond});
+        dword(0);
+        return m_Code.size()-4;
+    }
+
+    // Points the jump with its displacement at iDisp to the current position, or to iTarget
+    void patch(size_t iDisp) {
+        patch(iDisp, m_Code.size());
+    }
+
+    void patch(size_t iDisp, size_t iTarget) {
+        int32_t iRel = (int32_t)iTarget - (int32_t)(iDisp + 4);
+        memcpy(&m_Code[iDisp], &iRel, 4);
+    }
+
+};
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Class :: jitGenerator
+ * =======================
+ *  Generates one function from the bytecode. The scalar variant is double fn(const double* pValues), and the packed variant is
+ *  void fn(const double* pBlock, double* pOut, size_t nVec) where pBlock holds EVAL_BLOCK rows per variable and nVec groups
+ *  of four rows are computed. Constants are read from a table at the start of the executable memory, four copies per value.
+ *
+ *  Frame layout, relative to rsp: one spill slot per register, one slot per temporary, and two slots for the arguments of a
+ *  libm call made lane by lane.
+ */
+
+class jitGenerator {
+
+public:
+
+    jitGenerator(jitAssembler& jAsm, bool bPacked, size_t nConsts, size_t nTemps, int32_t iTable)
+        : m_Asm(jAsm), m_Packed(bPacked), m_Table(iTable)
+    {
+        m_One     = (int32_t)(nConsts*JIT_SLOT);
+        m_Sign    = m_One  + JIT_SLOT;
+        m_NoSign  = m_Sign + JIT_SLOT;
+        m_Temps   = JIT_REGS*JIT_SLOT;
+        m_ArgA    = m_Temps + (int32_t)(nTemps*JIT_SLOT);
+        m_ArgB    = m_ArgA + JIT_SLOT;
+        m_Frame   = m_ArgB + JIT_SLOT + 8;
+    }
+
+    bool generate(const vector<instr>&);
+
+private:
+
+    jitAssembler& m_Asm;
+    bool          m_Packed;
+    int32_t       m_Table;
+    int32_t       m_One;
+    int32_t       m_Sign;
+    int32_t       m_NoSign;
+    int32_t       m_Temps;
+    int32_t       m_ArgA;
+    int32_t       m_ArgB;
+    int32_t       m_Frame;
+
+    void move(int iDst, int iSrc) {
+        if(iDst == iSrc) return;
+        if(m_Packed) m_Asm.vex(1, 0x28, iDst, 0, iSrc); else m_Asm.sse(0x66, 0x28, iDst, iSrc);
+    }
+
+    void load(int iDst, int iBase, int32_t iDisp) {
+        if(m_Packed) m_Asm.vexMem(1, 0x10, iDst, 0, iBase, iDisp); else m_Asm.sseMem(0xf2, 0x10, iDst, iBase, iDisp);
+    }
+
+    void store(int iSrc, int iBase, int32_t iDisp) {
+        if(m_Packed) m_Asm.vexMem(1, 0x11, iSrc, 0, iBase, iDisp); else m_Asm.sseMem(0xf2, 0x11, iSrc, iBase, iDisp);
+    }
+
+    // Arithmetic, iDst = iDst op iSrc, with the scalar or packed double form of the opcode
+    void arith(uint8_t uOp, int iDst, int iSrc) {
+        if(m_Packed) m_Asm.vex(1, uOp, iDst, iDst, iSrc); else m_Asm.sse(0xf2, uOp, iDst, iSrc);
+    }
+
+    // Bitwise, iDst = iDst op iSrc
+    void logic(uint8_t uOp, int iDst, int iSrc) {
+        if(m_Packed) m_Asm.vex(1, uOp, iDst, iDst, iSrc); else m_Asm.sse(0x66, uOp, iDst, iSrc);
+    }
+
+    // Bitwise with a table constant, iDst = iDst op [table + iDisp]
+    void logicTable(uint8_t uOp, int iDst, int32_t iDisp) {
+        if(m_Packed) m_Asm.vexMem(1, uOp, iDst, iDst, JR_R12, iDisp); else m_Asm.sseMem(0x66, uOp, iDst, JR_R12, iDisp);
+    }
+
+    // Compare, iDst = iDst pred iSrc as an all ones or all zeros mask
+    void compare(int iDst, int iSrc, uint8_t uPred) {
+        if(m_Packed) m_Asm.vex(1, 0xc2, iDst, iDst, iSrc); else m_Asm.sse(0xf2, 0xc2, iDst, iSrc);
+        m_Asm.byte(uPred);
+    }
+
+    void zeroScratch() {
+        logic(0x57, JIT_SCRATCH, JIT_SCRATCH);
+    }
+
+    void emitCall(const void*, int, int);
+    void emitCompare(value_t, int, int);
+    void emitFalseMask(int);
+
+};
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: emitCall
+ * ======================
+ *  Calls a libm function on the nArgs registers starting at iFirst and leaves the result in iFirst. The registers below iFirst
+ *  are live across the call and are saved to their spill slots, as the System V ABI has no callee saved xmm registers.
+ *  The packed variant calls the function once per lane.
+ */
+
+void jitGenerator::emitCall(const void* pFunc, int iFirst, int nArgs) {
+
+    for(int i=0; i<iFirst; i++) store(i, JR_RSP, i*JIT_SLOT);
+
+    if(m_Packed) {
+        store(iFirst, JR_RSP, m_ArgA);
+        if(nArgs > 1) store(iFirst+1, JR_RSP, m_ArgB);
+        m_Asm.bytes({0xc5, 0xf8, 0x77}); // vzeroupper
+        for(int k=0; k<4; k++) {
+            m_Asm.sseMem(0xf2, 0x10, 0, JR_RSP, m_ArgA + 8*k);
+            if(nArgs > 1) m_Asm.sseMem(0xf2, 0x10, 1, JR_RSP, m_ArgB + 8*k);
+            m_Asm.callAbs(pFunc);
+            m_Asm.sseMem(0xf2, 0x11, 0, JR_RSP, m_ArgA + 8*k);
+        }
+        load(iFirst, JR_RSP, m_ArgA);
+    } else {
+        move(0, iFirst);
+        if(nArgs > 1) move(1, iFirst+1);
+        m_Asm.callAbs(pFunc);
+        move(iFirst, 0);
+    }
+
+    for(int i=0; i<iFirst; i++) load(i, JR_RSP, i*JIT_SLOT);
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: emitCompare
+ * =========================
+ *  Leaves EVAL_TRUE or EVAL_FALSE in iA. Scalar SSE2 has no greater than predicate, so those compare with swapped operands.
+ */
+
+void jitGenerator::emitCompare(value_t idEval, int iA, int iB) {
+
+    if(m_Packed) {
+        switch(idEval) {
+            case EVAL_LOGICAL_EQ: compare(iA, iB, JP_EQ);    break;
+            case EVAL_LOGICAL_NE: compare(iA, iB, JP_NE);    break;
+            case EVAL_LOGICAL_LT: compare(iA, iB, JP_LT_OQ); break;
+            case EVAL_LOGICAL_GT: compare(iA, iB, JP_GT_OQ); break;
+            case EVAL_LOGICAL_LE: compare(iA, iB, JP_LE_OQ); break;
+            case EVAL_LOGICAL_GE: compare(iA, iB, JP_GE_OQ); break;
+        }
+    } else {
+        switch(idEval) {
+            case EVAL_LOGICAL_EQ: compare(iA, iB, JP_EQ); break;
+            case EVAL_LOGICAL_NE: compare(iA, iB, JP_NE); break;
+            case EVAL_LOGICAL_LT: compare(iA, iB, JP_LT); break;
+            case EVAL_LOGICAL_LE: compare(iA, iB, JP_LE); break;
+            case EVAL_LOGICAL_GT:
+            case EVAL_LOGICAL_GE:
+                move(JIT_SCRATCH, iB);
+                compare(JIT_SCRATCH, iA, idEval == EVAL_LOGICAL_GT ? JP_LT : JP_LE);
+                move(iA, JIT_SCRATCH);
+                break;
+        }
+    }
+    logicTable(0x54, iA, m_One);
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: emitFalseMask
+ * ===========================
+ *  Sets eax to a bit mask of the lanes of iA that are EVAL_FALSE, and compares it to the mask of all lanes. The scalar variant
+ *  compares in the low lane only, and the high lane of the zeroed scratch register does not set its bit.
+ */
+
+void jitGenerator::emitFalseMask(int iA) {
+
+    zeroScratch();
+    compare(JIT_SCRATCH, iA, JP_EQ);
+    if(m_Packed) m_Asm.vex(1, 0x50, JR_RAX, 0, JIT_SCRATCH); else m_Asm.sse(0x66, 0x50, JR_RAX, JIT_SCRATCH);
+    m_Asm.bytes({0x83, 0xf8, (uint8_t)(m_Packed ? 0x0f : 0x01)});  // cmp eax, all lanes
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: generate
+ * ======================
+ *  Emits the function. Returns false if the program uses an instruction the JIT does not support, or is too deep to keep the
+ *  stack in registers.
+ *  Jumps are taken when they would be for all lanes, like in the tile interpreter. The code at a jump target expects the
+ *  same stack registers whether it is reached by the jump or from the instruction before, so registers need no fixing up.
+ */
+
+bool jitGenerator::generate(const vector<instr>& vCode) {
+
+    jitAssembler& a = m_Asm;
+
+    // Prologue, keeps rsp 16 byte aligned for the calls
+    a.byte(0x53);                                   // push rbx
+    a.bytes({0x41, 0x54});                          // push r12
+    if(m_Packed) {
+        a.bytes({0x41, 0x55});                      // push r13
+        a.bytes({0x41, 0x56});                      // push r14
+    }
+    a.bytes({0x48, 0x81, 0xec}); a.dword((uint32_t)m_Frame);  // sub rsp, frame
+    a.bytes({0x48, 0x89, 0xfb});                    // mov rbx, rdi
+    a.bytes({0x4c, 0x8d, 0x25});                    // lea r12, [rip + table]
+    a.dword((uint32_t)(m_Table - (int32_t)a.m_Code.size() - 4));
+
+    size_t iLoop = 0;
+    size_t iExit = 0;
+    if(m_Packed) {
+        a.bytes({0x49, 0x89, 0xf5});                // mov r13, rsi
+        a.bytes({0x49, 0x89, 0xd6});                // mov r14, rdx
+        a.bytes({0x4d, 0x85, 0xf6});                // test r14, r14
+        a.bytes({0x0f, 0x84}); a.dword(0);          // jz exit
+        iExit = a.m_Code.size();
+        iLoop = a.m_Code.size();
+    }
+
+    int iTop = -1;
+
+    vector<size_t> viLabel(vCode.size(), 0);
+    vector<size_t> viPatch;  // Displacements of jumps, each followed by its target instruction
+    size_t         iSkip;
+
+    for(size_t iIns=0; iIns<vCode.size(); iIns++) {
+
+        const instr& iOp = vCode[iIns];
+        viLabel[iIns] = a.m_Code.size();
+
+        if(iOp.op == EVAL_END) break;
+
+        if(iOp.size == 0) {
+            iTop++;
+            if(iTop >= JIT_REGS) return false;
+            switch(iOp.op) {
+                case EVAL_NUMBER:   load(iTop, JR_R12, (int32_t)(iOp.arg*JIT_SLOT)); break;
+                case EVAL_LOAD:     load(iTop, JR_RSP, m_Temps + (int32_t)(iOp.arg*JIT_SLOT)); break;
+                case EVAL_VARIABLE: load(iTop, JR_RBX, (int32_t)(iOp.arg*(m_Packed ? EVAL_BLOCK*8 : 8))); break;
+                default: return false;
+            }
+            continue;
+        }
+
+        int iA = iTop - iOp.size + 1;
+        int iB = iA + 1;
+        int iC = iA + 2;
+
+        switch(iOp.op) {
+        case EVAL_UNARY_PLUS:
+            break;
+        case EVAL_STORE:
+            store(iTop, JR_RSP, m_Temps + (int32_t)(iOp.arg*JIT_SLOT));
+            break;
+        case EVAL_UNARY_MINUS:
+            logicTable(0x57, iA, m_Sign);
+            break;
+        case EVAL_FUNC_ABS:
+            logicTable(0x54, iA, m_NoSign);
+            break;
+        case EVAL_MATH_PLUS:
+            arith(0x58, iA, iB);
+            break;
+        case EVAL_MATH_MINUS:
+            arith(0x5c, iA, iB);
+            break;
+        case EVAL_MATH_MULT:
+            arith(0x59, iA, iB);
+            break;
+        case EVAL_MATH_DIV:
+            arith(0x5e, iA, iB);
+            break;
+        case EVAL_LOGICAL_EQ:
+        case EVAL_LOGICAL_NE:
+        case EVAL_LOGICAL_LT:
+        case EVAL_LOGICAL_GT:
+        case EVAL_LOGICAL_LE:
+        case EVAL_LOGICAL_GE:
+            emitCompare(iOp.op, iA, iB);
+            break;
+        case EVAL_LOGICAL_AND:
+        case EVAL_LOGICAL_OR:
+            zeroScratch();
+            compare(iA, JIT_SCRATCH, JP_NE);
+            compare(iB, JIT_SCRATCH, JP_NE);
+            logic(iOp.op == EVAL_LOGICAL_AND ? 0x54 : 0x56, iA, iB);
+            logicTable(0x54, iA, m_One);
+            break;
+        case EVAL_SPECIAL_IF:
+            zeroScratch();
+            compare(iA, JIT_SCRATCH, JP_NE);
+            if(m_Packed) {
+                a.vex(3, 0x4b, iA, iC, iB);         // vblendvpd a, c, b, a
+                a.byte((uint8_t)(iA << 4));
+            } else {
+                logic(0x54, iB, iA);                // andpd  b, a
+                logic(0x55, iA, iC);                // andnpd a, c
+                logic(0x56, iA, iB);                // orpd   a, b
+            }
+            break;
+        case EVAL_JUMP_IF:
+            emitFalseMask(iA);
+            viPatch.push_back(a.jump(JC_E));
+            viPatch.push_back(iOp.arg);
+            break;
+        case EVAL_JUMP:
+            // The condition is below the first branch, and true in every lane if the scalar variant gets here
+            iSkip = 0;
+            if(m_Packed) {
+                emitFalseMask(iA-1);
+                a.bytes({0x85, 0xc0});              // test eax, eax
+                iSkip = a.jump(JC_NE);
+            }
+            move(iA-1, iA);
+            viPatch.push_back(a.jump(0));
+            viPatch.push_back(iOp.arg);
+            if(m_Packed) a.patch(iSkip);
+            break;
+        case EVAL_JUMP_AND:
+            emitFalseMask(iA);
+            iSkip = a.jump(JC_NE);
+            logicTable(0x54, iA, m_One);
+            viPatch.push_back(a.jump(0));
+            viPatch.push_back(iOp.arg);
+            a.patch(iSkip);
+            break;
+        case EVAL_JUMP_OR:
+            emitFalseMask(iA);
+            a.bytes({0x85, 0xc0});                  // test eax, eax
+            iSkip = a.jump(JC_NE);
+            load(iA, JR_R12, m_One);
+            viPatch.push_back(a.jump(0));
+            viPatch.push_back(iOp.arg);
+            a.patch(iSkip);
+            break;
+        case EVAL_FUNC_SIN:   emitCall((const void*)static_cast<double_t(*)(double_t)>(sin),  iA, 1); break;
+        case EVAL_FUNC_COS:   emitCall((const void*)static_cast<double_t(*)(double_t)>(cos),  iA, 1); break;
+        case EVAL_FUNC_TAN:   emitCall((const void*)static_cast<double_t(*)(double_t)>(tan),  iA, 1); break;
+        case EVAL_FUNC_ASIN:  emitCall((const void*)static_cast<double_t(*)(double_t)>(asin), iA, 1); break;
+        case EVAL_FUNC_ACOS:  emitCall((const void*)static_cast<double_t(*)(double_t)>(acos), iA, 1); break;
+        case EVAL_FUNC_ATAN:  emitCall((const void*)static_cast<double_t(*)(double_t)>(atan), iA, 1); break;
+        case EVAL_FUNC_EXP:   emitCall((const void*)static_cast<double_t(*)(double_t)>(exp),  iA, 1); break;
+        case EVAL_FUNC_LOG:   emitCall((const void*)static_cast<double_t(*)(double_t)>(log),  iA, 1); break;
+        case EVAL_MATH_POW:   emitCall((const void*)static_cast<double_t(*)(double_t, double_t)>(pow),   iA, 2); break;
+        case EVAL_FUNC_ATAN2: emitCall((const void*)static_cast<double_t(*)(double_t, double_t)>(atan2), iA, 2); break;
+        default:
+            // mod() needs to report non-integer arguments, which is left to the interpreter
+            return false;
+        }
+
+        iTop = iA;
+    }
+
+    if(iTop != 0) return false;
+
+    for(size_t i=0; i<viPatch.size(); i+=2) {
+        if(viPatch[i+1] >= vCode.size()) return false;
+        a.patch(viPatch[i], viLabel[viPatch[i+1]]);
+    }
+
+    if(m_Packed) {
+        m_Asm.vexMem(1, 0x11, 0, 0, JR_R13, 0);     // vmovupd [r13], ymm0
+        a.bytes({0x48, 0x83, 0xc3, 0x20});          // add rbx, 32
+        a.bytes({0x49, 0x83, 0xc5, 0x20});          // add r13, 32
+        a.bytes({0x49, 0xff, 0xce});                // dec r14
+        a.bytes({0x0f, 0x85});                      // jnz loop
+        a.dword((uint32_t)((int32_t)iLoop - (int32_t)a.m_Code.size() - 4));
+        int32_t iJump = (int32_t)(a.m_Code.size() - iExit);
+        memcpy(&a.m_Code[iExit-4], &iJump, 4);
+        a.bytes({0xc5, 0xf8, 0x77});                // vzeroupper
+    }
+
+    // Epilogue, the scalar result is already in xmm0
+    a.bytes({0x48, 0x81, 0xc4}); a.dword((uint32_t)m_Frame);  // add rsp, frame
+    if(m_Packed) {
+        a.bytes({0x41, 0x5e});                      // pop r14
+        a.bytes({0x41, 0x5d});                      // pop r13
+    }
+    a.bytes({0x41, 0x5c});                          // pop r12
+    a.byte(0x5b);                                   // pop rbx
+    a.byte(0xc3);                                   // ret
+
+    return true;
+}
+
+} // End Anonymous NameSpace
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Destructor
+ * ============
+ */
+
+JitCode::~JitCode() {
+    if(m_Memory != nullptr) munmap(m_Memory, m_Size);
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: Compile
+ * ===================
+ *  Generates the scalar function, and the packed function if the CPU supports AVX, from the stack bytecode with the given
+ *  constant table, stack depth and number of temporaries. The memory is mapped writable, filled, and then switched to read
+ *  and execute. Returns false if the program cannot be compiled or executable memory is not available.
+ */
+
+bool JitCode::Compile(const vector<instr>& vCode, const vdouble_t& vdConsts, size_t nStack, size_t nTemps) {
+
+    if(nStack > JIT_REGS) return false;
+
+    // Constant table, followed by 1.0, the sign bit and everything but the sign bit
+    vector<double_t> vdTable;
+    for(double_t dVal : vdConsts) vdTable.insert(vdTable.end(), 4, dVal);
+    vdTable.insert(vdTable.end(), 4, EVAL_TRUE);
+    vdTable.insert(vdTable.end(), 4, -0.0);
+    uint64_t uNoSign = 0x7fffffffffffffffULL;
+    double_t dNoSign;
+    memcpy(&dNoSign, &uNoSign, sizeof(dNoSign));
+    vdTable.insert(vdTable.end(), 4, dNoSign);
+
+    size_t nTable = vdTable.size()*sizeof(double_t);
+
+    // The table offset is relative to the start of the code, which follows the table
+    jitAssembler jAsm;
+    jitGenerator jScalar(jAsm, false, vdConsts.size(), nTemps, -(int32_t)nTable);
+    if(!jScalar.generate(vCode)) return false;
+
+    size_t iPacked = 0;
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx")) {
+        while(jAsm.m_Code.size() % 16 != 0) jAsm.byte(0xcc);
+        iPacked = jAsm.m_Code.size();
+        jitGenerator jPacked(jAsm, true, vdConsts.size(), nTemps, -(int32_t)nTable);
+        if(!jPacked.generate(vCode)) return false;
+    }
+
+    size_t nSize = nTable + jAsm.m_Code.size();
+    void*  pMem  = mmap(nullptr, nSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(pMem == MAP_FAILED) return false;
+
+    uint8_t* pBytes = (uint8_t*)pMem;
+    memcpy(pBytes, vdTable.data(), nTable);
+    memcpy(pBytes + nTable, jAsm.m_Code.data(), jAsm.m_Code.size());
+
+    if(mprotect(pMem, nSize, PROT_READ | PROT_EXEC) != 0) {
+        munmap(pMem, nSize);
+        return false;
+    }
+
+    if(m_Memory != nullptr) munmap(m_Memory, m_Size);
+    m_Memory = pMem;
+    m_Size   = nSize;
+    m_Scalar = (jitscalar_t)(pBytes + nTable);
+    m_Packed = iPacked > 0 ? (jitpacked_t)(pBytes + nTable + iPacked) : nullptr;
+
+    return true;
+}
+
+// ****************************************************************************************************************************** //
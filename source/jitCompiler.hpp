@@ -0,0 +1,55 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  JIT Compiler
+ *  Translates the stack bytecode into x86-64 machine code in executable memory. Stack level n lives in register xmm<n> (or
+ *  ymm<n> for the packed variant), so the generated code only touches memory for variables, constants, temporaries, and to
+ *  save live registers around calls to libm.
+ */
+
+#ifndef JIT_COMPILER
+#define JIT_COMPILER
+
+#include "clsMath.hpp"
+
+namespace smath {
+
+typedef double_t (*jitscalar_t)(const double_t*);
+typedef void     (*jitpacked_t)(const double_t*, double_t*, size_t);
+
+class JitCode {
+
+public:
+
+   /**
+    * Constructor/Destructor
+    */
+
+    JitCode() {};
+    ~JitCode();
+
+   /**
+    * Methods
+    */
+
+    bool Compile(const std::vector<instr>&, const vdouble_t&, size_t, size_t);
+
+    jitscalar_t scalarFunction() { return m_Scalar; };
+    jitpacked_t packedFunction() { return m_Packed; };
+
+private:
+
+   /**
+    * Member Variables
+    */
+
+    void*       m_Memory = nullptr;
+    size_t      m_Size   = 0;
+    jitscalar_t m_Scalar = nullptr;
+    jitpacked_t m_Packed = nullptr;
+
+};
+
+} // End NameSpace
+
+#endif
@@ -6,32 +6,786 @@
  */
 
 #include "libSimpleMath.hpp"
+#include "programFile.hpp"
+#include "threadPool.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unordered_set>
 
 using namespace std;
 using namespace smath;
 
-SimpleMath::SimpleMath() {
+// Evaluation buffers of the calling thread, shared by all equations. They are reached through a plain pointer, as that
+// avoids the initialisation check on every access to a thread_local object with a constructor.
+static thread_local scratch  t_ScratchStore;
+static thread_local scratch* t_Scratch = nullptr;
+
+static inline scratch& threadScratch() {
+    if(t_Scratch == nullptr) t_Scratch = &t_ScratchStore;
+    return *t_Scratch;
+}
 
+SimpleMath::SimpleMath() {
+    for(size_t i=0; i<SM_CHUNKS; i++) {
+        m_Slots[i]     = nullptr;
+        m_SetSlots[i]  = nullptr;
+        m_GradSlots[i] = nullptr;
+    }
 }
 
 SimpleMath::~SimpleMath() {
+    delete m_Pool;
+    for(size_t i=0; i<SM_CHUNKS; i++) {
+        delete[] m_Slots[i].load();
+        delete[] m_SetSlots[i].load();
+        delete[] m_GradSlots[i].load();
+    }
+}
+
+/**
+ *  Cache key of an equation. Runs of white space are equivalent to a single space in the lexer, and trailing white space is
+ *  ignored, so both are normalised away. The variables follow the equation, each after a separator that cannot be part of an
+ *  equation.
+ */
+static string_t cacheKey(const string_t& sEquation, const vstring_t& vsVariable) {
+
+    string_t sKey;
+    sKey.reserve(sEquation.size() + 8*vsVariable.size());
+
+    bool isSpace = false;
+    for(char cCurr : sEquation) {
+        if(isspace((unsigned char)cCurr)) {
+            isSpace = true;
+            continue;
+        }
+        if(isSpace) sKey += ' ';
+        sKey   += cCurr;
+        isSpace = false;
+    }
+    for(const auto& sItem : vsVariable) {
+        sKey += '\0';
+        sKey += sItem;
+    }
 
+    return sKey;
 }
 
+/**
+ *  Equations can be added, and backends changed, while other threads evaluate. The equation is compiled before the lock is
+ *  taken, and its program is then published in the slot table that the evaluation functions read without locking. Programs
+ *  that are replaced by setBackend are kept until the object is destroyed, as another thread may still be running them.
+ *  An equation that was compiled before with the same variables is served from the compile cache without parsing, and gets
+ *  a new id that shares the compiled program.
+ */
 size_t SimpleMath::addEquation(string_t sEquation, vstring_t vsVariable) {
 
-    m_Eqs.push_back(new Math());
-    size_t newEq = m_Eqs.size() - 1;
+    string_t                  sKey = cacheKey(sEquation, vsVariable);
+    shared_ptr<Math>          pEq;
+    shared_ptr<const Program> pProgram;
+    size_t                    newEq;
+
+    {
+        lock_guard<mutex> lGuard(m_Mutex);
+        if(m_CacheStats.limit > 0) {
+            auto itEntry = m_Cache.find(sKey);
+            if(itEntry != m_Cache.end()) {
+                m_CacheOrder.splice(m_CacheOrder.begin(), m_CacheOrder, itEntry->second.order);
+                m_CacheStats.hits++;
+                pEq      = itEntry->second.eq;
+                pProgram = pEq->getProgram();
+                newEq    = m_Eqs.size();
+                m_Eqs.push_back(pEq);
+                setSlot(m_Slots, newEq, pProgram);
+            }
+        }
+        if(!pEq) m_CacheStats.misses++;
+    }
+
+    if(!pEq) {
+        pEq = make_shared<Math>();
+        pEq->setVariables(vsVariable);
+        pEq->setEquation(sEquation);
+        pProgram = pEq->getProgram();
+        size_t nBytes = pEq->getMemoryUsage() + 2*sKey.size();
+
+        lock_guard<mutex> lGuard(m_Mutex);
+        newEq = m_Eqs.size();
+        m_Eqs.push_back(pEq);
+        setSlot(m_Slots, newEq, pProgram);
+
+        // Only valid equations are cached, and a concurrent add of the same equation keeps the entry already there
+        if(pProgram && m_CacheStats.limit > 0 && m_Cache.find(sKey) == m_Cache.end()) {
+            m_CacheOrder.push_front(sKey);
+            m_Cache[sKey] = cacheEntry({pEq, m_CacheOrder.begin(), nBytes});
+            m_CacheStats.bytes += nBytes;
+            trimCache();
+        }
+    }
 
-    m_Eqs[newEq]->setVariables(vsVariable);
-    m_Eqs[newEq]->setEquation(sEquation);
+    // Size this thread's buffers now, so the first evaluation does not allocate
+    if(pProgram) pProgram->Prepare(threadScratch());
 
     return newEq;
 
 }
 
-double_t SimpleMath::evalEquation(size_t idEQ, vdouble_t vdValues) {
-    double_t eqResult;
-    m_Eqs[idEQ]->Eval(vdValues, &eqResult);
+/**
+ *  Sets the memory bound of the compile cache in bytes, evicting the least recently used entries above it. A bound of 0
+ *  turns the cache off and empties it. Equations already added are not affected.
+ */
+void SimpleMath::setCacheLimit(size_t nBytes) {
+    lock_guard<mutex> lGuard(m_Mutex);
+    m_CacheStats.limit = nBytes;
+    trimCache();
+}
+
+cachestats SimpleMath::getCacheStats() {
+    lock_guard<mutex> lGuard(m_Mutex);
+    cachestats csStats = m_CacheStats;
+    csStats.entries = m_Cache.size();
+    return csStats;
+}
+
+// Called with m_Mutex held
+void SimpleMath::trimCache() {
+    while(!m_CacheOrder.empty() && (m_CacheStats.bytes > m_CacheStats.limit || m_CacheStats.limit == 0)) {
+        auto itEntry = m_Cache.find(m_CacheOrder.back());
+        m_CacheStats.bytes -= itEntry->second.bytes;
+        m_CacheStats.evictions++;
+        m_Cache.erase(itEntry);
+        m_CacheOrder.pop_back();
+    }
+}
+
+bool SimpleMath::setBackend(size_t idEQ, value_t idBackend) {
+    lock_guard<mutex> lGuard(m_Mutex);
+    if(idEQ >= m_Eqs.size()) return false;
+    // An equation shared with the cache or other ids gets its own copy before it is changed
+    if(m_Eqs[idEQ].use_count() > 1) m_Eqs[idEQ] = make_shared<Math>(*m_Eqs[idEQ]);
+    bool isValid = m_Eqs[idEQ]->setBackend(idBackend);
+    setSlot(m_Slots, idEQ, m_Eqs[idEQ]->getProgram());
+    return isValid;
+}
+
+value_t SimpleMath::getBackend(size_t idEQ) {
+    lock_guard<mutex> lGuard(m_Mutex);
+    if(idEQ >= m_Eqs.size()) return EVAL_NONE;
+    return m_Eqs[idEQ]->getBackend();
+}
+
+shared_ptr<const Program> SimpleMath::getProgram(size_t idEQ) {
+    lock_guard<mutex> lGuard(m_Mutex);
+    if(idEQ >= m_Eqs.size()) return nullptr;
+    return m_Eqs[idEQ]->getProgram();
+}
+
+double_t SimpleMath::evalEquation(size_t idEQ, const vdouble_t& vdValues) {
+    return evalEquation(idEQ, vdValues.data(), vdValues.size());
+}
+
+double_t SimpleMath::evalEquation(size_t idEQ, const double_t* pValues, size_t nValues) {
+    double_t       eqResult = NAN;
+    const Program* pProgram = getSlot(m_Slots, idEQ);
+    if(pProgram == nullptr) {
+        printf("Math Eval Error: No valid equation to evaluate\n");
+        return eqResult;
+    }
+    pProgram->Eval(pValues, nValues, &eqResult, threadScratch());
     return eqResult;
 }
+
+bool SimpleMath::evalEquationBatch(size_t idEQ, const double_t* const* ppColumns, size_t nRows, double_t* pOutput, size_t nStride) {
+    const Program* pProgram = getSlot(m_Slots, idEQ);
+    if(pProgram == nullptr) {
+        printf("Math Eval Error: No valid equation to evaluate\n");
+        return false;
+    }
+    return pProgram->EvalBatch(ppColumns, nRows, pOutput, nStride, threadScratch());
+}
+
+bool SimpleMath::evalEquationBatch(size_t idEQ, const float* const* ppColumns, size_t nRows, float* pOutput, size_t nStride) {
+    const Program* pProgram = getSlot(m_Slots, idEQ);
+    if(pProgram == nullptr) {
+        printf("Math Eval Error: No valid equation to evaluate\n");
+        return false;
+    }
+    return pProgram->EvalBatch(ppColumns, nRows, pOutput, nStride, threadScratch());
+}
+
+/**
+ *  Chunk k of the slot table holds SM_FIRST_CHUNK << k entries
+ */
+static void slotIndex(size_t idSlot, size_t* pChunk, size_t* pOffset) {
+    size_t iPos   = idSlot + SM_FIRST_CHUNK;
+    size_t iChunk = 0;
+    while((iPos >> iChunk) >= 2*SM_FIRST_CHUNK) iChunk++;
+    *pChunk  = iChunk;
+    *pOffset = iPos - ((size_t)SM_FIRST_CHUNK << iChunk);
+}
+
+const Program* SimpleMath::getSlot(const slots_t& aSlots, size_t idSlot) {
+    size_t iChunk, iOffset;
+    slotIndex(idSlot, &iChunk, &iOffset);
+    if(iChunk >= SM_CHUNKS) return nullptr;
+    atomic<const Program*>* pChunk = aSlots[iChunk].load(memory_order_acquire);
+    if(pChunk == nullptr) return nullptr;
+    return pChunk[iOffset].load(memory_order_acquire);
+}
+
+// Called with m_Mutex held
+void SimpleMath::setSlot(slots_t& aSlots, size_t idSlot, const shared_ptr<const Program>& pProgram) {
+    size_t iChunk, iOffset;
+    slotIndex(idSlot, &iChunk, &iOffset);
+    if(aSlots[iChunk].load() == nullptr) {
+        size_t nSize = (size_t)SM_FIRST_CHUNK << iChunk;
+        atomic<const Program*>* pChunk = new atomic<const Program*>[nSize];
+        for(size_t i=0; i<nSize; i++) pChunk[i] = nullptr;
+        aSlots[iChunk].store(pChunk, memory_order_release);
+    }
+    if(pProgram) m_Programs.push_back(pProgram);
+    aSlots[iChunk].load()[iOffset].store(pProgram.get(), memory_order_release);
+}
+
+/**
+ *  Evaluates an equation on columns of values like evalEquationBatch, split over nThreads threads of a pool that is kept
+ *  between calls. nThreads 0 uses one thread per hardware thread. The rows are cut into tasks of PARALLEL_CHUNK_BYTES worth
+ *  of input and output, and idle threads steal tasks from busy ones. Calls on the same SimpleMath object take turns.
+ */
+bool SimpleMath::evalEquationParallel(size_t idEQ, const double_t* const* ppColumns, size_t nRows, double_t* pOutput,
+                                      size_t nThreads, size_t nStride) {
+
+    const Program* pProgram = getSlot(m_Slots, idEQ);
+    if(pProgram == nullptr) {
+        printf("Math Eval Error: No valid equation to evaluate\n");
+        return false;
+    }
+    size_t nVars = pProgram->getVariableCount();
+
+    // Let EvalBatch report the missing columns
+    if(nVars > 0 && ppColumns == nullptr) {
+        return pProgram->EvalBatch(ppColumns, nRows, pOutput, nStride, threadScratch());
+    }
+
+    lock_guard<mutex> lGuard(m_PoolMutex);
+
+    nThreads = startPool(nThreads);
+    for(auto& vpCols : m_WorkCols) {
+        if(vpCols.size() < nVars) vpCols.resize(nVars);
+    }
+
+    size_t nChunk = PARALLEL_CHUNK_BYTES/(sizeof(double_t)*(nVars+1));
+    nChunk = max((size_t)EVAL_BLOCK, nChunk/EVAL_BLOCK*EVAL_BLOCK);
+    size_t nTasks = (nRows + nChunk - 1)/nChunk;
+
+    atomic<bool> isValid(true);
+    m_Pool->Run(nTasks, [&](size_t iTask, size_t iWorker) {
+        size_t iRow  = iTask*nChunk;
+        size_t nPart = min(nChunk, nRows-iRow);
+        vector<const double_t*>& vpCols = m_WorkCols[iWorker];
+        for(size_t i=0; i<nVars; i++) vpCols[i] = ppColumns[i] + iRow*nStride;
+        if(!pProgram->EvalBatch(vpCols.data(), nPart, pOutput+iRow, nStride, m_Scratch[iWorker])) isValid = false;
+    }, nThreads);
+
+    return isValid;
+}
+
+// Called with m_PoolMutex held. Starts a pool of nThreads threads unless there is one at least that large, and returns the
+// number of threads to use. The pool only grows, and runs with fewer threads use its first workers.
+size_t SimpleMath::startPool(size_t nThreads) {
+    if(nThreads == 0) nThreads = max(1u, thread::hardware_concurrency());
+    if(m_Pool == nullptr || m_Pool->threadCount() < nThreads) {
+        delete m_Pool;
+        m_Pool = new ThreadPool(nThreads);
+        m_Scratch.resize(nThreads);
+        m_WorkCols.resize(nThreads);
+    }
+    return nThreads;
+}
+
+/**
+ *  Reduces the results of an equation on columns of values to one value, without writing them to an output column. idReduce
+ *  is RD_SUM, RD_MIN, RD_MAX, RD_MEAN or RD_COUNT, see Program::EvalReduce. The rows are cut into tasks like those of
+ *  evalEquationParallel, whose partial results are merged in task order, so the result is the same for any nThreads. nThreads
+ *  other than 1 splits the tasks over the thread pool, with 0 for one thread per hardware thread. Returns NaN on error.
+ */
+double_t SimpleMath::reduceEquation(size_t idEQ, const double_t* const* ppColumns, size_t nRows, value_t idReduce,
+                                    size_t nThreads, size_t nStride) {
+
+    const Program* pProgram = getSlot(m_Slots, idEQ);
+    if(pProgram == nullptr) {
+        printf("Math Eval Error: No valid equation to evaluate\n");
+        return NAN;
+    }
+
+    size_t nChunk = PARALLEL_CHUNK_BYTES/(sizeof(double_t)*max((size_t)1, pProgram->getVariableCount()));
+    nChunk = max((size_t)EVAL_BLOCK, nChunk/EVAL_BLOCK*EVAL_BLOCK);
+    size_t nTasks = (nRows + nChunk - 1)/nChunk;
+
+    reduction rdTotal;
+    memset(&rdTotal, 0, sizeof(rdTotal));
+
+    // Bad arguments are reported once, by the first task on the calling thread
+    bool isBad = (pProgram->getVariableCount() > 0 && ppColumns == nullptr) || idReduce < RD_SUM || idReduce > RD_COUNT;
+
+    if(nThreads == 1 || nTasks <= 1 || isBad) {
+        scratch& sWork = threadScratch();
+        for(size_t iTask=0; iTask<max((size_t)1, nTasks); iTask++) {
+            size_t    iRow   = iTask*nChunk;
+            reduction rdPart;
+            memset(&rdPart, 0, sizeof(rdPart));
+            if(!pProgram->EvalReduce(ppColumns, iRow, min(nChunk, nRows-iRow), nStride, idReduce, &rdPart, sWork)) {
+                return NAN;
+            }
+            reduceMerge(&rdTotal, rdPart, idReduce);
+        }
+        return reduceValue(rdTotal, idReduce);
+    }
+
+    lock_guard<mutex> lGuard(m_PoolMutex);
+
+    nThreads = startPool(nThreads);
+
+    vector<reduction> vrParts(nTasks);
+    atomic<bool>      isValid(true);
+    m_Pool->Run(nTasks, [&](size_t iTask, size_t iWorker) {
+        size_t iRow = iTask*nChunk;
+        memset(&vrParts[iTask], 0, sizeof(reduction));
+        if(!pProgram->EvalReduce(ppColumns, iRow, min(nChunk, nRows-iRow), nStride, idReduce, &vrParts[iTask],
+                                 m_Scratch[iWorker])) {
+            isValid = false;
+        }
+    }, nThreads);
+    if(!isValid) return NAN;
+
+    for(const auto& rdPart : vrParts) reduceMerge(&rdTotal, rdPart, idReduce);
+
+    return reduceValue(rdTotal, idReduce);
+}
+
+/**
+ *  Evaluates an equation as a condition on columns of values, and sets bit i % 64 of pBitmap[i/64] for each row i where its
+ *  result is not false, see Program::EvalFilter. pBitmap must hold (nRows+63)/64 words. pCount, if given, is set to the
+ *  number of rows selected.
+ */
+bool SimpleMath::filterEquation(size_t idEQ, const double_t* const* ppColumns, size_t nRows, uint64_t* pBitmap,
+                                size_t* pCount, size_t nStride) {
+
+    const Program* pProgram = getSlot(m_Slots, idEQ);
+    if(pProgram == nullptr) {
+        printf("Math Eval Error: No valid equation to evaluate\n");
+        return false;
+    }
+
+    return pProgram->EvalFilter(ppColumns, nRows, nStride, pBitmap, nullptr, pCount, threadScratch());
+}
+
+/**
+ *  Like filterEquation, but writes the indices of the rows selected to pSelection in order, and their number to pCount.
+ *  pSelection must have room for nRows indices.
+ */
+bool SimpleMath::selectEquation(size_t idEQ, const double_t* const* ppColumns, size_t nRows, size_t* pSelection,
+                                size_t* pCount, size_t nStride) {
+
+    const Program* pProgram = getSlot(m_Slots, idEQ);
+    if(pProgram == nullptr) {
+        printf("Math Eval Error: No valid equation to evaluate\n");
+        return false;
+    }
+
+    return pProgram->EvalFilter(ppColumns, nRows, nStride, nullptr, pSelection, pCount, threadScratch());
+}
+
+/**
+ *  Combines equations that use the same variables into a set, and returns the id of the set. evalEquationSet evaluates all
+ *  of them in one pass over the input columns, computing subexpressions they share only once per row. The set is compiled
+ *  from the equations as they are now, and is always run by the batch interpreter regardless of their backends.
+ */
+size_t SimpleMath::addEquationSet(const vector<size_t>& vIds) {
+
+    lock_guard<mutex> lGuard(m_Mutex);
+
+    vector<const Math*> vpEqs;
+    for(size_t idEQ : vIds) {
+        vpEqs.push_back(idEQ < m_Eqs.size() ? m_Eqs[idEQ].get() : nullptr);
+    }
+
+    shared_ptr<Math> pSet = make_shared<Math>();
+    pSet->setEquationSet(vpEqs);
+
+    shared_ptr<const Program> pProgram = pSet->getProgram();
+    if(pProgram) pProgram->Prepare(threadScratch());
+
+    size_t newSet = m_Sets.size();
+    m_Sets.push_back(pSet);
+    setSlot(m_SetSlots, newSet, pProgram);
+
+    return newSet;
+}
+
+shared_ptr<const Program> SimpleMath::getSetProgram(size_t idSet) {
+    lock_guard<mutex> lGuard(m_Mutex);
+    return idSet < m_Sets.size() ? m_Sets[idSet]->getProgram() : nullptr;
+}
+
+/**
+ *  Evaluates a set from addEquationSet on columns of values, writing the result of the k-th equation of the set to
+ *  ppOutputs[k], which must hold at least nRows values
+ */
+bool SimpleMath::evalEquationSet(size_t idSet, const double_t* const* ppColumns, size_t nRows, double_t* const* ppOutputs,
+                                 size_t nStride) {
+
+    const Program* pProgram = getSlot(m_SetSlots, idSet);
+    if(pProgram == nullptr) {
+        printf("Math Eval Error: No valid equation set to evaluate\n");
+        return false;
+    }
+    return pProgram->EvalBatch(ppColumns, nRows, ppOutputs, nStride, threadScratch());
+}
+
+/**
+ *  Compiles a program that evaluates equation idEQ together with its derivative by each of its variables, and returns the id
+ *  of the gradient. idMode selects forward or reverse mode differentiation, and AD_AUTO picks the one that gives the shorter
+ *  program, which is forward mode for few variables and reverse mode for many. Like a set, the gradient is compiled from
+ *  the equation as it is now, and always runs on the stack interpreters.
+ */
+size_t SimpleMath::addGradient(size_t idEQ, value_t idMode) {
+
+    lock_guard<mutex> lGuard(m_Mutex);
+
+    shared_ptr<Math> pGrad = make_shared<Math>();
+    pGrad->setGradient(idEQ < m_Eqs.size() ? m_Eqs[idEQ].get() : nullptr, idMode);
+
+    shared_ptr<const Program> pProgram = pGrad->getProgram();
+    if(pProgram) pProgram->Prepare(threadScratch());
+
+    size_t newGrad = m_Grads.size();
+    m_Grads.push_back(pGrad);
+    setSlot(m_GradSlots, newGrad, pProgram);
+
+    return newGrad;
+}
+
+shared_ptr<const Program> SimpleMath::getGradientProgram(size_t idGrad) {
+    lock_guard<mutex> lGuard(m_Mutex);
+    return idGrad < m_Grads.size() ? m_Grads[idGrad]->getProgram() : nullptr;
+}
+
+/**
+ *  Evaluates a gradient from addGradient for one set of values. Returns the value of the equation, and writes its derivative
+ *  by each variable to pGradient, which must hold one value per variable. Returns NaN on error.
+ */
+double_t SimpleMath::evalGradient(size_t idGrad, const double_t* pValues, size_t nValues, double_t* pGradient) {
+
+    const Program* pProgram = getSlot(m_GradSlots, idGrad);
+    if(pProgram == nullptr) {
+        printf("Math Eval Error: No valid gradient to evaluate\n");
+        return NAN;
+    }
+
+    // Sized before the output buffer is taken from it
+    scratch& sWork = threadScratch();
+    if(!pProgram->isPrepared(sWork)) pProgram->Prepare(sWork);
+
+    double_t* pOutput = sWork.output.data();
+    if(!pProgram->Eval(pValues, nValues, pOutput, pProgram->getOutputCount(), sWork)) return NAN;
+    if(pGradient != nullptr) {
+        copy(pOutput + 1, pOutput + pProgram->getOutputCount(), pGradient);
+    }
+
+    return pOutput[0];
+}
+
+/**
+ *  Evaluates a gradient on columns of values, writing the value of the equation to ppOutputs[0] and its derivative by the
+ *  i-th variable to ppOutputs[1+i]. Each output must hold at least nRows values.
+ */
+bool SimpleMath::evalGradientBatch(size_t idGrad, const double_t* const* ppColumns, size_t nRows, double_t* const* ppOutputs,
+                                   size_t nStride) {
+
+    const Program* pProgram = getSlot(m_GradSlots, idGrad);
+    if(pProgram == nullptr) {
+        printf("Math Eval Error: No valid gradient to evaluate\n");
+        return false;
+    }
+    return pProgram->EvalBatch(ppColumns, nRows, ppOutputs, nStride, threadScratch());
+}
+
+/**
+ *  Turns profiling on with PM_CALLS or PM_OPS, or off with PM_OFF. The mode applies to every program in the process, and the
+ *  counts are kept until resetProfiles. See Program::setProfiling.
+ */
+void SimpleMath::setProfiling(value_t idMode) {
+    Program::setProfiling(idMode);
+}
+
+// Profile of the current program of an equation, all zero if there is none. Equations that share a program share its counts.
+evalprofile SimpleMath::getProfile(size_t idEQ) {
+    shared_ptr<const Program> pProgram = getProgram(idEQ);
+    if(pProgram) return pProgram->getProfile();
+    evalprofile epProfile;
+    memset(&epProfile, 0, sizeof(epProfile));
+    return epProfile;
+}
+
+void SimpleMath::resetProfiles() {
+    lock_guard<mutex> lGuard(m_Mutex);
+    for(const auto& pProgram : m_Programs) pProgram->resetProfile();
+}
+
+static string_t jsonText(const string_t& sText) {
+    string_t sJSON = "\"";
+    for(char cChar : sText) {
+        if(cChar == '"' || cChar == '\\') {
+            sJSON += '\\';
+            sJSON += cChar;
+        } else
+        if((unsigned char)cChar < 0x20) {
+            char aCode[8];
+            snprintf(aCode, sizeof(aCode), "\\u%04x", (unsigned char)cChar);
+            sJSON += aCode;
+        } else {
+            sJSON += cChar;
+        }
+    }
+    return sJSON + "\"";
+}
+
+static string_t jsonOps(const opstats* pOps) {
+    string_t sJSON = "[";
+    char     aItem[128];
+    for(value_t i=0; i<EVAL_COUNT; i++) {
+        if(pOps[i].count == 0) continue;
+        snprintf(aItem, sizeof(aItem), "%s{\"op\":", sJSON.size() > 1 ? "," : "");
+        sJSON += aItem + jsonText(evalName(i));
+        snprintf(aItem, sizeof(aItem), ",\"code\":%d,\"count\":%llu,\"cycles\":%llu}",
+            i, (unsigned long long)pOps[i].count, (unsigned long long)pOps[i].cycles);
+        sJSON += aItem;
+    }
+    return sJSON + "]";
+}
+
+static string_t jsonProfile(const evalprofile& epProfile) {
+    char aItem[128];
+    snprintf(aItem, sizeof(aItem), "\"calls\":%llu,\"rows\":%llu,\"cycles\":%llu,\"ops\":",
+        (unsigned long long)epProfile.calls, (unsigned long long)epProfile.rows, (unsigned long long)epProfile.cycles);
+    return aItem + jsonOps(epProfile.ops);
+}
+
+/**
+ *  Dumps the profiles as a JSON object. "equations" lists each equation id that has been called since the last reset, with
+ *  its equation text and backend, "sets" and "gradients" list the called sets and gradients by id, and "ops" adds up the
+ *  instructions of all of them. Instructions that did not run are left out of the "ops" arrays. Equations that share a
+ *  program share its counts, which are added to the totals only once.
+ */
+string_t SimpleMath::getProfileJSON() {
+
+    lock_guard<mutex> lGuard(m_Mutex);
+
+    opstats                       aTotal[EVAL_COUNT];
+    unordered_set<const Program*> spSeen;
+    memset(aTotal, 0, sizeof(aTotal));
+
+    auto addEntry = [&](string_t& sList, size_t idEntry, const Program* pProgram, const string_t& sExtra) {
+        if(pProgram == nullptr) return;
+        evalprofile epProfile = pProgram->getProfile();
+        if(epProfile.calls == 0) return;
+        if(spSeen.insert(pProgram).second) {
+            for(size_t i=0; i<EVAL_COUNT; i++) {
+                aTotal[i].count  += epProfile.ops[i].count;
+                aTotal[i].cycles += epProfile.ops[i].cycles;
+            }
+        }
+        sList += sList.empty() ? "{" : ",{";
+        sList += "\"id\":" + to_string(idEntry) + sExtra + "," + jsonProfile(epProfile) + "}";
+    };
+
+    string_t sEqs, sSets, sGrads;
+    for(size_t i=0; i<m_Eqs.size(); i++) {
+        shared_ptr<const Program> pProgram = m_Eqs[i]->getProgram();
+        string_t sExtra = ",\"equation\":" + jsonText(m_Eqs[i]->getEquation()) +
+                          ",\"backend\":" + to_string(m_Eqs[i]->getBackend());
+        addEntry(sEqs, i, pProgram.get(), sExtra);
+    }
+    for(size_t i=0; i<m_Sets.size(); i++) addEntry(sSets, i, m_Sets[i]->getProgram().get(), "");
+    for(size_t i=0; i<m_Grads.size(); i++) addEntry(sGrads, i, m_Grads[i]->getProgram().get(), "");
+
+    return "{\"mode\":" + to_string(Program::getProfiling()) + ",\"equations\":[" + sEqs + "],\"sets\":[" + sSets +
+           "],\"gradients\":[" + sGrads + "],\"ops\":" + jsonOps(aTotal) + "}";
+}
+
+/**
+ *  Writes the equations, sets and gradients of this object to a program file, see programFile.hpp. The payload holds the
+ *  number of distinct equations, of equation ids, of sets and of gradients, then the equation of each id as an index, then
+ *  the image of every distinct equation, set and gradient in order. Equations that share a compiled program are written once.
+ *  The file is written under a temporary name and renamed, so a process loading it never sees a partial file.
+ */
+bool SimpleMath::saveFile(const string_t& sPath) {
+
+    ImageWriter iwBody;
+    {
+        lock_guard<mutex> lGuard(m_Mutex);
+
+        unordered_map<const Math*, uint64_t> mIndex;
+        vector<Math*>                        vpUnique;
+        vector<uint64_t>                     viEq;
+        for(const auto& pEq : m_Eqs) {
+            auto itIndex = mIndex.find(pEq.get());
+            if(itIndex == mIndex.end()) {
+                itIndex = mIndex.emplace(pEq.get(), vpUnique.size()).first;
+                vpUnique.push_back(pEq.get());
+            }
+            viEq.push_back(itIndex->second);
+        }
+
+        iwBody.u64(vpUnique.size());
+        iwBody.u64(m_Eqs.size());
+        iwBody.u64(m_Sets.size());
+        iwBody.u64(m_Grads.size());
+        for(uint64_t iIndex : viEq) iwBody.u64(iIndex);
+        for(Math* pEq : vpUnique) pEq->writeImage(iwBody);
+        for(const auto& pSet : m_Sets) pSet->writeImage(iwBody);
+        for(const auto& pGrad : m_Grads) pGrad->writeImage(iwBody);
+    }
+
+    ImageWriter iwHead;
+    iwHead.m_Data.assign(PF_MAGIC, PF_MAGIC + 8);
+    iwHead.u32(PF_VERSION);
+    iwHead.u32(PF_HEADER_SIZE);
+    iwHead.u64(iwBody.m_Data.size());
+    iwHead.u32(imageChecksum(iwBody.m_Data.data(), iwBody.m_Data.size()));
+    iwHead.u32(0);
+
+    string_t sTemp = sPath + ".tmp";
+    {
+        ofstream fOutput(sTemp, ios::binary | ios::trunc);
+        fOutput.write((const char*)iwHead.m_Data.data(), iwHead.m_Data.size());
+        fOutput.write((const char*)iwBody.m_Data.data(), iwBody.m_Data.size());
+        if(!fOutput.flush()) {
+            printf("Math Error: Cannot write program file '%s'\n", sPath.c_str());
+            remove(sTemp.c_str());
+            return false;
+        }
+    }
+    if(rename(sTemp.c_str(), sPath.c_str()) != 0) {
+        printf("Math Error: Cannot write program file '%s'\n", sPath.c_str());
+        remove(sTemp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ *  Loads the equations, sets and gradients of a file from saveFile into this object, which must not have any yet. They keep
+ *  their ids and backends, and are restored without parsing. The equations also fill the compile cache, so that adding one
+ *  of them again by its text reuses the loaded program.
+ */
+bool SimpleMath::loadFile(const string_t& sPath) {
+
+    {
+        lock_guard<mutex> lGuard(m_Mutex);
+        if(!m_Eqs.empty() || !m_Sets.empty() || !m_Grads.empty()) {
+            printf("Math Error: Program files can only be loaded into an empty SimpleMath\n");
+            return false;
+        }
+    }
+
+    MappedFile mfInput;
+    if(!mfInput.open(sPath)) {
+        printf("Math Error: Cannot read program file '%s'\n", sPath.c_str());
+        return false;
+    }
+
+    if(mfInput.size() < PF_HEADER_SIZE || memcmp(mfInput.data(), PF_MAGIC, 8) != 0) {
+        printf("Math Error: '%s' is not a program file\n", sPath.c_str());
+        return false;
+    }
+
+    ImageReader irHead(mfInput.data() + 8, PF_HEADER_SIZE - 8);
+    uint32_t    nVersion, nHeader, nChecksum, nReserved;
+    uint64_t    nBody;
+    irHead.u32(&nVersion);
+    irHead.u32(&nHeader);
+    irHead.u64(&nBody);
+    irHead.u32(&nChecksum);
+    irHead.u32(&nReserved);
+    if(nVersion != PF_VERSION) {
+        printf("Math Error: Program file '%s' has version %d, but version %d is required\n", sPath.c_str(), (int)nVersion,
+               PF_VERSION);
+        return false;
+    }
+    const uint8_t* pBody = mfInput.data() + PF_HEADER_SIZE;
+    if(nHeader != PF_HEADER_SIZE || nBody != mfInput.size() - PF_HEADER_SIZE || imageChecksum(pBody, nBody) != nChecksum) {
+        printf("Math Error: Program file '%s' is damaged\n", sPath.c_str());
+        return false;
+    }
+
+    ImageReader              irBody(pBody, nBody);
+    size_t                   nUnique, nEqs, nSets, nGrads;
+    vector<uint64_t>         viEq;
+    vector<shared_ptr<Math>> vpUnique, vpSets, vpGrads;
+
+    auto readImages = [&](vector<shared_ptr<Math>>& vpList, size_t nCount) {
+        for(size_t i=0; i<nCount; i++) {
+            vpList.push_back(make_shared<Math>());
+            if(!vpList.back()->readImage(irBody)) return false;
+        }
+        return true;
+    };
+
+    bool isValid = irBody.count(&nUnique, 8) && irBody.count(&nEqs, 8) && irBody.count(&nSets, 8) && irBody.count(&nGrads, 8);
+    if(isValid) viEq.resize(nEqs);
+    for(size_t i=0; isValid && i<nEqs; i++) {
+        isValid = irBody.u64(&viEq[i]) && viEq[i] < nUnique;
+    }
+    isValid = isValid && readImages(vpUnique, nUnique) && readImages(vpSets, nSets) && readImages(vpGrads, nGrads);
+    if(!isValid) {
+        printf("Math Error: Program file '%s' is damaged\n", sPath.c_str());
+        return false;
+    }
+
+    lock_guard<mutex> lGuard(m_Mutex);
+    if(!m_Eqs.empty() || !m_Sets.empty() || !m_Grads.empty()) {
+        printf("Math Error: Program files can only be loaded into an empty SimpleMath\n");
+        return false;
+    }
+
+    scratch& sWork = threadScratch();
+    for(size_t i=0; i<nEqs; i++) {
+        m_Eqs.push_back(vpUnique[viEq[i]]);
+        setSlot(m_Slots, i, m_Eqs[i]->getProgram());
+    }
+    for(const auto& pEq : vpUnique) {
+        shared_ptr<const Program> pProgram = pEq->getProgram();
+        if(!pProgram) continue;
+        pProgram->Prepare(sWork);
+
+        string_t sKey = cacheKey(pEq->getEquation(), pEq->getVariables());
+        if(m_CacheStats.limit > 0 && m_Cache.find(sKey) == m_Cache.end()) {
+            size_t nBytes = pEq->getMemoryUsage() + 2*sKey.size();
+            m_CacheOrder.push_front(sKey);
+            m_Cache[sKey] = cacheEntry({pEq, m_CacheOrder.begin(), nBytes});
+            m_CacheStats.bytes += nBytes;
+        }
+    }
+    trimCache();
+    for(const auto& pSet : vpSets) {
+        if(pSet->getProgram()) pSet->getProgram()->Prepare(sWork);
+    }
+    for(const auto& pGrad : vpGrads) {
+        if(pGrad->getProgram()) pGrad->getProgram()->Prepare(sWork);
+    }
+    for(size_t i=0; i<vpSets.size(); i++) {
+        setSlot(m_SetSlots, i, vpSets[i]->getProgram());
+    }
+    for(size_t i=0; i<vpGrads.size(); i++) {
+        setSlot(m_GradSlots, i, vpGrads[i]->getProgram());
+    }
+    m_Sets.swap(vpSets);
+    m_Grads.swap(vpGrads);
+
+    return true;
+}
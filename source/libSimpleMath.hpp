@@ -7,8 +7,37 @@
 
 #include "clsMath.hpp"
 
+#include <atomic>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+
+// Rows per task of evalEquationParallel are picked so that a task's input and output fit in this many bytes
+#define PARALLEL_CHUNK_BYTES 262144
+
+// The program table grows in chunks that double in size, starting at SM_FIRST_CHUNK entries
+#define SM_FIRST_CHUNK 64
+#define SM_CHUNKS      40
+
+// Default memory bound of the compile cache of addEquation
+#define SM_CACHE_BYTES 67108864
+
 namespace smath {
 
+class ThreadPool;
+
+// Table of the current program of each id, grown in chunks that are never moved, so that it can be read without locking
+typedef std::atomic<std::atomic<const Program*>*> slots_t[SM_CHUNKS];
+
+struct cachestats {
+    size_t hits;       // addEquation calls served from the cache
+    size_t misses;     // addEquation calls that compiled the equation
+    size_t evictions;  // Entries dropped to stay below the memory bound
+    size_t entries;    // Entries in the cache
+    size_t bytes;      // Estimated memory held by the entries
+    size_t limit;      // Memory bound, 0 when the cache is off
+};
+
 class SimpleMath {
 
     public:
@@ -17,11 +46,76 @@ class SimpleMath {
     ~SimpleMath();
 
     size_t   addEquation(string_t, vstring_t);
-    double_t evalEquation(size_t, vdouble_t);
+    bool     setBackend(size_t, value_t);
+    value_t  getBackend(size_t);
+    double_t evalEquation(size_t, const vdouble_t&);
+    double_t evalEquation(size_t, const double_t*, size_t);
+    bool     evalEquationBatch(size_t, const double_t* const*, size_t, double_t*, size_t nStride=1);
+    bool     evalEquationBatch(size_t, const float* const*, size_t, float*, size_t nStride=1);
+    bool     evalEquationParallel(size_t, const double_t* const*, size_t, double_t*, size_t nThreads=0, size_t nStride=1);
+    double_t reduceEquation(size_t, const double_t* const*, size_t, value_t, size_t nThreads=1, size_t nStride=1);
+    bool     filterEquation(size_t, const double_t* const*, size_t, uint64_t*, size_t* pCount=nullptr, size_t nStride=1);
+    bool     selectEquation(size_t, const double_t* const*, size_t, size_t*, size_t*, size_t nStride=1);
+
+    size_t   addEquationSet(const std::vector<size_t>&);
+    bool     evalEquationSet(size_t, const double_t* const*, size_t, double_t* const*, size_t nStride=1);
+
+    std::shared_ptr<const Program> getSetProgram(size_t);
+
+    size_t   addGradient(size_t, value_t idMode=AD_AUTO);
+    double_t evalGradient(size_t, const double_t*, size_t, double_t*);
+    bool     evalGradientBatch(size_t, const double_t* const*, size_t, double_t* const*, size_t nStride=1);
+
+    std::shared_ptr<const Program> getGradientProgram(size_t);
+
+    void       setCacheLimit(size_t);
+    cachestats getCacheStats();
+
+    std::shared_ptr<const Program> getProgram(size_t);
+
+    static void setProfiling(value_t);
+    evalprofile getProfile(size_t);
+    void        resetProfiles();
+    string_t    getProfileJSON();
+
+    bool     saveFile(const string_t&);
+    bool     loadFile(const string_t&);
 
     private:
 
-    std::vector<Math*> m_Eqs;
+    const Program* getSlot(const slots_t&, size_t);
+    void           setSlot(slots_t&, size_t, const std::shared_ptr<const Program>&);
+    void           trimCache();
+    size_t         startPool(size_t);
+
+    // Equations and every program published in the slot tables, changed under m_Mutex only. Equations added with the same
+    // text and variables share one Math object until the backend of one of them is changed. Sets and gradients keep the Math
+    // object they were compiled by, so that saveFile can write them.
+    std::mutex                                  m_Mutex;
+    std::vector<std::shared_ptr<Math>>          m_Eqs;
+    std::vector<std::shared_ptr<const Program>> m_Programs;
+    std::vector<std::shared_ptr<Math>>          m_Sets;
+    std::vector<std::shared_ptr<Math>>          m_Grads;
+
+    // Compile cache, keyed on the normalised equation and its variables, with the most recently used entry first
+    struct cacheEntry {
+        std::shared_ptr<Math>           eq;
+        std::list<string_t>::iterator   order;
+        size_t                          bytes;
+    };
+    std::unordered_map<string_t,cacheEntry>     m_Cache;
+    std::list<string_t>                         m_CacheOrder;
+    cachestats                                  m_CacheStats = {0, 0, 0, 0, 0, SM_CACHE_BYTES};
+
+    // Current program of each equation, set and gradient
+    slots_t                                     m_Slots;
+    slots_t                                     m_SetSlots;
+    slots_t                                     m_GradSlots;
+
+    std::mutex                                  m_PoolMutex;
+    ThreadPool*                                 m_Pool = nullptr;
+    std::vector<scratch>                        m_Scratch;
+    std::vector<std::vector<const double_t*>>   m_WorkCols;
 
 };
 
@@ -0,0 +1,199 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  Program File
+ *  Little endian encoding of the program file, and read-only access to the file itself.
+ */
+
+#include "programFile.hpp"
+
+#include <cstring>
+#include <fstream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PF_MMAP
+#endif
+
+using namespace std;
+using namespace smath;
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Class :: ImageWriter
+ * ======================
+ *  Appends fields byte by byte, so the output does not depend on the byte order of the host. Text is stored as its length
+ *  followed by its bytes, padded to a multiple of 8 bytes like every record.
+ */
+
+void ImageWriter::u32(uint32_t nValue) {
+    for(int i=0; i<4; i++) m_Data.push_back((uint8_t)(nValue >> 8*i));
+}
+
+void ImageWriter::u64(uint64_t nValue) {
+    for(int i=0; i<8; i++) m_Data.push_back((uint8_t)(nValue >> 8*i));
+}
+
+void ImageWriter::f64(double_t dValue) {
+    uint64_t nBits;
+    memcpy(&nBits, &dValue, sizeof(nBits));
+    u64(nBits);
+}
+
+void ImageWriter::text(const string_t& sText) {
+    u64(sText.size());
+    m_Data.insert(m_Data.end(), sText.begin(), sText.end());
+    align();
+}
+
+void ImageWriter::align() {
+    while(m_Data.size() % 8 != 0) m_Data.push_back(0);
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Class :: ImageReader
+ * ======================
+ *  Reads fields from an image, returning false instead of reading past its end. count reads a number of items and checks
+ *  that the image has room for that many of at least nItem bytes each, before the caller sizes anything by it.
+ */
+
+bool ImageReader::u32(uint32_t* pValue) {
+    if(m_Size - m_Pos < 4) return false;
+    uint32_t nValue = 0;
+    for(int i=0; i<4; i++) nValue |= (uint32_t)m_Data[m_Pos+i] << 8*i;
+    m_Pos  += 4;
+    *pValue = nValue;
+    return true;
+}
+
+bool ImageReader::u64(uint64_t* pValue) {
+    if(m_Size - m_Pos < 8) return false;
+    uint64_t nValue = 0;
+    for(int i=0; i<8; i++) nValue |= (uint64_t)m_Data[m_Pos+i] << 8*i;
+    m_Pos  += 8;
+    *pValue = nValue;
+    return true;
+}
+
+bool ImageReader::f64(double_t* pValue) {
+    uint64_t nBits;
+    if(!u64(&nBits)) return false;
+    memcpy(pValue, &nBits, sizeof(nBits));
+    return true;
+}
+
+bool ImageReader::text(string_t* pText) {
+    size_t nSize;
+    if(!count(&nSize, 1)) return false;
+    pText->assign((const char*)m_Data + m_Pos, nSize);
+    m_Pos += nSize;
+    return align();
+}
+
+bool ImageReader::count(size_t* pCount, size_t nItem) {
+    uint64_t nCount;
+    if(!u64(&nCount)) return false;
+    if(nCount > (m_Size - m_Pos)/nItem) return false;
+    *pCount = (size_t)nCount;
+    return true;
+}
+
+bool ImageReader::align() {
+    size_t nPad = (8 - m_Pos % 8) % 8;
+    if(m_Size - m_Pos < nPad) return false;
+    m_Pos += nPad;
+    return true;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: imageChecksum
+ * ===========================
+ *  CRC-32 with the polynomial of zlib and PNG, so a file can be checked with standard tools. Eight bytes are folded in per
+ *  step with eight tables (slicing-by-8), as the whole payload is checked before anything is loaded.
+ */
+
+uint32_t smath::imageChecksum(const uint8_t* pData, size_t nSize) {
+
+    static uint32_t aTable[8][256];
+    static bool     isReady = [] {
+        for(uint32_t i=0; i<256; i++) {
+            uint32_t nCRC = i;
+            for(int k=0; k<8; k++) nCRC = (nCRC & 1) ? 0xedb88320 ^ (nCRC >> 1) : nCRC >> 1;
+            aTable[0][i] = nCRC;
+        }
+        for(uint32_t i=0; i<256; i++) {
+            for(int t=1; t<8; t++) aTable[t][i] = aTable[0][aTable[t-1][i] & 0xff] ^ (aTable[t-1][i] >> 8);
+        }
+        return true;
+    }();
+    (void)isReady;
+
+    uint32_t nCRC = 0xffffffff;
+    size_t   i    = 0;
+    for(; i+8<=nSize; i+=8) {
+        const uint8_t* p = pData + i;
+        uint32_t nLow  = nCRC ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t nHigh = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+        nCRC = aTable[7][nLow & 0xff]          ^ aTable[6][(nLow >> 8) & 0xff]  ^
+               aTable[5][(nLow >> 16) & 0xff]  ^ aTable[4][nLow >> 24]          ^
+               aTable[3][nHigh & 0xff]         ^ aTable[2][(nHigh >> 8) & 0xff] ^
+               aTable[1][(nHigh >> 16) & 0xff] ^ aTable[0][nHigh >> 24];
+    }
+    for(; i<nSize; i++) nCRC = aTable[0][(nCRC ^ pData[i]) & 0xff] ^ (nCRC >> 8);
+
+    return nCRC ^ 0xffffffff;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Class :: MappedFile
+ * =====================
+ *  Maps the file read-only and shared, so processes loading the same file share its pages in the page cache. Platforms
+ *  without mmap read the file into a buffer instead.
+ */
+
+MappedFile::~MappedFile() {
+#ifdef PF_MMAP
+    if(m_Mapped) munmap((void*)m_Data, m_Size);
+#endif
+}
+
+bool MappedFile::open(const string_t& sPath) {
+
+#ifdef PF_MMAP
+    int iFile = ::open(sPath.c_str(), O_RDONLY);
+    if(iFile < 0) return false;
+
+    struct stat sInfo;
+    if(fstat(iFile, &sInfo) != 0) {
+        close(iFile);
+        return false;
+    }
+    m_Size = (size_t)sInfo.st_size;
+    if(m_Size > 0) {
+        void* pMem = mmap(nullptr, m_Size, PROT_READ, MAP_SHARED, iFile, 0);
+        if(pMem != MAP_FAILED) {
+            m_Data   = (const uint8_t*)pMem;
+            m_Mapped = true;
+        }
+    }
+    close(iFile);
+    if(m_Mapped || m_Size == 0) return true;
+#endif
+
+    ifstream fInput(sPath, ios::binary);
+    if(!fInput) return false;
+    m_Buffer.assign(istreambuf_iterator<char>(fInput), istreambuf_iterator<char>());
+    m_Data = m_Buffer.data();
+    m_Size = m_Buffer.size();
+
+    return true;
+}
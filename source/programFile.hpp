@@ -0,0 +1,92 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  Program File
+ *  Binary images of compiled equations, written by SimpleMath::saveFile and read back by SimpleMath::loadFile. Every field is
+ *  stored little endian at an offset that is a multiple of its size, whatever the byte order of the host, so a file can be
+ *  mapped into memory and read in place. The file starts with a header holding the format version and a CRC-32 of the rest.
+ *
+ *  Offset  Size  Header
+ *       0     8  Magic "EQNBPROG"
+ *       8     4  PF_VERSION
+ *      12     4  Size of the header, 32
+ *      16     8  Size of the payload that follows the header
+ *      24     4  CRC-32 of the payload
+ *      28     4  Reserved, 0
+ */
+
+#ifndef PROGRAM_FILE
+#define PROGRAM_FILE
+
+#include "clsMath.hpp"
+
+// The images hold opcodes and the layout of Math, so the version must change with either
+#define PF_MAGIC       "EQNBPROG"
+#define PF_VERSION     1
+#define PF_HEADER_SIZE 32
+
+namespace smath {
+
+class ImageWriter {
+
+public:
+
+    void u32(uint32_t);
+    void u64(uint64_t);
+    void f64(double_t);
+    void text(const string_t&);
+    void align();
+
+    std::vector<uint8_t> m_Data;
+
+};
+
+class ImageReader {
+
+public:
+
+    ImageReader(const uint8_t* pData, size_t nSize) : m_Data(pData), m_Size(nSize) {};
+
+    bool u32(uint32_t*);
+    bool u64(uint64_t*);
+    bool f64(double_t*);
+    bool text(string_t*);
+    bool count(size_t*, size_t);
+    bool align();
+
+private:
+
+    const uint8_t* m_Data;
+    size_t         m_Size;
+    size_t         m_Pos = 0;
+
+};
+
+uint32_t imageChecksum(const uint8_t*, size_t);
+
+// A read-only view of a whole file, mapped into memory where the platform allows it
+class MappedFile {
+
+public:
+
+    MappedFile() {};
+    MappedFile(const MappedFile&) = delete;
+    ~MappedFile();
+
+    bool open(const string_t&);
+
+    const uint8_t* data() { return m_Data; };
+    size_t         size() { return m_Size; };
+
+private:
+
+    const uint8_t*       m_Data = nullptr;
+    size_t               m_Size = 0;
+    bool                 m_Mapped = false;
+    std::vector<uint8_t> m_Buffer;
+
+};
+
+} // End NameSpace
+
+#endif
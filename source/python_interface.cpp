@@ -1,17 +1,291 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  C Interface
+ */
+
+#include "python_interface.h"
 #include "libSimpleMath.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+using namespace std;
+using namespace smath;
+
+typedef function<bool(const double_t* const*, size_t, double_t* const*)> pyeval_t;
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: evalStrided
+ * =========================
+ *  Runs fEval(ppColumns, nStride, ppOutputs) directly on the caller's buffers when all columns share one non-negative
+ *  stride and the outputs are contiguous, which is the case for plain NumPy arrays. Otherwise the columns are gathered into
+ *  contiguous buffers first, and the results scattered to the strided outputs afterwards.
+ */
+
+static bool evalStrided(size_t nVars, const double* const* ppColumns, const int64_t* pStrides, size_t nRows,
+                        size_t nOuts, double* const* ppOutputs, const int64_t* pOutStrides, const pyeval_t& fEval) {
+
+    if(nVars > 0 && (ppColumns == nullptr || pStrides == nullptr)) {
+        printf("Math Eval Error: No value columns given\n");
+        return false;
+    }
+    if(ppOutputs == nullptr) {
+        printf("Math Eval Error: No output columns given\n");
+        return false;
+    }
+
+    bool isDirect = nVars == 0 || pStrides[0] >= 0;
+    for(size_t v=1; v<nVars; v++)        isDirect = isDirect && pStrides[v] == pStrides[0];
+    for(size_t k=0; k<nOuts && pOutStrides; k++) isDirect = isDirect && pOutStrides[k] == 1;
+
+    if(isDirect) {
+        return fEval(ppColumns, nVars > 0 ? (size_t)pStrides[0] : 1, ppOutputs);
+    }
+
+    vector<vdouble_t>       vdCols(nVars, vdouble_t(nRows));
+    vector<vdouble_t>       vdOuts(nOuts, vdouble_t(nRows));
+    vector<const double_t*> vpCols(nVars);
+    vector<double_t*>       vpOuts(nOuts);
+
+    for(size_t v=0; v<nVars; v++) {
+        for(size_t i=0; i<nRows; i++) vdCols[v][i] = ppColumns[v][(int64_t)i*pStrides[v]];
+        vpCols[v] = vdCols[v].data();
+    }
+    for(size_t k=0; k<nOuts; k++) vpOuts[k] = vdOuts[k].data();
+
+    if(!fEval(vpCols.data(), 1, vpOuts.data())) return false;
+
+    for(size_t k=0; k<nOuts; k++) {
+        int64_t nStride = pOutStrides ? pOutStrides[k] : 1;
+        for(size_t i=0; i<nRows; i++) ppOutputs[k][(int64_t)i*nStride] = vdOuts[k][i];
+    }
+
+    return true;
+}
+
+// ****************************************************************************************************************************** //
+
 extern "C" {
-    smath::SimpleMath* py_smath_init() {
-        printf("C interface says hi!\n");
-        return new smath::SimpleMath();
+
+void* py_smath_new() {
+    return new SimpleMath();
+}
+
+void py_smath_free(void* pMath) {
+    delete (SimpleMath*)pMath;
+}
+
+/**
+ *  Adds an equation with nVars variable names, and returns its id or -1 if it does not compile
+ */
+int64_t py_smath_add_eq(void* pMath, const char* pEquation, const char* const* ppVars, size_t nVars) {
+
+    SimpleMath* pSM = (SimpleMath*)pMath;
+    vstring_t   vsVars;
+    for(size_t v=0; v<nVars; v++) vsVars.push_back(ppVars[v]);
+
+    size_t idEQ = pSM->addEquation(pEquation, vsVars);
+    if(!pSM->getProgram(idEQ)) return -1;
+
+    return (int64_t)idEQ;
+}
+
+/**
+ *  The id checks below go through getProgram, which returns an empty pointer for ids that were never handed out
+ */
+int py_smath_set_backend(void* pMath, int64_t idEQ, int idBackend) {
+    SimpleMath* pSM = (SimpleMath*)pMath;
+    if(idEQ < 0 || !pSM->getProgram((size_t)idEQ)) return 0;
+    return pSM->setBackend((size_t)idEQ, idBackend) ? 1 : 0;
+}
+
+int py_smath_get_backend(void* pMath, int64_t idEQ) {
+    SimpleMath* pSM = (SimpleMath*)pMath;
+    if(idEQ < 0 || !pSM->getProgram((size_t)idEQ)) return -1;
+    return pSM->getBackend((size_t)idEQ);
+}
+
+double py_smath_eval_eq(void* pMath, int64_t idEQ, const double* pValues, size_t nValues) {
+    if(idEQ < 0) return NAN;
+    return ((SimpleMath*)pMath)->evalEquation((size_t)idEQ, pValues, nValues);
+}
+
+/**
+ *  Evaluates an equation on nRows rows of columns with a stride each, writing to pOutput with stride nOutStride. nThreads
+ *  1 runs on the calling thread, any other value uses evalEquationParallel, with 0 for one thread per hardware thread.
+ *  Returns 1 on success and 0 on error.
+ */
+int py_smath_eval_batch(void* pMath, int64_t idEQ, const double* const* ppColumns, const int64_t* pStrides, size_t nRows,
+                        double* pOutput, int64_t nOutStride, size_t nThreads) {
+
+    SimpleMath*               pSM      = (SimpleMath*)pMath;
+    shared_ptr<const Program> pProgram = idEQ >= 0 ? pSM->getProgram((size_t)idEQ) : nullptr;
+    if(!pProgram) {
+        printf("Math Eval Error: No valid equation to evaluate\n");
+        return 0;
     }
-    int py_smath_add_eq(smath::SimpleMath* smath, char* inEq, char* inVars){
-        string_t  theEQ;
-        vstring_t theVars;
-        return smath->addEquation(theEQ, theVars);
+
+    return evalStrided(pProgram->getVariableCount(), ppColumns, pStrides, nRows, 1, &pOutput, &nOutStride,
+        [&](const double_t* const* ppCols, size_t nStride, double_t* const* ppOuts) {
+            if(nThreads == 1) return pSM->evalEquationBatch((size_t)idEQ, ppCols, nRows, ppOuts[0], nStride);
+            return pSM->evalEquationParallel((size_t)idEQ, ppCols, nRows, ppOuts[0], nThreads, nStride);
+        }) ? 1 : 0;
+}
+
+/**
+ *  Reduces the results of an equation on strided columns to one value with idReduce, see SimpleMath::reduceEquation.
+ *  Returns NaN on error.
+ */
+double py_smath_reduce(void* pMath, int64_t idEQ, const double* const* ppColumns, const int64_t* pStrides, size_t nRows,
+                       int idReduce, size_t nThreads) {
+
+    SimpleMath*               pSM      = (SimpleMath*)pMath;
+    shared_ptr<const Program> pProgram = idEQ >= 0 ? pSM->getProgram((size_t)idEQ) : nullptr;
+    if(!pProgram) {
+        printf("Math Eval Error: No valid equation to evaluate\n");
+        return NAN;
+    }
+
+    // There are no output columns, but evalStrided needs somewhere to point
+    double_t* pNone   = nullptr;
+    double_t  dResult = NAN;
+    evalStrided(pProgram->getVariableCount(), ppColumns, pStrides, nRows, 0, &pNone, nullptr,
+        [&](const double_t* const* ppCols, size_t nStride, double_t* const*) {
+            dResult = pSM->reduceEquation((size_t)idEQ, ppCols, nRows, idReduce, nThreads, nStride);
+            return true;
+        });
+
+    return dResult;
+}
+
+/**
+ *  Selects the rows of strided columns where an equation is not false, see SimpleMath::filterEquation. Writes a bitmap of
+ *  them to pBitmap and their indices to pSelection, either of which may be null, and their number to pCount. Returns 1 on
+ *  success and 0 on error.
+ */
+int py_smath_filter(void* pMath, int64_t idEQ, const double* const* ppColumns, const int64_t* pStrides, size_t nRows,
+                    uint64_t* pBitmap, size_t* pSelection, size_t* pCount) {
+
+    SimpleMath*               pSM      = (SimpleMath*)pMath;
+    shared_ptr<const Program> pProgram = idEQ >= 0 ? pSM->getProgram((size_t)idEQ) : nullptr;
+    if(!pProgram) {
+        printf("Math Eval Error: No valid equation to evaluate\n");
+        return 0;
     }
-    double py_smath_eval_eq(smath::SimpleMath* smath, int inID, double inVals) {
-        vdouble_t theVals;
-        return smath->evalEquation((size_t)inID, theVals);
+
+    double_t* pNone = nullptr;
+    return evalStrided(pProgram->getVariableCount(), ppColumns, pStrides, nRows, 0, &pNone, nullptr,
+        [&](const double_t* const* ppCols, size_t nStride, double_t* const*) {
+            if(pSelection) {
+                if(!pSM->selectEquation((size_t)idEQ, ppCols, nRows, pSelection, pCount, nStride)) return false;
+                if(!pBitmap) return true;
+            }
+            return pSM->filterEquation((size_t)idEQ, ppCols, nRows, pBitmap, pCount, nStride);
+        }) ? 1 : 0;
+}
+
+/**
+ *  Combines nIds equations into a set, and returns its id or -1 if the equations can not be combined
+ */
+int64_t py_smath_add_set(void* pMath, const int64_t* pIds, size_t nIds) {
+
+    SimpleMath*    pSM = (SimpleMath*)pMath;
+    vector<size_t> vIds(pIds, pIds + nIds);
+
+    size_t idSet = pSM->addEquationSet(vIds);
+    if(!pSM->getSetProgram(idSet)) return -1;
+
+    return (int64_t)idSet;
+}
+
+/**
+ *  Evaluates a set with one output column per equation, each with its own stride. Returns 1 on success and 0 on error.
+ */
+int py_smath_eval_set(void* pMath, int64_t idSet, const double* const* ppColumns, const int64_t* pStrides, size_t nRows,
+                      double* const* ppOutputs, const int64_t* pOutStrides) {
+
+    SimpleMath*               pSM      = (SimpleMath*)pMath;
+    shared_ptr<const Program> pProgram = idSet >= 0 ? pSM->getSetProgram((size_t)idSet) : nullptr;
+    if(!pProgram) {
+        printf("Math Eval Error: No valid equation set to evaluate\n");
+        return 0;
     }
+
+    return evalStrided(pProgram->getVariableCount(), ppColumns, pStrides, nRows, pProgram->getOutputCount(), ppOutputs,
+        pOutStrides, [&](const double_t* const* ppCols, size_t nStride, double_t* const* ppOuts) {
+            return pSM->evalEquationSet((size_t)idSet, ppCols, nRows, ppOuts, nStride);
+        }) ? 1 : 0;
 }
+
+/**
+ *  Compiles the gradient of an equation with differentiation mode idMode, and returns its id or -1 on error
+ */
+int64_t py_smath_add_grad(void* pMath, int64_t idEQ, int idMode) {
+
+    SimpleMath* pSM = (SimpleMath*)pMath;
+    if(idEQ < 0 || !pSM->getProgram((size_t)idEQ)) return -1;
+
+    size_t idGrad = pSM->addGradient((size_t)idEQ, idMode);
+    if(!pSM->getGradientProgram(idGrad)) return -1;
+
+    return (int64_t)idGrad;
+}
+
+/**
+ *  Returns the value of the equation, and writes its derivative by each variable to pGradient
+ */
+double py_smath_eval_grad(void* pMath, int64_t idGrad, const double* pValues, size_t nValues, double* pGradient) {
+    if(idGrad < 0) return NAN;
+    return ((SimpleMath*)pMath)->evalGradient((size_t)idGrad, pValues, nValues, pGradient);
+}
+
+/**
+ *  Evaluates a gradient with the value in the first output column and one derivative per variable in the following ones,
+ *  each with its own stride. Returns 1 on success and 0 on error.
+ */
+int py_smath_eval_grad_batch(void* pMath, int64_t idGrad, const double* const* ppColumns, const int64_t* pStrides,
+                             size_t nRows, double* const* ppOutputs, const int64_t* pOutStrides) {
+
+    SimpleMath*               pSM      = (SimpleMath*)pMath;
+    shared_ptr<const Program> pProgram = idGrad >= 0 ? pSM->getGradientProgram((size_t)idGrad) : nullptr;
+    if(!pProgram) {
+        printf("Math Eval Error: No valid gradient to evaluate\n");
+        return 0;
+    }
+
+    return evalStrided(pProgram->getVariableCount(), ppColumns, pStrides, nRows, pProgram->getOutputCount(), ppOutputs,
+        pOutStrides, [&](const double_t* const* ppCols, size_t nStride, double_t* const* ppOuts) {
+            return pSM->evalGradientBatch((size_t)idGrad, ppCols, nRows, ppOuts, nStride);
+        }) ? 1 : 0;
+}
+
+/**
+ *  Profiling is process wide, and turned on or off for every SimpleMath object at once
+ */
+void py_smath_set_profiling(int idMode) {
+    SimpleMath::setProfiling(idMode);
+}
+
+void py_smath_reset_profiles(void* pMath) {
+    ((SimpleMath*)pMath)->resetProfiles();
+}
+
+/**
+ *  Copies the profile as JSON to pBuffer, truncated to nSize bytes including the terminating null. Returns the length of
+ *  the full text, so a caller can retry with a buffer of that length plus one.
+ */
+size_t py_smath_profile_json(void* pMath, char* pBuffer, size_t nSize) {
+    string_t sJSON = ((SimpleMath*)pMath)->getProfileJSON();
+    if(pBuffer != nullptr && nSize > 0) {
+        size_t nCopy = min(sJSON.size(), nSize-1);
+        memcpy(pBuffer, sJSON.data(), nCopy);
+        pBuffer[nCopy] = '\0';
+    }
+    return sJSON.size();
+}
+
+} // End Extern C
@@ -0,0 +1,49 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  C Interface
+ *  Plain C functions around SimpleMath, used by the Python wrapper through ctypes and usable from any language with a C
+ *  foreign function interface. Equation ids are returned as int64_t, with -1 for an equation that does not compile.
+ *
+ *  Columns are passed as one pointer per variable with a stride per column, counted in values rather than bytes. A stride
+ *  of 0 repeats the first value for every row. Outputs are written to caller owned buffers, which may also be strided.
+ */
+
+#ifndef PY_INTERFACE
+#define PY_INTERFACE
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void*   py_smath_new();
+void    py_smath_free(void*);
+
+int64_t py_smath_add_eq(void*, const char*, const char* const*, size_t);
+int     py_smath_set_backend(void*, int64_t, int);
+int     py_smath_get_backend(void*, int64_t);
+
+double  py_smath_eval_eq(void*, int64_t, const double*, size_t);
+int     py_smath_eval_batch(void*, int64_t, const double* const*, const int64_t*, size_t, double*, int64_t, size_t);
+double  py_smath_reduce(void*, int64_t, const double* const*, const int64_t*, size_t, int, size_t);
+int     py_smath_filter(void*, int64_t, const double* const*, const int64_t*, size_t, uint64_t*, size_t*, size_t*);
+
+int64_t py_smath_add_set(void*, const int64_t*, size_t);
+int     py_smath_eval_set(void*, int64_t, const double* const*, const int64_t*, size_t, double* const*, const int64_t*);
+
+int64_t py_smath_add_grad(void*, int64_t, int);
+double  py_smath_eval_grad(void*, int64_t, const double*, size_t, double*);
+int     py_smath_eval_grad_batch(void*, int64_t, const double* const*, const int64_t*, size_t, double* const*, const int64_t*);
+
+void    py_smath_set_profiling(int);
+void    py_smath_reset_profiles(void*);
+size_t  py_smath_profile_json(void*, char*, size_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  SIMD Batch Kernels
+ *  Runtime selection of the instruction set
+ */
+
+#include "simdKernel.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+using namespace smath;
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: simdSelect
+ * ========================
+ *  Picks the widest kernel the CPU supports, limited by the SMATH_SIMD environment variable if it is set. The two lane SSE2
+ *  kernel is only used when asked for explicitly, as its vector libm is no faster than the system one.
+ */
+
+static value_t simdSelect() {
+
+    const char* sLimit = getenv("SMATH_SIMD");
+    value_t     iLimit = 3;
+
+    if(sLimit != nullptr) {
+        if(strcmp(sLimit, "none")   == 0) iLimit = 0;
+        if(strcmp(sLimit, "sse2")   == 0) iLimit = 1;
+        if(strcmp(sLimit, "avx2")   == 0) iLimit = 2;
+        if(strcmp(sLimit, "avx512") == 0) iLimit = 3;
+    }
+
+    __builtin_cpu_init();
+    if(iLimit >= 3 && __builtin_cpu_supports("avx512f")) return 3;
+    if(iLimit >= 2 && __builtin_cpu_supports("avx2"))    return 2;
+    if(iLimit == 1 && __builtin_cpu_supports("sse2"))    return 1;
+
+    return 0;
+}
+
+static value_t simdLevel() {
+    static value_t iLevel = simdSelect();
+    return iLevel;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: simdKernel
+ * ========================
+ *  Returns the selected batch kernel, or nullptr if the scalar block interpreter should be used
+ */
+
+simdkernel_t smath::simdKernel() {
+
+    switch(simdLevel()) {
+        case 3: return simd_avx512::evalBatch;
+        case 2: return simd_avx2::evalBatch;
+        case 1: return simd_sse2::evalBatch;
+    }
+
+    return nullptr;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: simdKernelF
+ * =========================
+ *  Returns the single precision version of the selected batch kernel, with twice as many lanes per vector
+ */
+
+simdkernelf_t smath::simdKernelF() {
+
+    switch(simdLevel()) {
+        case 3: return simd_avx512::evalBatchF;
+        case 2: return simd_avx2::evalBatchF;
+        case 1: return simd_sse2::evalBatchF;
+    }
+
+    return nullptr;
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: simdName
+ * ======================
+ *  Returns the name of the selected instruction set
+ */
+
+const char* smath::simdName() {
+
+    switch(simdLevel()) {
+        case 3: return "avx512";
+        case 2: return "avx2";
+        case 1: return "sse2";
+    }
+
+    return "none";
+}
+
+// ****************************************************************************************************************************** //
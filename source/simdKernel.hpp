@@ -0,0 +1,39 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  SIMD Batch Kernels
+ *  Vectorised versions of the EvalBatch block interpreter, one per instruction set. The best kernel supported by the CPU is
+ *  selected at runtime, so the library can be built for a generic x86-64 target and still use AVX2 or AVX-512 where present.
+ *  The environment variable SMATH_SIMD can be set to none, sse2, avx2 or avx512 to limit the selection.
+ */
+
+#ifndef SIMD_KERNEL
+#define SIMD_KERNEL
+
+#include "clsMath.hpp"
+
+namespace smath {
+
+typedef bool (*simdkernel_t)(const instr*, const double_t*, const double_t* const*, size_t, size_t, double_t* const*, size_t,
+                             double_t*, double_t*);
+typedef bool (*simdkernelf_t)(const instr*, const float*, const float* const*, size_t, size_t, float* const*, size_t,
+                              float*, float*);
+
+#define SIMD_DECLARE \
+    bool evalBatch(const instr*, const double_t*, const double_t* const*, size_t, size_t, double_t* const*, size_t, \
+                   double_t*, double_t*); \
+    bool evalBatchF(const instr*, const float*, const float* const*, size_t, size_t, float* const*, size_t, float*, float*);
+
+namespace simd_sse2   { SIMD_DECLARE }
+namespace simd_avx2   { SIMD_DECLARE }
+namespace simd_avx512 { SIMD_DECLARE }
+
+#undef SIMD_DECLARE
+
+simdkernel_t  simdKernel();
+simdkernelf_t simdKernelF();
+const char*   simdName();
+
+} // End NameSpace
+
+#endif
@@ -0,0 +1,11 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  SIMD Batch Kernels
+ *  AVX2 kernel, 4 doubles per vector
+ */
+
+#define SIMD_WIDTH     4
+#define SIMD_NAMESPACE simd_avx2
+
+#include "simdKernelImpl.hpp"
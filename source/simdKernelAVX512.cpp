@@ -0,0 +1,11 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  SIMD Batch Kernels
+ *  AVX512 kernel, 8 doubles per vector
+ */
+
+#define SIMD_WIDTH     8
+#define SIMD_NAMESPACE simd_avx512
+
+#include "simdKernelImpl.hpp"
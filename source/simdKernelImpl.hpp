@@ -0,0 +1,560 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  SIMD Batch Kernels
+ *  Generic implementation, included once per instruction set with SIMD_WIDTH and SIMD_NAMESPACE defined. Each inclusion is
+ *  compiled with different target flags, so everything here is kept inside that namespace.
+ *
+ *  The kernels are compiled without floating point contraction, so every instruction set performs the same sequence of IEEE
+ *  operations and returns bit identical results. The vectorised elementary functions follow the Cephes Math Library
+ *  (http://www.netlib.org/cephes/). Lanes outside the range of an approximation, such as non-finite values, zeros for log and
+ *  atan2, or very large arguments for sin and cos, are recomputed with the system libm.
+ *
+ *  Masks and integer bookkeeping are kept in double arithmetic where possible, since 64 bit integer compares and arithmetic
+ *  shifts have no native SSE2 or AVX2 instruction.
+ */
+
+#include "simdKernel.hpp"
+
+#include <cstring>
+#include <cfloat>
+#include <algorithm>
+
+namespace smath {
+namespace SIMD_NAMESPACE {
+
+typedef double   vdbl_t __attribute__((vector_size(SIMD_WIDTH*8)));
+typedef int64_t  vint_t __attribute__((vector_size(SIMD_WIDTH*8)));
+typedef uint64_t vuint_t __attribute__((vector_size(SIMD_WIDTH*8)));
+typedef float    vflt_t __attribute__((vector_size(SIMD_WIDTH*8)));
+typedef int32_t  vfint_t __attribute__((vector_size(SIMD_WIDTH*8)));
+typedef float    vhflt_t __attribute__((vector_size(SIMD_WIDTH*4)));
+
+#define SIMD_SIGN 0x8000000000000000LL
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Vector Helpers
+ * ================
+ */
+
+static inline vdbl_t vLoad(const double* pSrc) {
+    vdbl_t vVal;
+    memcpy(&vVal, pSrc, sizeof(vVal));
+    return vVal;
+}
+
+static inline void vStore(double* pDst, vdbl_t vVal) {
+    memcpy(pDst, &vVal, sizeof(vVal));
+}
+
+// Copies tVal into every lane. Adding it to a zero vector instead would turn -0.0 into +0.0.
+template<typename V, typename T> static inline V vSplat(T tVal) {
+    V vVal;
+    for(size_t i=0; i<sizeof(V)/sizeof(T); i++) vVal[i] = tVal;
+    return vVal;
+}
+
+static inline vdbl_t vSet(double dVal) {
+    return vSplat<vdbl_t>(dVal);
+}
+
+static inline vdbl_t vBlend(vint_t vMask, vdbl_t vTrue, vdbl_t vFalse) {
+    return (vdbl_t)(((vint_t)vTrue & vMask) | ((vint_t)vFalse & ~vMask));
+}
+
+static inline vdbl_t vBool(vint_t vMask) {
+    return (vdbl_t)(vMask & (vint_t)vSet(EVAL_TRUE));
+}
+
+static inline vdbl_t vAbs(vdbl_t vVal) {
+    return (vdbl_t)((vint_t)vVal & ~SIMD_SIGN);
+}
+
+static inline vdbl_t vFlip(vint_t vMask, vdbl_t vVal) {
+    return (vdbl_t)((vint_t)vVal ^ (vMask & SIMD_SIGN));
+}
+
+// Single precision versions of the helpers used by the block interpreter
+static inline vflt_t vLoad(const float* pSrc) {
+    vflt_t vVal;
+    memcpy(&vVal, pSrc, sizeof(vVal));
+    return vVal;
+}
+
+static inline void vStore(float* pDst, vflt_t vVal) {
+    memcpy(pDst, &vVal, sizeof(vVal));
+}
+
+static inline vflt_t vBlend(vfint_t vMask, vflt_t vTrue, vflt_t vFalse) {
+    return (vflt_t)(((vfint_t)vTrue & vMask) | ((vfint_t)vFalse & ~vMask));
+}
+
+static inline vflt_t vBool(vfint_t vMask) {
+    return (vflt_t)(vMask & (vfint_t)vSplat<vflt_t>((float)EVAL_TRUE));
+}
+
+static inline vflt_t vAbs(vflt_t vVal) {
+    return (vflt_t)((vfint_t)vVal & 0x7fffffff);
+}
+
+static inline vdbl_t vMin(vdbl_t vA, vdbl_t vB) {
+    return vBlend(vA < vB, vA, vB);
+}
+
+static inline vdbl_t vMax(vdbl_t vA, vdbl_t vB) {
+    return vBlend(vA > vB, vA, vB);
+}
+
+// Rounds to nearest, valid for |x| < 2^51
+static inline vdbl_t vRound(vdbl_t vVal) {
+    return (vVal + 6755399441055744.0) - 6755399441055744.0;
+}
+
+static inline vdbl_t vFloor(vdbl_t vVal) {
+    vdbl_t vRnd = vRound(vVal);
+    return vBlend(vRnd > vVal, vRnd - 1.0, vRnd);
+}
+
+// Converts an integer valued vector to integers, valid for |x| < 2^51
+static inline vint_t vToInt(vdbl_t vVal) {
+    return (vint_t)(vVal + 6755399441055744.0) - (vint_t)vSet(6755399441055744.0);
+}
+
+// Converts integers to doubles, valid for |n| < 2^51
+static inline vdbl_t vToDbl(vint_t vInt) {
+    return (vdbl_t)((vint_t)vSet(6755399441055744.0) + vInt) - 6755399441055744.0;
+}
+
+// Returns 2^n for integer n in the normal exponent range
+static inline vdbl_t vPow2(vint_t vInt) {
+    return (vdbl_t)((vInt + 1023) << 52);
+}
+
+static inline bool vAny(vint_t vMask) {
+    vint_t vOr = vMask;
+    for(int i=1; i<SIMD_WIDTH; i++) vOr[0] |= vMask[i];
+    return vOr[0] != 0;
+}
+
+static inline vint_t vIsFinite(vdbl_t vVal) {
+    return vAbs(vVal) <= DBL_MAX;
+}
+
+// Recomputes the masked lanes with a scalar function
+static inline vdbl_t vPatch(vint_t vMask, vdbl_t vRes, vdbl_t vArg, double_t (*pFunc)(double_t)) {
+    if(vAny(vMask)) {
+        for(int i=0; i<SIMD_WIDTH; i++) {
+            if(vMask[i]) vRes[i] = pFunc(vArg[i]);
+        }
+    }
+    return vRes;
+}
+
+static inline vdbl_t vPatch2(vint_t vMask, vdbl_t vRes, vdbl_t vArgA, vdbl_t vArgB, double_t (*pFunc)(double_t,double_t)) {
+    if(vAny(vMask)) {
+        for(int i=0; i<SIMD_WIDTH; i++) {
+            if(vMask[i]) vRes[i] = pFunc(vArgA[i], vArgB[i]);
+        }
+    }
+    return vRes;
+}
+
+static double_t sLog(double_t dVal)                { return std::log(dVal); }
+static double_t sSin(double_t dVal)                { return std::sin(dVal); }
+static double_t sCos(double_t dVal)                { return std::cos(dVal); }
+static double_t sTan(double_t dVal)                { return std::tan(dVal); }
+static double_t sPow(double_t dValA, double_t dValB)   { return std::pow(dValA, dValB); }
+static double_t sAtan2(double_t dValA, double_t dValB) { return std::atan2(dValA, dValB); }
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Vector Elementary Functions
+ * =============================
+ */
+
+static inline vdbl_t vExp(vdbl_t vX) {
+
+    vdbl_t vC = vMin(vMax(vX, vSet(-745.2)), vSet(709.8));
+    vdbl_t vN = vRound(vC * 1.4426950408889634073599);
+    vdbl_t vR = (vC - vN*6.93145751953125e-1) - vN*1.42860682030941723212e-6;
+    vdbl_t vZ = vR*vR;
+
+    vdbl_t vP = vR * ((1.26177193074810590878e-4*vZ + 3.02994407707441961300e-2)*vZ + 9.99999999999999999910e-1);
+    vdbl_t vQ = ((3.00198505138664455042e-6*vZ + 2.52448340349684104192e-3)*vZ + 2.27265548208155028766e-1)*vZ
+              + 2.00000000000000000009e0;
+    vdbl_t vE = 1.0 + 2.0*(vP/(vQ - vP));
+
+    // Scale in two steps so that 2^n stays in the normal range for the full input range
+    vdbl_t vH = vFloor(vN*0.5);
+    vE = (vE * vPow2(vToInt(vH))) * vPow2(vToInt(vN - vH));
+
+    vE = vBlend(vX >  7.09782712893383996843e2, vSet(HUGE_VAL), vE);
+    vE = vBlend(vX < -7.451332191019412076e2,   vSet(0.0),      vE);
+    vE = vBlend(vX != vX, vX, vE);
+
+    return vE;
+}
+
+static inline vdbl_t vLog(vdbl_t vX) {
+
+    vint_t vBits = (vint_t)vX;
+    vint_t vInt  = (vint_t)((vuint_t)vBits >> 52) - 1022;
+    vdbl_t vM    = (vdbl_t)((vBits & 0x000fffffffffffffLL) | 0x3fe0000000000000LL);
+
+    // The sign bit is set only for inputs that are patched below
+
+    // Mantissa in [sqrt(1/2), sqrt(2)) minus one
+    vint_t vLow  = vM < 7.07106781186547524401e-1;
+    vdbl_t vE    = vToDbl(vInt);
+    vE = vBlend(vLow, vE - 1.0, vE);
+    vM = vBlend(vLow, vM + vM - 1.0, vM - 1.0);
+
+    vdbl_t vZ = vM*vM;
+    vdbl_t vP = ((((1.01875663804580931796e-4*vM + 4.97494994976747001425e-1)*vM + 4.70579119878881725854e0)*vM
+              + 1.44989225341610930846e1)*vM + 1.79368678507819816313e1)*vM + 7.70838733755885391666e0;
+    vdbl_t vQ = ((((vM + 1.12873587189167450590e1)*vM + 4.52279145837532221105e1)*vM + 8.29875266912776603211e1)*vM
+              + 7.11544750618563894466e1)*vM + 2.31251620126765340583e1;
+    vdbl_t vY = vM * (vZ * vP / vQ);
+
+    vY = vY - vE*2.121944400546905827679e-4;
+    vY = vY - 0.5*vZ;
+    vY = vM + vY;
+    vY = vY + vE*0.693359375;
+
+    return vPatch(~((vX >= DBL_MIN) & (vX <= DBL_MAX)), vY, vX, sLog);
+}
+
+static inline void vSinCos(vdbl_t vX, vdbl_t* pSin, vdbl_t* pCos) {
+
+    vdbl_t vA = vAbs(vX);
+    vdbl_t vY = vFloor(vA * 1.27323954473516268615);
+
+    // Map zeros to origin, then octant j in 0, 2, 4, 6
+    vY = vY + (vY - 2.0*vFloor(vY*0.5));
+    vdbl_t vJ = vY - 8.0*vFloor(vY*0.125);
+
+    vdbl_t vZ  = ((vA - vY*7.85398125648498535156e-1) - vY*3.77489470793079817668e-8) - vY*2.69515142907905952645e-15;
+    vdbl_t vZZ = vZ*vZ;
+
+    vdbl_t vPS = (((((1.58962301576546568060e-10*vZZ - 2.50507477628578072866e-8)*vZZ + 2.75573136213857245213e-6)*vZZ
+               - 1.98412698295895385996e-4)*vZZ + 8.33333333332211858878e-3)*vZZ - 1.66666666666666307295e-1);
+    vdbl_t vPC = (((((-1.13585365213876817300e-11*vZZ + 2.08757008419747316778e-9)*vZZ - 2.75573141792967388112e-7)*vZZ
+               + 2.48015872888517045348e-5)*vZZ - 1.38888888888730564116e-3)*vZZ + 4.16666666666665929218e-2);
+    vPS = vZ + vZ*vZZ*vPS;
+    vPC = 1.0 - 0.5*vZZ + vZZ*vZZ*vPC;
+
+    vint_t vSwap = (vJ == 2.0) | (vJ == 6.0);
+    vint_t vNegS = (vJ >= 4.0) ^ (vX < 0.0);
+    vint_t vNegC = (vJ == 2.0) | (vJ == 4.0);
+
+    *pSin = vFlip(vNegS, vBlend(vSwap, vPC, vPS));
+    *pCos = vFlip(vNegC, vBlend(vSwap, vPS, vPC));
+}
+
+// Sine, tangent and arctangent of -0.0 are -0.0 as in libm, so zero lanes return their input to keep the sign
+
+static inline vdbl_t vSin(vdbl_t vX) {
+    vdbl_t vS, vC;
+    vSinCos(vX, &vS, &vC);
+    return vPatch(~(vAbs(vX) < 1.0e8), vBlend(vX == 0.0, vX, vS), vX, sSin);
+}
+
+static inline vdbl_t vCos(vdbl_t vX) {
+    vdbl_t vS, vC;
+    vSinCos(vX, &vS, &vC);
+    return vPatch(~(vAbs(vX) < 1.0e8), vC, vX, sCos);
+}
+
+static inline vdbl_t vTan(vdbl_t vX) {
+    vdbl_t vS, vC;
+    vSinCos(vX, &vS, &vC);
+    return vPatch(~(vAbs(vX) < 1.0e8), vBlend(vX == 0.0, vX, vS/vC), vX, sTan);
+}
+
+static inline vdbl_t vAtan(vdbl_t vX) {
+
+    vdbl_t vA   = vAbs(vX);
+    vint_t vBig = vA > 2.41421356237309504880;
+    vint_t vMid = ~vBig & (vA > 0.66);
+
+    vdbl_t vY = vBlend(vBig, vSet(1.57079632679489661923), vBlend(vMid, vSet(0.78539816339744830962), vSet(0.0)));
+    vdbl_t vT = vBlend(vBig, -1.0/vA, vBlend(vMid, (vA - 1.0)/(vA + 1.0), vA));
+    vdbl_t vZ = vT*vT;
+
+    vdbl_t vP = (((-8.750608600031904122785e-1*vZ - 1.615753718733365076637e1)*vZ - 7.500855792314704667340e1)*vZ
+              - 1.228866684490136173410e2)*vZ - 6.485021904942025371773e1;
+    vdbl_t vQ = ((((vZ + 2.485846490142306297962e1)*vZ + 1.650270098316988542046e2)*vZ + 4.328810604912902668951e2)*vZ
+              + 4.853903996359136964868e2)*vZ + 1.945506571482613964425e2;
+    vZ = vZ * vP / vQ;
+    vZ = vT*vZ + vT;
+    vZ = vBlend(vBig, vZ + 6.123233995736765886130e-17, vBlend(vMid, vZ + 0.5*6.123233995736765886130e-17, vZ));
+
+    return vBlend(vX == 0.0, vX, vFlip(vX < 0.0, vY + vZ));
+}
+
+static inline vdbl_t vAtan2(vdbl_t vY, vdbl_t vX) {
+
+    vdbl_t vZ = vAtan(vY/vX);
+    vZ = vBlend(vX < 0.0, vBlend(vY >= 0.0, vZ + 3.14159265358979323846, vZ - 3.14159265358979323846), vZ);
+
+    vint_t vBad = (vX == 0.0) | (vY == 0.0) | ~vIsFinite(vX) | ~vIsFinite(vY);
+    return vPatch2(vBad, vZ, vY, vX, sAtan2);
+}
+
+static inline vdbl_t vPow(vdbl_t vA, vdbl_t vB) {
+
+    // Small integer exponents by repeated squaring, which also covers negative bases. Each squaring doubles the relative
+    // error, so this is limited to |y| <= 8.
+    vdbl_t vAbsB = vAbs(vB);
+    vint_t vInt  = (vRound(vB) == vB) & (vAbsB <= 8.0);
+    vdbl_t vNum  = vBlend(vInt, vAbsB, vSet(0.0));
+    vdbl_t vRes  = vSet(1.0);
+    vdbl_t vBase = vA;
+    for(int i=0; i<4; i++) {
+        vdbl_t vHalf = vFloor(vNum*0.5);
+        vRes  = vBlend((vNum - 2.0*vHalf) != 0.0, vRes*vBase, vRes);
+        vBase = vBase*vBase;
+        vNum  = vHalf;
+    }
+    vint_t vNorm = (vAbs(vRes) >= DBL_MIN) & (vAbs(vRes) <= DBL_MAX);
+    vRes  = vBlend(vB < 0.0, 1.0/vRes, vRes);
+    vNorm = vNorm & (vAbs(vRes) >= DBL_MIN) & (vAbs(vRes) <= DBL_MAX);
+
+    // Everything else through exp and log where the base is positive. The rounding error of y*log(x) is magnified in the
+    // result, so this is limited to |y*log(x)| <= 4, which bounds the error to a few ulp.
+    vint_t vGen = ~vInt & (vA > 0.0) & vIsFinite(vA) & vIsFinite(vB);
+    if(vAny(vGen)) {
+        vdbl_t vT = vB * vLog(vBlend(vGen, vA, vSet(1.0)));
+        vGen = vGen & (vAbs(vT) <= 4.0);
+        vRes = vBlend(vGen, vExp(vT), vRes);
+    }
+
+    // Lanes that left the normal range on the way are recomputed, as are all remaining special cases
+    return vPatch2((~vInt & ~vGen) | (vInt & ~vNorm), vRes, vA, vB, sPow);
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: vCall
+ * ===================
+ *  Applies a double precision vector function. Single precision vectors are widened to two double vectors and the results
+ *  rounded back, which keeps float results within an ulp of the exact value.
+ */
+
+template<vdbl_t (*F)(vdbl_t)> static inline vdbl_t vCall(vdbl_t vA) {
+    return F(vA);
+}
+
+template<vdbl_t (*F)(vdbl_t,vdbl_t)> static inline vdbl_t vCall(vdbl_t vA, vdbl_t vB) {
+    return F(vA, vB);
+}
+
+static inline void vWiden(vflt_t vVal, vdbl_t* pLo, vdbl_t* pHi) {
+    vhflt_t vLo, vHi;
+    memcpy(&vLo, &vVal, sizeof(vLo));
+    memcpy(&vHi, (const char*)&vVal + sizeof(vLo), sizeof(vHi));
+    *pLo = __builtin_convertvector(vLo, vdbl_t);
+    *pHi = __builtin_convertvector(vHi, vdbl_t);
+}
+
+static inline vflt_t vNarrow(vdbl_t vLo, vdbl_t vHi) {
+    vhflt_t aHalf[2] = {__builtin_convertvector(vLo, vhflt_t), __builtin_convertvector(vHi, vhflt_t)};
+    vflt_t  vVal;
+    memcpy(&vVal, aHalf, sizeof(vVal));
+    return vVal;
+}
+
+template<vdbl_t (*F)(vdbl_t)> static inline vflt_t vCall(vflt_t vA) {
+    vdbl_t vLo, vHi;
+    vWiden(vA, &vLo, &vHi);
+    return vNarrow(F(vLo), F(vHi));
+}
+
+template<vdbl_t (*F)(vdbl_t,vdbl_t)> static inline vflt_t vCall(vflt_t vA, vflt_t vB) {
+    vdbl_t vLoA, vHiA, vLoB, vHiB;
+    vWiden(vA, &vLoA, &vHiA);
+    vWiden(vB, &vLoB, &vHiB);
+    return vNarrow(F(vLoA, vLoB), F(vHiA, vHiB));
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: evalTiles
+ * =======================
+ *  Vectorised block interpreter, same layout and semantics as Program::EvalBatch, for value type T in vectors of type V
+ *  Blocks of nTile rows are processed in whole vectors, so nTile must be a multiple of the number of lanes. The lanes past
+ *  the last row of a block are zero filled and never written out. Jumps are decided on the rows of the block only.
+ */
+
+template<typename T> static inline size_t countFalse(const T* pVal, size_t nBlock) {
+    size_t nFalse = 0;
+    for(size_t i=0; i<nBlock; i++) nFalse += pVal[i] == (T)EVAL_FALSE;
+    return nFalse;
+}
+
+#define SIMD_UNARY(EXPR) \
+    for(size_t i=0; i<nVec; i+=nLanes) { V a = vLoad(pTop+i); vStore(pTop+i, EXPR); } break
+#define SIMD_BINARY(EXPR) \
+    for(size_t i=0; i<nVec; i+=nLanes) { V a = vLoad(pTop+i); V b = vLoad(pL+i); vStore(pTop+i, EXPR); } break
+
+template<typename T, typename V> static bool evalTiles(const instr* pCode, const T* pConst, const T* const* ppColumns,
+                                                       size_t nRows, size_t nStride, T* const* ppOutputs, size_t nTile,
+                                                       T* pStack, T* pTemp) {
+
+    const size_t nLanes = sizeof(V)/sizeof(T);
+    const T      tFalse = (T)EVAL_FALSE;
+
+    for(size_t iRow=0; iRow<nRows; iRow+=nTile) {
+
+        size_t nBlock = std::min(nTile, nRows-iRow);
+        size_t nVec   = (nBlock + nLanes - 1)/nLanes*nLanes;
+        T*     pTop   = pStack - nTile;
+        T*     pL;
+        T*     pC;
+
+        for(const instr* pIns=pCode; pIns->op != EVAL_END; pIns++) {
+
+            if(pIns->size == 0) {
+                pTop += nTile;
+                if(pIns->op == EVAL_NUMBER) {
+                    V vVal = vSplat<V>(pConst[pIns->arg]);
+                    for(size_t i=0; i<nVec; i+=nLanes) vStore(pTop+i, vVal);
+                } else
+                if(pIns->op == EVAL_LOAD) {
+                    memcpy(pTop, pTemp + pIns->arg*nTile, nVec*sizeof(T));
+                } else {
+                    const T* pCol = ppColumns[pIns->arg] + iRow*nStride;
+                    if(nStride == 1) {
+                        memcpy(pTop, pCol, nBlock*sizeof(T));
+                    } else {
+                        for(size_t i=0; i<nBlock; i++) pTop[i] = pCol[i*nStride];
+                    }
+                    for(size_t i=nBlock; i<nVec; i++) pTop[i] = 0;
+                }
+                continue;
+            }
+
+            pTop -= (pIns->size-1)*nTile;
+            pL    = pTop + nTile;
+            pC    = pTop + 2*nTile;
+
+            switch(pIns->op) {
+            case EVAL_UNARY_PLUS:
+                break;
+            case EVAL_STORE:
+                memcpy(pTemp + pIns->arg*nTile, pTop, nVec*sizeof(T));
+                break;
+            case EVAL_OUTPUT:
+                memcpy(ppOutputs[pIns->arg]+iRow, pTop, nBlock*sizeof(T));
+                pTop -= nTile;
+                break;
+            case EVAL_UNARY_MINUS: SIMD_UNARY(-a);
+            case EVAL_FUNC_ABS:    SIMD_UNARY(vAbs(a));
+            case EVAL_FUNC_SIN:    SIMD_UNARY(vCall<vSin>(a));
+            case EVAL_FUNC_COS:    SIMD_UNARY(vCall<vCos>(a));
+            case EVAL_FUNC_TAN:    SIMD_UNARY(vCall<vTan>(a));
+            case EVAL_FUNC_ATAN:   SIMD_UNARY(vCall<vAtan>(a));
+            case EVAL_FUNC_EXP:    SIMD_UNARY(vCall<vExp>(a));
+            case EVAL_FUNC_LOG:    SIMD_UNARY(vCall<vLog>(a));
+            case EVAL_FUNC_ASIN:
+                for(size_t i=0; i<nVec; i++) pTop[i] = (T)asin((double_t)pTop[i]);
+                break;
+            case EVAL_FUNC_ACOS:
+                for(size_t i=0; i<nVec; i++) pTop[i] = (T)acos((double_t)pTop[i]);
+                break;
+            case EVAL_MATH_PLUS:   SIMD_BINARY(a + b);
+            case EVAL_MATH_MINUS:  SIMD_BINARY(a - b);
+            case EVAL_MATH_MULT:   SIMD_BINARY(a * b);
+            case EVAL_MATH_DIV:    SIMD_BINARY(a / b);
+            case EVAL_MATH_POW:    SIMD_BINARY(vCall<vPow>(a, b));
+            case EVAL_FUNC_ATAN2:  SIMD_BINARY(vCall<vAtan2>(a, b));
+            case EVAL_LOGICAL_AND: SIMD_BINARY(vBool((a != tFalse) & (b != tFalse)));
+            case EVAL_LOGICAL_OR:  SIMD_BINARY(vBool((a != tFalse) | (b != tFalse)));
+            case EVAL_LOGICAL_EQ:  SIMD_BINARY(vBool(a == b));
+            case EVAL_LOGICAL_NE:  SIMD_BINARY(vBool(a != b));
+            case EVAL_LOGICAL_LT:  SIMD_BINARY(vBool(a <  b));
+            case EVAL_LOGICAL_GT:  SIMD_BINARY(vBool(a >  b));
+            case EVAL_LOGICAL_LE:  SIMD_BINARY(vBool(a <= b));
+            case EVAL_LOGICAL_GE:  SIMD_BINARY(vBool(a >= b));
+            case EVAL_FUNC_MOD:
+                for(size_t i=0; i<nBlock; i++) {
+                    if(pTop[i] != floor(pTop[i]) || pL[i] != floor(pL[i])) {
+                        printf("Math Eval Error: Function mod() requires integer values\n");
+                        return false;
+                    }
+                    pTop[i] = (T)((int)floor(pTop[i])%(int)floor(pL[i]));
+                }
+                break;
+            case EVAL_SPECIAL_IF:
+                for(size_t i=0; i<nVec; i+=nLanes) {
+                    V a = vLoad(pTop+i);
+                    vStore(pTop+i, vBlend(a != tFalse, vLoad(pL+i), vLoad(pC+i)));
+                }
+                break;
+            case EVAL_JUMP_IF:
+                if(countFalse(pTop, nBlock) == nBlock) {
+                    pTop += nTile;
+                    pIns  = pCode + pIns->arg-1;
+                }
+                break;
+            case EVAL_JUMP:
+                pC = pTop - nTile;
+                if(countFalse(pC, nBlock) == 0) {
+                    memcpy(pC, pTop, nVec*sizeof(T));
+                    pTop = pC;
+                    pIns = pCode + pIns->arg-1;
+                }
+                break;
+            case EVAL_JUMP_AND:
+                if(countFalse(pTop, nBlock) == nBlock) {
+                    for(size_t i=0; i<nVec; i++) pTop[i] = tFalse;
+                    pIns = pCode + pIns->arg-1;
+                }
+                break;
+            case EVAL_JUMP_OR:
+                if(countFalse(pTop, nBlock) == 0) {
+                    for(size_t i=0; i<nVec; i++) pTop[i] = (T)EVAL_TRUE;
+                    pIns = pCode + pIns->arg-1;
+                }
+                break;
+            default:
+                printf("Math Eval Error: Unknown instruction %d\n", pIns->op);
+                return false;
+            }
+        }
+
+        if(pTop == pStack) memcpy(ppOutputs[0]+iRow, pStack, nBlock*sizeof(T));
+    }
+
+    return true;
+}
+
+#undef SIMD_UNARY
+#undef SIMD_BINARY
+#undef SIMD_SIGN
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: evalBatch
+ * =======================
+ *  Entry points for double and float columns
+ */
+
+bool evalBatch(const instr* pCode, const double_t* pConst, const double_t* const* ppColumns, size_t nRows, size_t nStride,
+               double_t* const* ppOutputs, size_t nTile, double_t* pStack, double_t* pTemp) {
+    return evalTiles<double_t,vdbl_t>(pCode, pConst, ppColumns, nRows, nStride, ppOutputs, nTile, pStack, pTemp);
+}
+
+bool evalBatchF(const instr* pCode, const float* pConst, const float* const* ppColumns, size_t nRows, size_t nStride,
+                float* const* ppOutputs, size_t nTile, float* pStack, float* pTemp) {
+    return evalTiles<float,vflt_t>(pCode, pConst, ppColumns, nRows, nStride, ppOutputs, nTile, pStack, pTemp);
+}
+
+} // End NameSpace
+} // End NameSpace
@@ -0,0 +1,11 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  SIMD Batch Kernels
+ *  SSE2 kernel, 2 doubles per vector
+ */
+
+#define SIMD_WIDTH     2
+#define SIMD_NAMESPACE simd_sse2
+
+#include "simdKernelImpl.hpp"
@@ -0,0 +1,162 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  Thread Pool
+ */
+
+#include "threadPool.hpp"
+
+using namespace std;
+using namespace smath;
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Constructor/Destructor
+ * ========================
+ *  The calling thread takes part in Run as worker 0, so nThreads-1 threads are started
+ */
+
+ThreadPool::ThreadPool(size_t nThreads) {
+
+    m_Workers = nThreads > 0 ? nThreads : 1;
+    m_Ranges.reset(new taskRange[m_Workers]);
+    for(size_t i=0; i<m_Workers; i++) m_Ranges[i].range = 0;
+
+    for(size_t i=1; i<m_Workers; i++) {
+        m_Threads.push_back(thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+
+    {
+        lock_guard<mutex> lGuard(m_Mutex);
+        m_Stop = true;
+    }
+    m_Wake.notify_all();
+
+    for(auto& tThread : m_Threads) tThread.join();
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Method :: Run
+ * ===============
+ *  Calls fTask(iTask, iWorker) once for every iTask below nTasks, and returns when all have completed. iWorker is below
+ *  threadCount() and identifies the thread, so tasks can use per-worker scratch space without locking. Only the first
+ *  nWorkers workers take part, or all of them if nWorkers is 0, so a pool started for the most threads serves any fewer.
+ */
+
+void ThreadPool::Run(size_t nTasks, const pooltask_t& fTask, size_t nWorkers) {
+
+    if(nTasks == 0) return;
+
+    size_t nUsed = (nWorkers > 0 && nWorkers < m_Workers) ? nWorkers : m_Workers;
+    for(size_t i=0; i<nUsed; i++) {
+        uint64_t iBegin = nTasks*i/nUsed;
+        uint64_t iEnd   = nTasks*(i+1)/nUsed;
+        m_Ranges[i].range = iBegin | iEnd << 32;
+    }
+    m_Task = &fTask;
+
+    // Workers left out of the last batch may still be reading m_Used as they go back to sleep
+    {
+        lock_guard<mutex> lGuard(m_Mutex);
+        m_Used = nUsed;
+        if(nUsed > 1) {
+            m_Active = nUsed - 1;
+            m_Generation++;
+        }
+    }
+    if(nUsed == 1) {
+        runTasks(0);
+        return;
+    }
+    m_Wake.notify_all();
+
+    runTasks(0);
+
+    unique_lock<mutex> lLock(m_Mutex);
+    m_Done.wait(lLock, [this]{ return m_Active == 0; });
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: workerLoop
+ * ========================
+ *  Sleeps until Run starts a new batch, takes part in it if it is one of the workers used, and reports back when no tasks
+ *  are left
+ */
+
+void ThreadPool::workerLoop(size_t iWorker) {
+
+    size_t iSeen = 0;
+
+    for(;;) {
+        {
+            unique_lock<mutex> lLock(m_Mutex);
+            m_Wake.wait(lLock, [&]{ return m_Stop || m_Generation != iSeen; });
+            if(m_Stop) return;
+            iSeen = m_Generation;
+            if(iWorker >= m_Used) continue;
+        }
+
+        runTasks(iWorker);
+
+        lock_guard<mutex> lGuard(m_Mutex);
+        if(--m_Active == 0) m_Done.notify_one();
+    }
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: runTasks
+ * ======================
+ */
+
+void ThreadPool::runTasks(size_t iWorker) {
+
+    size_t iTask;
+    while(takeTask(iWorker, &iTask)) {
+        (*m_Task)(iTask, iWorker);
+    }
+}
+
+// ****************************************************************************************************************************** //
+
+/**
+ *  Function :: takeTask
+ * ======================
+ *  Takes the next task from the front of the worker's own range, or else steals one from the back of another worker's range.
+ *  Both ends of a range are updated with a single compare and swap, so owner and thief never hand out the same task.
+ */
+
+bool ThreadPool::takeTask(size_t iWorker, size_t* pTask) {
+
+    for(size_t k=0; k<m_Used; k++) {
+
+        bool       isOwn  = k == 0;
+        taskRange& tRange = m_Ranges[(iWorker+k) % m_Used];
+        uint64_t   uRange = tRange.range.load();
+
+        for(;;) {
+            uint64_t iBegin = uRange & 0xffffffff;
+            uint64_t iEnd   = uRange >> 32;
+            if(iBegin >= iEnd) break;
+
+            uint64_t uNext = isOwn ? ((iBegin+1) | iEnd << 32) : (iBegin | (iEnd-1) << 32);
+            if(tRange.range.compare_exchange_weak(uRange, uNext)) {
+                *pTask = (size_t)(isOwn ? iBegin : iEnd-1);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// ****************************************************************************************************************************** //
@@ -0,0 +1,79 @@
+/**
+ *  Equation Nibbler Library
+ * ==========================
+ *  Thread Pool
+ *  A persistent pool of worker threads for splitting a batch of equal sized tasks. Each worker is given a contiguous range of
+ *  task indices to take from the front, and steals from the back of another worker's range when its own runs out.
+ */
+
+#ifndef THREAD_POOL
+#define THREAD_POOL
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <memory>
+
+namespace smath {
+
+typedef std::function<void(size_t, size_t)> pooltask_t;
+
+class ThreadPool {
+
+public:
+
+   /**
+    * Constructor/Destructor
+    */
+
+    ThreadPool(size_t);
+    ~ThreadPool();
+
+   /**
+    * Methods
+    */
+
+    size_t threadCount() { return m_Workers; };
+    void   Run(size_t, const pooltask_t&, size_t nWorkers=0);
+
+private:
+
+   /**
+    * Member Functions
+    */
+
+    void workerLoop(size_t);
+    void runTasks(size_t);
+    bool takeTask(size_t, size_t*);
+
+   /**
+    * Member Variables
+    */
+
+    // Task range of a worker, begin in the low and end in the high 32 bits, padded to its own cache line
+    struct taskRange {
+        std::atomic<uint64_t> range;
+        char                  pad[64-sizeof(std::atomic<uint64_t>)];
+    };
+
+    size_t                       m_Workers;
+    std::unique_ptr<taskRange[]> m_Ranges;
+    std::vector<std::thread>     m_Threads;
+
+    std::mutex                   m_Mutex;
+    std::condition_variable      m_Wake;
+    std::condition_variable      m_Done;
+    size_t                       m_Generation = 0;
+    size_t                       m_Active     = 0;
+    size_t                       m_Used       = 1;  // Workers taking part in the current batch
+    bool                         m_Stop       = false;
+    const pooltask_t*            m_Task       = nullptr;
+
+};
+
+} // End NameSpace
+
+#endif